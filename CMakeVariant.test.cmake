@@ -20,6 +20,9 @@ add_subdirectory("include")
 add_subdirectory("source")
 add_subdirectory("test/cunit")
 
+# C++ headers are checked against the lowest supported standard
+set_source_files_properties("test/cunit/test_message_schema_hpp.cpp" PROPERTIES COMPILE_FLAGS "-std=c++17")
+
 
 
 
@@ -0,0 +1,101 @@
+#ifndef __MX_DART_CAPTURE_H_
+#define __MX_DART_CAPTURE_H_
+
+
+#include "mx/core/dart.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+#define DART_CAPTURE_LINKTYPE           147     ///< LINKTYPE_USER0, reserved for private use
+#define DART_CAPTURE_SNAPLEN            0xFFFF
+
+
+
+/**
+ * \name Capture file format
+ * @{
+ *
+ * Captures are stored in classic pcap format (host byte order, millisecond precision) with
+ * LINKTYPE_USER0. Every packet starts with single byte pseudo header carrying direction,
+ * raw line bytes follow.
+ */
+enum dart_capture_dir_e
+{
+    DART_CAPTURE_TX,                ///< Bytes sent by the capturing side
+    DART_CAPTURE_RX,                ///< Bytes received by the capturing side
+};
+/** @} */
+
+
+
+/**
+ * Sink of flushed capture data
+ *
+ * Returns number of bytes actually written, less than 'length' means failure.
+ */
+typedef size_t (*dart_capture_write_fn)(void *private, const void *data, size_t length);
+
+
+
+/**
+ * Traffic recorder
+ *
+ * Records are kept in caller supplied ring buffer, the oldest ones are overwritten when it is
+ * full, so the buffer always holds the most recent traffic.
+ */
+struct dart_capture
+{
+    uint8_t *buffer;
+    uint32_t size;
+    uint32_t head;                  ///< Offset of the oldest record
+    uint32_t tail;                  ///< Offset of the newest record
+    uint32_t used;                  ///< Bytes occupied by records
+
+    uint32_t records;               ///< Records kept in buffer
+    uint32_t dropped;               ///< Records overwritten or too long to be kept
+    bool header_written;            ///< File header was flushed already
+    uint32_t flushed;               ///< Bytes of the oldest packet written by interrupted flush
+};
+
+
+/**
+ * Capture replay
+ *
+ * Feeds received bytes of the capture to DART instance, sent bytes are skipped.
+ */
+struct dart_replay
+{
+    struct dart *dart;
+    const uint8_t *data;
+    size_t length;
+    size_t offset;                  ///< Offset of the next packet
+    bool swapped;                   ///< Capture was written on host of other byte order
+
+    uint32_t speed;                 ///< Time acceleration, 0 feeds the whole capture at once
+    uint32_t first_tstamp;          ///< Time of the first packet
+    uint32_t start;                 ///< Time the first packet was fed
+    bool started;
+};
+
+
+
+void dart_capture_init(struct dart_capture *self, void *buffer, uint32_t size);
+void dart_capture_reset(struct dart_capture *self);
+
+void dart_capture_record(struct dart_capture *self, uint8_t dir, uint32_t tstamp, const uint8_t *data, uint32_t length);
+void dart_capture_recordv(struct dart_capture *self, uint8_t dir, uint32_t tstamp, const struct dart_iovec *iov, int iovcnt);
+void dart_capture_append(struct dart_capture *self, uint8_t dir, uint32_t tstamp, const uint8_t *data, uint32_t length);
+
+int dart_capture_flush(struct dart_capture *self, void *private, dart_capture_write_fn write);
+size_t dart_capture_fwrite(void *private, const void *data, size_t length);
+
+int dart_replay_init(struct dart_replay *self, struct dart *dart, const void *data, size_t length, uint32_t speed);
+int dart_replay_poll(struct dart_replay *self, uint32_t now);
+
+
+
+#endif /* __MX_DART_CAPTURE_H_ */
@@ -0,0 +1,80 @@
+
+
+#ifndef __MX_DART_LINUX_H_
+#define __MX_DART_LINUX_H_
+
+
+#include "mx/core/dart.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+#ifndef DART_LINUX_TX_BUFFER_LEN
+  #define DART_LINUX_TX_BUFFER_LEN          4096    // Bytes waiting for writable descriptor
+#endif
+#ifndef DART_LINUX_RX_CHUNK_LEN
+  #define DART_LINUX_RX_CHUNK_LEN           256     // Bytes read at once
+#endif
+
+
+
+
+
+enum dart_linux_pins_e
+{
+    DART_LINUX_PINS_SIMULATED,      ///< Pins kept in memory, RDY follows WRK of linked peer
+    DART_LINUX_PINS_MODEM,          ///< WRK drives RTS, RDY reads CTS
+};
+
+
+
+struct dart_linux;
+
+struct dart_linux_link
+{
+    struct dart *dart;
+    struct dart_linux *loop;
+    struct dart_linux_link *next;
+    struct dart_linux_link *peer;   ///< Simulated opponent, NULL means always ready
+
+    int fd;
+    int pins_mode;
+    bool pins[2];
+
+    uint8_t tx_buffer[DART_LINUX_TX_BUFFER_LEN];
+    size_t tx_head;
+    size_t tx_tail;
+    uint32_t tx_dropped;            ///< Bytes lost due to full tx buffer or failed link
+    bool tx_polling;
+    int error;                      ///< Errno of hangup or i/o failure, link is not polled then
+};
+
+
+struct dart_linux
+{
+    int epoll_fd;
+    struct dart_linux_link *links;
+};
+
+
+
+int dart_linux_init(struct dart_linux *self);
+void dart_linux_clean(struct dart_linux *self);
+
+int dart_linux_open(struct dart_linux *self, struct dart_linux_link *link, struct dart *dart,
+                    const char *path, uint32_t baudrate, int pins_mode);
+int dart_linux_open_pty(struct dart_linux *self,
+                        struct dart_linux_link *master, struct dart *master_dart,
+                        struct dart_linux_link *slave, struct dart *slave_dart);
+void dart_linux_close(struct dart_linux *self, struct dart_linux_link *link);
+
+int dart_linux_poll(struct dart_linux *self, int timeout);
+
+
+
+
+
+#endif /* __MX_DART_LINUX_H_ */
@@ -0,0 +1,154 @@
+#ifndef __MX_DART_STREAM_H_
+#define __MX_DART_STREAM_H_
+
+
+#include "mx/core/dart.h"
+#include "mx/core/message-schema.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+#ifndef DART_STREAM_FRAGMENT_LEN
+  #define DART_STREAM_FRAGMENT_LEN          64      // Payload bytes per fragment
+#endif
+#ifndef DART_STREAM_TX_DEPTH
+  #define DART_STREAM_TX_DEPTH              2       // Fragments queued in DART at once
+#endif
+
+
+#if (DART_STREAM_TX_DEPTH < 1) || (DART_STREAM_TX_DEPTH > 255)
+  #error Unsupported DART_STREAM_TX_DEPTH value
+#endif
+
+
+
+/**
+ * \name Stream fragment
+ * @{
+ *
+ * Every fragment carries stream id, flags, offset of its data and total payload length,
+ * fragment data follows the fixed part.
+ */
+#define DART_FRAGMENT_FIRST         0x01    ///< Fragment opens new stream
+#define DART_FRAGMENT_LAST          0x02    ///< Fragment completes stream
+
+#define MSG_FRAGMENT_FIELDS(FIELD, msg)                         \
+    FIELD(msg, uint8_t,  stream)                                \
+    FIELD(msg, uint8_t,  flags)                                 \
+    FIELD(msg, uint32_t, offset)                                \
+    FIELD(msg, uint32_t, total)
+
+MSG_SCHEMA(msg_fragment, MSG_FRAGMENT_FIELDS)
+
+_Static_assert(msg_fragment_size + DART_STREAM_FRAGMENT_LEN <= DART_MSG_MAX_LEN,
+               "DART_STREAM_FRAGMENT_LEN does not fit into DART message");
+/** @} */
+
+
+
+enum dart_stream_event_e
+{
+    DART_STREAM_STARTED,            ///< Opponent opened new stream
+    DART_STREAM_PROGRESS,           ///< Fragment was transferred or received
+    DART_STREAM_DONE,               ///< Whole payload was transferred or received
+    DART_STREAM_ABORTED,            ///< Stream was broken, payload is incomplete
+};
+
+
+enum dart_stream_dir_e
+{
+    DART_STREAM_TX,
+    DART_STREAM_RX,
+};
+
+
+
+/**
+ * Stream callbacks
+ *
+ * Source fills buffer with payload data starting at given offset and returns number of bytes
+ * provided. Sink stores received data at given offset, returning false aborts the stream.
+ * Progress callback reports bytes done out of total for given direction.
+ */
+typedef size_t (*dart_stream_read_fn)(void *private, uint32_t offset, uint8_t *buffer, size_t length);
+typedef bool (*dart_stream_write_fn)(void *private, uint32_t offset, const uint8_t *data, size_t length);
+typedef void (*dart_stream_callback_fn)(int event, int dir, uint32_t done, uint32_t total, void *private);
+
+
+
+struct dart_stream_tx
+{
+    dart_stream_read_fn read;
+    void *read_private;
+
+    uint8_t id;
+    uint32_t total;
+    uint32_t queued;                ///< Bytes passed to DART
+    uint32_t acked;                 ///< Bytes acknowledged by the opponent
+    uint8_t inflight;               ///< Fragments passed to DART, not acknowledged yet
+    bool active;
+};
+
+
+struct dart_stream_rx
+{
+    dart_stream_write_fn write;
+    void *write_private;
+
+    uint8_t id;
+    uint32_t total;
+    uint32_t received;
+    bool active;
+    bool completed;                 ///< Stream 'id' of 'total' bytes was received completely
+};
+
+
+struct dart_stream
+{
+    struct dart *dart;
+    msgtype_t msgtype;              ///< Message type carrying fragments
+
+    struct dart_stream_tx tx;
+    struct dart_stream_rx rx;
+    uint8_t next_id;
+
+    dart_stream_callback_fn callback;
+    void *callback_private;
+
+    dart_callback_fn dart_callback;         ///< Chained DART callback
+    void *dart_callback_private;
+};
+
+
+/**
+ * Caller supplied sink buffer, used with dart_stream_buffer_write()
+ *
+ */
+struct dart_stream_buffer
+{
+    uint8_t *data;
+    uint32_t size;
+};
+
+
+
+void dart_stream_init(struct dart_stream *self, struct dart *dart, msgtype_t msgtype);
+void dart_stream_clean(struct dart_stream *self);
+
+void dart_stream_set_callback(struct dart_stream *self, void *private, dart_stream_callback_fn callback);
+void dart_stream_set_sink(struct dart_stream *self, void *private, dart_stream_write_fn write);
+
+int dart_stream_send(struct dart_stream *self, uint32_t length, void *private, dart_stream_read_fn read);
+void dart_stream_abort(struct dart_stream *self);
+
+bool dart_stream_is_sending(struct dart_stream *self);
+bool dart_stream_is_receiving(struct dart_stream *self);
+
+bool dart_stream_buffer_write(void *private, uint32_t offset, const uint8_t *data, size_t length);
+
+
+
+#endif /* __MX_DART_STREAM_H_ */
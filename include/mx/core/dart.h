@@ -12,6 +12,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 
 
@@ -21,14 +22,62 @@
 #ifndef DART_CRC_SIZE
   #define DART_CRC_SIZE                     1
 #endif
+#ifndef DART_WINDOW_SIZE
+  #define DART_WINDOW_SIZE                  1       // Legacy stop-and-wait
+#endif
+#ifndef DART_PENDING_REQUESTS
+  #define DART_PENDING_REQUESTS             1       // Requests waiting for response at once
+#endif
+#ifndef DART_AGGR_MAX_MSGS
+  #define DART_AGGR_MAX_MSGS                8       // Messages per aggregated frame
+#endif
+#ifndef DART_BYTE_STUFFING
+  #define DART_BYTE_STUFFING                0       // Escape sync bytes within frames
+#endif
+#ifndef DART_STATS
+  #define DART_STATS                        0       // Link statistics
+#endif
+#ifndef DART_STATS_BUCKETS
+  #define DART_STATS_BUCKETS                12      // Latency histogram buckets
+#endif
+#ifndef DART_CAPTURE
+  #define DART_CAPTURE                      0       // Traffic capture hooks, see dart-capture.h
+#endif
+#ifndef DART_HANDLERS
+  #define DART_HANDLERS                     0       // Receive handler registrations, 0 disables registry
+#endif
+#ifndef DART_HANDLER_INDEX_BITS
+  #define DART_HANDLER_INDEX_BITS           8       // Handler lookup table is indexed by low msgtype bits
+#endif
+#ifndef DART_COMPRESSION
+  #define DART_COMPRESSION                  0       // Negotiated payload compression, see dart_set_compression()
+#endif
 
 
 #if (DART_LEN_SIZE != 1) && (DART_LEN_SIZE != 2)
   #error Unsupported DART_LEN_SIZE value
 #endif
-#if (DART_CRC_SIZE != 1) && (DART_CRC_SIZE != 2)
+#if (DART_CRC_SIZE != 1) && (DART_CRC_SIZE != 2) && (DART_CRC_SIZE != 4)
   #error Unsupported DART_CRC_SIZE value
 #endif
+#if (DART_WINDOW_SIZE < 1) || (DART_WINDOW_SIZE > 7)
+  #error Unsupported DART_WINDOW_SIZE value
+#endif
+#if (DART_PENDING_REQUESTS < 1) || (DART_PENDING_REQUESTS > 255)
+  #error Unsupported DART_PENDING_REQUESTS value
+#endif
+#if (DART_AGGR_MAX_MSGS < 1) || (DART_AGGR_MAX_MSGS > 255)
+  #error Unsupported DART_AGGR_MAX_MSGS value
+#endif
+#if (DART_STATS_BUCKETS < 2) || (DART_STATS_BUCKETS > 32)
+  #error Unsupported DART_STATS_BUCKETS value
+#endif
+#if (DART_HANDLERS < 0) || (DART_HANDLERS > 254)
+  #error Unsupported DART_HANDLERS value
+#endif
+#if (DART_HANDLER_INDEX_BITS < 1) || (DART_HANDLER_INDEX_BITS > 8 * MSGTYPE_SIZE)
+  #error Unsupported DART_HANDLER_INDEX_BITS value
+#endif
 
 
 
@@ -41,6 +90,18 @@
 #define DART_DONE       0xDD            ///< No more messages
 #define DART_EOC        0xEE            ///< End of communication
 
+#define DART_SYNC_SEQ   0x5A            ///< Synchronization of sequenced frame (windowed mode)
+#define DART_SYNC_AGG   0x5B            ///< Synchronization of aggregated frame
+#define DART_SYNC_LZ    0x5C            ///< Synchronization of compressed frame
+#define DART_SACK       0x60            ///< Cumulative acknowledge, ORed with sequence number
+#define DART_NAK        0x68            ///< Negative acknowledge, ORed with expected sequence number
+#define DART_HELLO      0x80            ///< Windowed mode negotiation, ORed with window size
+#define DART_AGG        0x88            ///< Aggregation negotiation
+#define DART_LZ         0x90            ///< Compression negotiation, ORed with decompressed size class
+#define DART_ESC        0x7D            ///< Escape of sync byte within frame (byte stuffing mode)
+
+#define DART_HDR_SEQ_MAX        8       ///< Number of sequence numbers in windowed mode
+
 
 
 enum dart_status_e
@@ -81,6 +142,7 @@ enum dart_callback_code_e
     DART_CLBK_TRANSFER_IMPOSSIBLE,  ///< Message was not transferred, connection not possible
     DART_CLBK_MESSAGE_RECEIVED,     ///< Received valid message
     DART_CLBK_MESSAGE_ABANDONED,    ///< No RESPONSE received for the REQUEST message
+    DART_CLBK_MESSAGE_EXPIRED,      ///< Message was not transferred before its deadline
 };
 
 
@@ -95,6 +157,13 @@ enum dart_callback_code_e
 #endif
 
 
+#if DART_WINDOW_SIZE > 1
+  #define DART_MSG_MAX_LEN      ((dart_len_t)~0 - 1)    // Sequenced frame header takes one byte
+#else
+  #define DART_MSG_MAX_LEN      ((dart_len_t)~0)
+#endif
+
+
 
 
 
@@ -102,10 +171,125 @@ struct dart;
 
 typedef void (*dart_callback_fn)(int code, void *param1, void *param2, void *private);
 typedef bool (*dart_deferred_msg_callback_fn)(struct dart *self, msgtype_t msgtype);
+typedef dart_len_t (*dart_msg_generator_fn)(struct msg *msg, dart_len_t max_len, void *private);
+typedef void (*dart_msg_handler_fn)(struct msg *msg, size_t msg_len, void *private);
+
+
+
+/**
+ * Round trip time estimation (Jacobson/Karels)
+ *
+ */
+struct dart_rtt
+{
+    uint32_t srtt;                  ///< Smoothed round trip time scaled by 8, 0 if not measured yet
+    uint32_t rttvar;                ///< Round trip time variation scaled by 4
+};
+
+
+
+#if DART_HANDLERS
+#define DART_HANDLER_INDEX_LEN      (1 << DART_HANDLER_INDEX_BITS)
 
 
+enum dart_handler_flags_e
+{
+    DART_HANDLER_VIEW = 0x00,       ///< Handler gets view of receive buffer, valid within the call only
+    DART_HANDLER_POST = 0x01,       ///< Message is copied and posted to process given as private
+    DART_HANDLER_NOTIFY = 0x02,     ///< DART_CLBK_MESSAGE_RECEIVED is raised as well
+};
+
+
+/**
+ * Receive handler registration
+ *
+ * Covers message types from 'first' to 'last' inclusive, ranges must not overlap.
+ */
+struct dart_handler
+{
+    msgtype_t first;
+    msgtype_t last;
+    uint8_t flags;
+    bool active;
+    dart_msg_handler_fn handler;
+    void *private;
+};
+#endif
+
 
 
+/**
+ * Request waiting for response
+ *
+ */
+struct dart_request
+{
+    struct msg_ptr *msg_ptr;        ///< Acknowledged request, NULL if slot is free
+    struct timer timer;             ///< Response timeout
+    uint32_t tstamp;                ///< Time the request was acknowledged
+};
+
+
+
+/**
+ * Link statistics
+ *
+ * Latency histograms are log2 scaled - bucket 0 counts samples below 1 ms, bucket n counts
+ * samples from 2^(n-1) to 2^n - 1 ms, the last bucket collects all longer ones.
+ */
+struct dart_stats
+{
+    uint32_t tx_frames;             ///< Frames sent, retransmissions included
+    uint32_t tx_bytes;              ///< Frame bytes sent, before byte stuffing
+    uint32_t tx_retries;            ///< Frames sent again
+    uint32_t tx_failures;           ///< Messages dropped after all attempts
+    uint32_t rx_frames;             ///< Valid frames received
+    uint32_t rx_bytes;              ///< Bytes of valid frames received
+    uint32_t rx_crc_errors;         ///< Frames with invalid crc or content
+    uint32_t rx_framing_errors;     ///< Frames with unsupported length or broken by sync byte
+    uint32_t rx_timeouts;           ///< Frames not completed in time
+    uint32_t ack_timeouts;          ///< Frames not acknowledged in time
+    uint32_t wakeup_attempts;       ///< Opponent wakeups
+    uint32_t requests_abandoned;    ///< Requests without response
+    uint32_t tx_compressed;         ///< Messages sent compressed
+    uint32_t tx_compress_saved;     ///< Bytes saved by compression
+    uint32_t tx_preemptions;        ///< Retransmissions postponed for more urgent message
+    uint32_t tx_cancelled;          ///< Queued messages cancelled before transfer
+
+    uint32_t ack_latency[DART_STATS_BUCKETS];       ///< Frame to acknowledge time
+    uint32_t response_latency[DART_STATS_BUCKETS];  ///< Request acknowledge to response time
+};
+
+
+
+struct dart_iovec
+{
+    uint8_t *base;
+    uint32_t length;
+};
+
+
+/**
+ * Transport operations of single link
+ *
+ * The 'private' parameter is the one given to dart_set_ops(). Optional operations may be
+ * NULL - 'sendv' falls back to 'send', 'get_milis' to clock_get_milis(). Buffers given to
+ * 'send' and 'sendv' are valid only for the duration of the call.
+ */
+struct dart_ops
+{
+    void (*send)(uint8_t *buffer, int32_t length, void *private);
+    void (*sendv)(const struct dart_iovec *iov, int iovcnt, void *private);
+    bool (*pin_get_state)(int pin_e, void *private);
+    void (*pin_set_state)(int pin_e, bool state, void *private);
+    uint32_t (*get_milis)(void *private);
+};
+
+
+
+
+
+struct dart_capture;
 
 struct dart
 {
@@ -113,24 +297,90 @@ struct dart
 
     struct msg_queue queue;
     struct msg_list *transfering;
-    struct msg_ptr* pending_request;
+    struct dart_request pending_requests[DART_PENDING_REQUESTS];
+    uint8_t request_tag_offset;     ///< Offset of request tag echoed by response, 0 if not used
 
     struct timer wakeup_timer;
     uint8_t wakeup_attempts;
 
     struct timer tx_ack_timer;
-    struct timer tx_response_timer;
     uint8_t tx_attempts;
+    uint32_t tx_tstamp;             ///< Time the current frame was sent
+    uint8_t tx_prio;                ///< Priority of the message being transferred
+
+    uint8_t preempt_prio;           ///< Least urgent priority allowed to preempt, DART_MSG_PRIO_ANY disables
+    struct msg_ptr *tx_preempted;   ///< Message waiting for retransmission behind preempting one
+    uint8_t tx_preempted_attempts;  ///< Attempts of preempted message
+
+    struct dart_rtt ack_rtt;        ///< Frame to acknowledge time
+    struct dart_rtt response_rtt;   ///< Request acknowledge to response time
+    uint8_t rto_backoff;            ///< Acknowledge timeout doubling after timeouts
+#if DART_STATS
+    struct dart_stats stats;
+#endif
+    uint8_t tx_batch;               ///< Number of messages carried by the frame being transferred
+
+    dart_len_t aggr_max_len;        ///< Aggregated frame size budget, 0 disables aggregation
+    uint32_t aggr_max_delay;        ///< Time the first message may wait for companions
+    bool aggr_offered;
+    bool aggr_peer;                 ///< Opponent accepts aggregated frames
+
+    struct dart_rtt idle_gap;       ///< Time from going quiet to the next activity
+    uint32_t idle_tstamp;           ///< Time the link went quiet
+    bool idle_sampling;             ///< Link is quiet, the next activity ends the gap
+    uint32_t keepalive_max;         ///< Longest time the link may be held awake, 0 disables
+
+#if DART_WINDOW_SIZE > 1
+    struct msg_list inflight;       ///< Sent, not acknowledged messages
+    uint8_t window;                 ///< Negotiated window size, 1 for legacy opponent
+    uint8_t tx_base;                ///< Sequence number of the oldest message in flight
+    uint8_t tx_hdr;                 ///< Header of the frame being pushed
+    uint32_t tx_seq_tstamp[DART_HDR_SEQ_MAX];   ///< Send time of every sequence number
+    uint8_t tx_resent;              ///< Mask of retransmitted sequence numbers (Karn's rule)
+    bool tx_sequenced;
+    bool tx_resync;
+    bool tx_nak_pending;
+    bool hello_sent;
+    uint8_t rx_seq;                 ///< Expected sequence number of the next frame
+    uint8_t rx_resync_seq;          ///< Sequence number of the last accepted RESYNC frame
+    bool rx_resynced;               ///< RESYNC frame may be retransmitted, its SACK was possibly lost
+    bool rx_nak_sent;
+#endif
 
     uint8_t *rx_buffer;
     uint16_t rx_buffer_size;
     uint16_t rx_buffer_bytes;
+    uint32_t rx_crc;
     struct timer rx_byte_timer;
+#if DART_BYTE_STUFFING
+    bool rx_escaped;                ///< Previous frame byte was escape
+#endif
+#if DART_CAPTURE
+    struct dart_capture *capture;   ///< Traffic recorder, NULL if not capturing
+#endif
+#if DART_COMPRESSION
+    uint8_t *lz_tx_buffer;          ///< Compressed outgoing frame
+    uint8_t *lz_rx_buffer;          ///< Decompressed incoming message
+    uint16_t lz_buffer_size;        ///< Size of each buffer
+    dart_len_t lz_threshold;        ///< Shortest message to compress, 0 disables compression
+    bool lz_offered;
+    uint16_t lz_peer_size;          ///< Longest message the opponent decompresses, 0 if not accepted
+#endif
+
+    const struct dart_ops *ops;
+    void *ops_private;
 
     dart_callback_fn callback;
     void *callback_private;
 
     dart_deferred_msg_callback_fn deferred_msg_callback;
+    uint8_t *deferred_buffer;       ///< Content of late-bound message is generated here
+    uint16_t deferred_buffer_size;
+
+#if DART_HANDLERS
+    struct dart_handler handlers[DART_HANDLERS];
+    uint8_t handler_index[DART_HANDLER_INDEX_LEN];  ///< Slot covering types of given low bits
+#endif
 
     struct timer closing_timer;
 
@@ -143,8 +393,40 @@ void dart_init(struct dart *self, void *mpool, uint16_t mpool_size, void *rx_buf
 void dart_clean(struct dart *self);
 void dart_reset(struct dart *self);
 
+void dart_set_ops(struct dart *self, void *private, const struct dart_ops *ops);
 void dart_set_callback(struct dart *self, void *private, dart_callback_fn callback);
 void dart_set_deferred_msg_callback(struct dart *self, dart_deferred_msg_callback_fn callback);
+void dart_set_deferred_buffer(struct dart *self, void *buffer, uint16_t size);
+
+#if DART_HANDLERS
+int dart_register_handler(struct dart *self, msgtype_t first, msgtype_t last, uint8_t flags, void *private, dart_msg_handler_fn handler);
+int dart_unregister_handler(struct dart *self, msgtype_t first);
+#endif
+
+void dart_set_max_delay(struct dart *self, uint8_t prio, uint32_t max_delay);
+void dart_set_edf(struct dart *self, uint8_t prio, bool edf);
+void dart_set_preemption(struct dart *self, uint8_t prio);
+uint32_t dart_get_worst_delay(struct dart *self, uint8_t prio);
+
+uint8_t dart_get_window(struct dart *self);
+uint32_t dart_get_ack_timeout(struct dart *self);
+uint32_t dart_get_response_timeout(struct dart *self);
+uint32_t dart_get_closing_time(struct dart *self);
+
+#if DART_STATS
+void dart_get_stats(struct dart *self, struct dart_stats *stats);
+void dart_reset_stats(struct dart *self);
+#endif
+#if DART_CAPTURE
+void dart_set_capture(struct dart *self, struct dart_capture *capture);
+#endif
+#if DART_COMPRESSION
+void dart_set_compression(struct dart *self, dart_len_t threshold, void *buffer, uint16_t size);
+#endif
+
+void dart_set_aggregation(struct dart *self, dart_len_t max_len, uint32_t max_delay);
+void dart_set_request_tag(struct dart *self, uint8_t offset);
+void dart_set_keepalive(struct dart *self, uint32_t max_hold);
 
 bool dart_is_idle(struct dart *self);
 bool dart_is_sending(struct dart *self);
@@ -156,9 +438,16 @@ bool dart_get_current_msgtype(struct dart *self, msgtype_t *type);
 void dart_handle_transfer_done(struct dart *self);
 int dart_handle_time(struct dart *self);
 void dart_handle_received_char(struct dart *self, uint8_t ch);
+void dart_handle_received_buffer(struct dart *self, const uint8_t *buffer, size_t length);
 
 int dart_send_msg_ex(struct dart *self, uint8_t prio, struct msg *msg, dart_len_t msg_len);
 int dart_send_msgtype_ex(struct dart *self, uint8_t prio, msgtype_t msgtype);
+int dart_send_msg_deadline(struct dart *self, uint8_t prio, struct msg *msg, dart_len_t msg_len, uint32_t deadline);
+int dart_forward_msg(struct dart *self, uint8_t prio, struct msg *msg);
+int dart_send_deferred(struct dart *self, uint8_t prio, msgtype_t msgtype, dart_msg_generator_fn generator, void *private);
+
+int dart_cancel_msgtype(struct dart *self, uint8_t prio, msgtype_t msgtype);
+int dart_cancel_msg(struct dart *self, struct msg *msg);
 
 int dart_send_msg(struct dart *self, struct msg *msg, dart_len_t msg_len);
 int dart_send_msgtype(struct dart *self, msgtype_t msgtype);
@@ -178,12 +467,16 @@ enum dart_pin_e
 };
 
 
+// Default transport, used unless dart_set_ops() is called
 extern bool dart_pin_get_state(int pin_e);
 extern void dart_pin_set_state(int pin_e, bool state);
 
+
 //extern void dart_uart_open(void);
 //extern void dart_uart_close(void);
 extern void dart_uart_send(uint8_t *buffer, int32_t length);
+extern void dart_uart_sendv(const struct dart_iovec *iov, int iovcnt);     // Optional, weak default
+
 
 
 
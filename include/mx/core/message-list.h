@@ -7,15 +7,23 @@
 #include "mx/core/message.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 
 
+struct cba;
+
 struct msg_ptr
 {
     struct msg_ptr *next;
     void *private;
     size_t length;
+    uint32_t tstamp;
+    uint32_t deadline;          // Valid only if 'has_deadline' is set, any value may be deadline
+    uint16_t refs;
+    bool has_deadline;
+    struct cba *cba;            // Last member before message, keeps it pointer aligned
     struct msg msg;
 };
 
@@ -24,10 +32,10 @@ struct msg_ptr
 
 
 
-struct cba;
-
 struct msg_ptr* msg_ptr_malloc(struct cba *cba, size_t msg_size);
+struct msg_ptr* msg_ptr_retain(struct msg_ptr *msg_ptr);
 struct msg_ptr* msg_ptr_free(struct cba *cba, struct msg_ptr *msg_ptr);
+bool msg_ptr_expired_at(struct msg_ptr *msg_ptr, uint32_t now);
 
 
 
@@ -47,10 +55,14 @@ struct msg_list
 void msg_list_init(struct msg_list *self);
 
 struct msg_ptr* msg_list_push(struct msg_list *self, struct msg_ptr *msg_ptr);
+struct msg_ptr* msg_list_insert_after(struct msg_list *self, struct msg_ptr *pos, struct msg_ptr *msg_ptr);
 struct msg_ptr* msg_list_pop(struct msg_list *self);
 struct msg_ptr* msg_list_peek(struct msg_list *self);
 struct msg_ptr* msg_list_remove(struct msg_list *self, struct msg_ptr *msg_ptr);
 
+void msg_list_splice(struct msg_list *self, struct msg_list *src);
+size_t msg_list_pop_n(struct msg_list *self, struct msg_list *dst, size_t n);
+
 struct msg_ptr* msg_list_find_msgtype(struct msg_list *self, msgtype_t type);
 
 size_t msg_list_length(struct msg_list *self);
@@ -7,6 +7,7 @@
 #include "mx/core/message-list.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 
@@ -31,6 +32,10 @@ enum msq_queue_priority_e
 struct msg_queue
 {
     struct msg_list list_prio[MSG_PRIO_LENGTH];
+
+    uint32_t max_delay[MSG_PRIO_LENGTH];        // Aging limit in ms, 0 means strict priority
+    uint32_t worst_delay[MSG_PRIO_LENGTH];      // Worst observed queueing delay in ms
+    bool edf[MSG_PRIO_LENGTH];                  // Earliest deadline first instead of FIFO order
 };
 
 
@@ -38,17 +43,31 @@ struct msg_queue
 
 
 void msg_queue_init(struct msg_queue *self);
+void msg_queue_reset(struct msg_queue *self);
 
 struct msg_list* msg_queue_get_msg_list(struct msg_queue *self, uint8_t prio);
+struct msg_list* msg_queue_select_msg_list(struct msg_queue *self, uint8_t *prio, uint8_t exclude);
+struct msg_list* msg_queue_select_msg_list_at(struct msg_queue *self, uint8_t *prio, uint8_t exclude, uint32_t now);
 
 struct msg_ptr* msg_queue_push(struct msg_queue *self, uint8_t prio, struct msg_ptr *msg);
+struct msg_ptr* msg_queue_push_at(struct msg_queue *self, uint8_t prio, struct msg_ptr *msg, uint32_t now);
+struct msg_ptr* msg_queue_push_pinned_at(struct msg_queue *self, uint8_t prio, struct msg_ptr *msg, uint32_t now, size_t pinned);
 struct msg_ptr* msg_queue_pop(struct msg_queue *self, uint8_t *prio);
 struct msg_ptr* msg_queue_peek(struct msg_queue *self, uint8_t *prio);
 
 struct msg_ptr* msg_queue_find_msgtype(struct msg_queue *self, uint8_t *prio, msgtype_t type);
 
+size_t msg_queue_drain_into(struct msg_queue *self, struct msg_list *dst);
+
 size_t msg_queue_length(struct msg_queue *self);
 
+void msg_queue_set_max_delay(struct msg_queue *self, uint8_t prio, uint32_t max_delay);
+void msg_queue_account_delay(struct msg_queue *self, uint8_t prio, struct msg_ptr *msg_ptr);
+void msg_queue_account_delay_at(struct msg_queue *self, uint8_t prio, struct msg_ptr *msg_ptr, uint32_t now);
+uint32_t msg_queue_get_worst_delay(struct msg_queue *self, uint8_t prio);
+
+void msg_queue_set_edf(struct msg_queue *self, uint8_t prio, bool edf);
+
 
 
 #endif /* __MX_MESSAGE_QUEUE_H_ */
@@ -0,0 +1,154 @@
+#ifndef __MX_MESSAGE_SCHEMA_H_
+#define __MX_MESSAGE_SCHEMA_H_
+
+
+#include "mx/core/message.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+/**
+ * \name Message schema
+ * @{
+ *
+ * Fixed layout message types generated from X-macro field lists.
+ *
+ * Fields are stored in big-endian byte order (same as DART length and crc), the wire
+ * structure is byte aligned so it may be used as a zero-copy view over a received buffer.
+ * Supported field types are uint8_t, uint16_t, uint32_t, int8_t, int16_t and int32_t, wider
+ * fields fail compilation (mx::be<T> of message-schema.hpp supports 64-bit fields).
+ *
+ * Definition:
+ *
+ *     #define MSG_TEMP_FIELDS(FIELD, msg)          \
+ *         FIELD(msg, int16_t,  temperature)        \
+ *         FIELD(msg, uint8_t,  sensor)
+ *
+ *     MSG_SCHEMA(msg_temp, MSG_TEMP_FIELDS)
+ *
+ * Generated:
+ *
+ *     struct msg_temp                  - wire layout, msg_temp_size bytes
+ *     struct msg_temp_host             - host layout, native types
+ *     msg_temp_view(msg, msg_len)      - zero-copy view, NULL if message is too short
+ *     msg_temp_get_<field>(wire)       - read single field from wire layout
+ *     msg_temp_set_<field>(wire, val)  - write single field into wire layout
+ *     msg_temp_pack(wire, host)        - convert host layout into wire layout
+ *     msg_temp_unpack(host, wire)      - convert wire layout into host layout
+ *
+ * Size may be verified against transport length type:
+ *
+ *     MSG_SCHEMA_ASSERT_LEN(msg_temp, dart_len_t);
+ *
+ * C++17 users may include mx/core/message-schema.hpp for typed wrappers.
+ *
+ */
+
+
+
+static inline uint32_t msg_schema_load_be(const uint8_t *buffer, size_t size)
+{
+    uint32_t value = 0;
+    for (size_t i=0; i<size; i++)
+        value = (value << 8) | buffer[i];
+    return value;
+}
+
+
+static inline void msg_schema_store_be(uint8_t *buffer, size_t size, uint32_t value)
+{
+    for (size_t i=size; i>0; i--) {
+        buffer[i-1] = (uint8_t)(value & 0xFF);
+        value >>= 8;
+    }
+}
+
+
+
+#define MSG_SCHEMA_WIRE_FIELD(schema, type, name)                                           \
+    uint8_t name[sizeof(type)];
+
+#define MSG_SCHEMA_HOST_FIELD(schema, type, name)                                           \
+    type name;
+
+#define MSG_SCHEMA_ACCESSORS(schema, type, name)                                            \
+_Static_assert(sizeof(type) <= sizeof(uint32_t), #schema "." #name " wider than 32 bits");  \
+static inline type schema##_get_##name(const struct schema *self)                           \
+{                                                                                           \
+    return (type)msg_schema_load_be(self->name, sizeof(type));                              \
+}                                                                                           \
+static inline void schema##_set_##name(struct schema *self, type value)                     \
+{                                                                                           \
+    msg_schema_store_be(self->name, sizeof(type), (uint32_t)value);                         \
+}
+
+#define MSG_SCHEMA_PACK_FIELD(schema, type, name)                                           \
+    schema##_set_##name(wire, host->name);
+
+#define MSG_SCHEMA_UNPACK_FIELD(schema, type, name)                                         \
+    host->name = schema##_get_##name(wire);
+
+
+
+/**
+ * Define message schema
+ *
+ * \param schema The name of generated message structure.
+ * \param fields The X-macro listing message fields.
+ *
+ * \hideinitializer
+ */
+#define MSG_SCHEMA(schema, fields)                                                          \
+struct schema                                                                               \
+{                                                                                           \
+    MSG_BASE();                                                                             \
+    fields(MSG_SCHEMA_WIRE_FIELD, schema)                                                   \
+}                                                                                           \
+__attribute__((packed));                                                                    \
+                                                                                            \
+struct schema##_host                                                                        \
+{                                                                                           \
+    msgtype_t type;                                                                         \
+    fields(MSG_SCHEMA_HOST_FIELD, schema)                                                   \
+};                                                                                          \
+                                                                                            \
+enum { schema##_size = sizeof(struct schema) };                                             \
+                                                                                            \
+fields(MSG_SCHEMA_ACCESSORS, schema)                                                        \
+                                                                                            \
+static inline const struct schema* schema##_view(const struct msg *msg, size_t msg_len)     \
+{                                                                                           \
+    if (!msg || msg_len < schema##_size)                                                    \
+        return NULL;                                                                        \
+    return (const struct schema*)msg;                                                       \
+}                                                                                           \
+                                                                                            \
+static inline void schema##_pack(struct schema *wire, const struct schema##_host *host)     \
+{                                                                                           \
+    wire->type = host->type;                                                                \
+    fields(MSG_SCHEMA_PACK_FIELD, schema)                                                   \
+}                                                                                           \
+                                                                                            \
+static inline void schema##_unpack(struct schema##_host *host, const struct schema *wire)   \
+{                                                                                           \
+    host->type = wire->type;                                                                \
+    fields(MSG_SCHEMA_UNPACK_FIELD, schema)                                                 \
+}
+
+/**
+ * Check message schema size against length type
+ *
+ * Fails compilation if message does not fit into length field, i.e. dart_len_t.
+ *
+ * \hideinitializer
+ */
+#define MSG_SCHEMA_ASSERT_LEN(schema, len_type)                                             \
+    _Static_assert(schema##_size <= (len_type)~0, #schema " does not fit into " #len_type)
+
+/** @} */
+
+
+
+#endif /* __MX_MESSAGE_SCHEMA_H_ */
@@ -0,0 +1,100 @@
+#ifndef __MX_MESSAGE_SCHEMA_HPP_
+#define __MX_MESSAGE_SCHEMA_HPP_
+
+
+// Flexible array member of struct msg_data is C only
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#include "mx/core/message.h"
+#pragma GCC diagnostic pop
+
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+
+
+
+namespace mx {
+
+
+/**
+ * Big-endian field
+ *
+ * Byte aligned storage for integral field, may be used as member of packed message.
+ *
+ */
+template <typename T>
+struct be
+{
+    static_assert(std::is_integral<T>::value, "be<T> requires integral type");
+
+    constexpr T get() const
+    {
+        std::make_unsigned_t<T> value = 0;
+        for (std::size_t i=0; i<sizeof(T); i++)
+            value = static_cast<std::make_unsigned_t<T>>((value << 8) | bytes[i]);
+        return static_cast<T>(value);
+    }
+
+    constexpr void set(T value)
+    {
+        auto raw = static_cast<std::make_unsigned_t<T>>(value);
+        for (std::size_t i=sizeof(T); i>0; i--) {
+            bytes[i-1] = static_cast<std::uint8_t>(raw & 0xFF);
+            raw = static_cast<std::make_unsigned_t<T>>(raw >> 8);
+        }
+    }
+
+    constexpr operator T() const  { return get(); }
+    be& operator=(T value)        { set(value); return *this; }
+
+    std::uint8_t bytes[sizeof(T)];
+};
+
+static_assert(alignof(be<std::uint32_t>) == 1, "be<T> must be byte aligned");
+static_assert(std::is_trivial<be<std::uint32_t>>::value, "be<T> must be trivial");
+
+
+
+/**
+ * Message size constant
+ *
+ */
+template <typename M>
+constexpr std::size_t msg_size = sizeof(M);
+
+
+
+/**
+ * Check message size against length type, i.e. dart_len_t
+ *
+ */
+template <typename M, typename Len>
+constexpr bool msg_fits = (sizeof(M) <= std::numeric_limits<Len>::max());
+
+
+
+/**
+ * Zero-copy message view
+ *
+ * Returns nullptr if received message is shorter than requested type.
+ *
+ */
+template <typename M>
+const M* msg_view(const struct msg *msg, std::size_t msg_len)
+{
+    static_assert(std::is_standard_layout<M>::value, "message must have standard layout");
+    static_assert(alignof(M) == 1, "message must be packed");
+
+    if (!msg || msg_len < sizeof(M))
+        return nullptr;
+    return reinterpret_cast<const M*>(msg);
+}
+
+
+} // namespace mx
+
+
+
+#endif /* __MX_MESSAGE_SCHEMA_HPP_ */
@@ -290,6 +290,10 @@ struct msg* process_free(struct msg *msg);
 // post message object allocated with process_alloc()
 int process_post_msg(struct process *p, struct msg *msg);
 
+// keep or pass received message object without copying, release with process_free()
+struct msg* process_take_msg(struct msg *msg);
+int process_forward_msg(struct process *p, struct msg *msg);
+
 // handle message object synchronously
 void process_handle_msg(struct process *p, struct msg *msg);
 void process_handle_msg_p0(struct process *p, msgtype_t type);
@@ -22,6 +22,8 @@ struct scheduler
     struct msg_list messages;
     struct cba cba;
 
+    struct msg_ptr *dispatched;
+
     unsigned int poll_requested;
 
 };
@@ -41,7 +43,10 @@ struct process* scheduler_get_current_process(struct scheduler *self);
 struct msg* scheduler_malloc(struct scheduler *self, uint32_t size);
 struct msg* scheduler_free(struct scheduler *self, struct msg *msg);
 
+struct msg* scheduler_take_msg(struct scheduler *self, struct msg *msg);
+
 void scheduler_post_msg(struct scheduler *self, struct process *proc, struct msg *msg);
+struct msg* scheduler_forward_msg(struct scheduler *self, struct process *proc, struct msg *msg);
 void scheduler_handle_msg(struct scheduler *self, struct process *proc, struct msg *msg);
 
 void scheduler_timer_start(struct scheduler *self, struct process_timer *timer, uint32_t time_ms);
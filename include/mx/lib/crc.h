@@ -0,0 +1,122 @@
+#ifndef __MX_LIB_CRC_H_
+#define __MX_LIB_CRC_H_
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+#define CRC16_ENGINE_SHIFT                  0       // No tables, smallest code
+#define CRC16_ENGINE_NIBBLE                 1       // 32 bytes table
+#define CRC16_ENGINE_TABLE                  2       // 512 bytes table
+#define CRC16_ENGINE_SLICE4                 3       // 2 KB tables
+#define CRC16_ENGINE_SLICE8                 4       // 4 KB tables
+
+#ifndef CRC16_ENGINE
+  #if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+    #define CRC16_ENGINE                    CRC16_ENGINE_SLICE8     // Host build
+  #else
+    #define CRC16_ENGINE                    CRC16_ENGINE_NIBBLE     // Flash constrained target
+  #endif
+#endif
+#ifndef CRC_ENGINES_ALL
+  #if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+    #define CRC_ENGINES_ALL                 1       // Host build, engines may be compared
+  #else
+    #define CRC_ENGINES_ALL                 0       // Only selected engines and their tables
+  #endif
+#endif
+
+#define CRC16_ENGINE_BUILT(engine)          (CRC_ENGINES_ALL || (CRC16_ENGINE == (engine)))
+
+
+#define CRC16_CCITT_INIT                    0xFFFF
+
+
+
+uint16_t crc16_ccitt_shift(uint16_t crc, const uint8_t *buffer, size_t length);
+#if CRC16_ENGINE_BUILT(CRC16_ENGINE_NIBBLE)
+uint16_t crc16_ccitt_nibble(uint16_t crc, const uint8_t *buffer, size_t length);
+#endif
+#if CRC16_ENGINE_BUILT(CRC16_ENGINE_TABLE)
+uint16_t crc16_ccitt_table(uint16_t crc, const uint8_t *buffer, size_t length);
+#endif
+#if CRC16_ENGINE_BUILT(CRC16_ENGINE_SLICE4)
+uint16_t crc16_ccitt_slice4(uint16_t crc, const uint8_t *buffer, size_t length);
+#endif
+#if CRC16_ENGINE_BUILT(CRC16_ENGINE_SLICE8)
+uint16_t crc16_ccitt_slice8(uint16_t crc, const uint8_t *buffer, size_t length);
+#endif
+
+
+
+/**
+ * Calculate CRC-16/CCITT-FALSE with engine selected at compile time
+ *
+ * Start with CRC16_CCITT_INIT, 'crc' may be the result of previous call to continue calculation.
+ * All engines give identical result.
+ */
+static inline uint16_t crc16_ccitt(uint16_t crc, const uint8_t *buffer, size_t length)
+{
+#if CRC16_ENGINE == CRC16_ENGINE_SHIFT
+    return crc16_ccitt_shift(crc, buffer, length);
+#elif CRC16_ENGINE == CRC16_ENGINE_NIBBLE
+    return crc16_ccitt_nibble(crc, buffer, length);
+#elif CRC16_ENGINE == CRC16_ENGINE_TABLE
+    return crc16_ccitt_table(crc, buffer, length);
+#elif CRC16_ENGINE == CRC16_ENGINE_SLICE4
+    return crc16_ccitt_slice4(crc, buffer, length);
+#elif CRC16_ENGINE == CRC16_ENGINE_SLICE8
+    return crc16_ccitt_slice8(crc, buffer, length);
+#else
+  #error Unsupported CRC16_ENGINE value
+#endif
+}
+
+
+
+
+#define CRC32C_ENGINE_SHIFT                 0       // No table, bit at a time
+#define CRC32C_ENGINE_TABLE                 1       // 1 KB table
+
+#ifndef CRC32C_ENGINE
+  #if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+    #define CRC32C_ENGINE                   CRC32C_ENGINE_TABLE     // Host build
+  #else
+    #define CRC32C_ENGINE                   CRC32C_ENGINE_SHIFT     // Flash constrained target
+  #endif
+#endif
+
+#if (CRC32C_ENGINE != CRC32C_ENGINE_SHIFT) && (CRC32C_ENGINE != CRC32C_ENGINE_TABLE)
+  #error Unsupported CRC32C_ENGINE value
+#endif
+
+
+#define CRC32C_INIT                         0xFFFFFFFF
+#define CRC32C_XOROUT                       0xFFFFFFFF
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  #define CRC32C_HW_X86                     1
+#else
+  #define CRC32C_HW_X86                     0
+#endif
+
+
+
+uint32_t crc32c_sw(uint32_t crc, const uint8_t *buffer, size_t length);
+#if CRC32C_HW_X86
+uint32_t crc32c_hw(uint32_t crc, const uint8_t *buffer, size_t length);
+#endif
+
+/**
+ * Calculate CRC-32C, dispatched at runtime
+ *
+ * Start with CRC32C_INIT, 'crc' may be the result of previous call to continue calculation.
+ * Final value has to be XORed with CRC32C_XOROUT.
+ */
+uint32_t crc32c(uint32_t crc, const uint8_t *buffer, size_t length);
+
+
+
+#endif /* __MX_LIB_CRC_H_ */
@@ -0,0 +1,47 @@
+#ifndef __MX_LIB_LZSS_H_
+#define __MX_LIB_LZSS_H_
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+#ifndef LZSS_WINDOW
+  #define LZSS_WINDOW                       256     // Searched distance, trades ratio for CPU time
+#endif
+
+
+#define LZSS_MIN_MATCH                      3
+#define LZSS_MAX_MATCH                      18
+#define LZSS_MAX_OFFSET                     4096
+
+#if (LZSS_WINDOW < 1) || (LZSS_WINDOW > LZSS_MAX_OFFSET)
+  #error Unsupported LZSS_WINDOW value
+#endif
+
+
+/**
+ * Worst case compressed length, i.e. literals only
+ *
+ */
+#define LZSS_BOUND(len)                     ((len) + ((len) + 7) / 8)
+
+
+
+/**
+ * \name Stream format
+ * @{
+ *
+ * Every group of up to 8 items is preceded by flags byte, bit 0 describes the first item.
+ * Bit value 0 means literal byte, value 1 means match - two bytes holding 12 bits of offset
+ * minus 1 and 4 bits of length minus LZSS_MIN_MATCH, most significant first. Matches may
+ * overlap decoded data. No tables are needed, compressor searches input itself, decompressor
+ * copies from output itself.
+ */
+size_t lzss_compress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_size);
+size_t lzss_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_size);
+/** @} */
+
+
+#endif /* __MX_LIB_LZSS_H_ */
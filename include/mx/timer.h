@@ -93,4 +93,31 @@ static inline bool timer_expired(struct timer *self)
 }
 
 
+
+// Variants taking explicit time stamp, for modules driven by their own clock
+
+static inline void timer_start_at(struct timer *self, uint8_t flags, uint32_t interval, uint32_t now)
+{
+    self->flags = flags;
+    self->start = now;
+    self->interval = interval;
+}
+
+
+static inline void timer_restart_at(struct timer *self, uint32_t now)
+{
+    self->start = now;
+}
+
+
+static inline bool timer_expired_at(struct timer *self, uint32_t now)
+{
+    if (self->interval == 0)
+        return false;
+    if (now - self->start < self->interval)
+        return false;
+    return true;
+}
+
+
 #endif /* __MX_TIMER_H_ */
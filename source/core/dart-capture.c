@@ -0,0 +1,400 @@
+
+#include "mx/core/dart-capture.h"
+#include "mx/misc.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+
+
+#define DART_PCAP_MAGIC                 0xA1B2C3D4
+#define DART_PCAP_MAGIC_SWAPPED         0xD4C3B2A1
+#define DART_PCAP_VERSION_MAJOR         2
+#define DART_PCAP_VERSION_MINOR         4
+
+
+struct dart_pcap_file_hdr
+{
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+
+struct dart_pcap_packet_hdr
+{
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+
+struct dart_capture_hdr
+{
+    uint32_t tstamp;
+    uint16_t length;
+    uint8_t dir;
+    uint8_t reserved;
+};
+
+
+
+
+
+/**
+ * Copy data into ring buffer at given offset
+ *
+ */
+static void dart_capture_put(struct dart_capture *self, uint32_t offset, const void *data, uint32_t length)
+{
+    uint32_t pos = offset % self->size;
+    uint32_t first = MIN(length, self->size - pos);
+
+    memcpy(&self->buffer[pos], data, first);
+    memcpy(self->buffer, (const uint8_t*)data + first, length - first);
+}
+
+
+/**
+ * Copy data from ring buffer at given offset
+ *
+ */
+static void dart_capture_get(struct dart_capture *self, uint32_t offset, void *data, uint32_t length)
+{
+    uint32_t pos = offset % self->size;
+    uint32_t first = MIN(length, self->size - pos);
+
+    memcpy(data, &self->buffer[pos], first);
+    memcpy((uint8_t*)data + first, self->buffer, length - first);
+}
+
+
+/**
+ * Write part of flushed packet
+ *
+ * Packet is written by several calls, 'pos' is offset of given part within the packet. Bytes
+ * written by interrupted flush are skipped, so retried packet continues where it stopped.
+ */
+static bool dart_capture_write(struct dart_capture *self, uint32_t *pos, const void *data, uint32_t length, void *private, dart_capture_write_fn write)
+{
+    uint32_t start = *pos;
+    *pos += length;
+    if (self->flushed >= start + length)
+        return true;
+
+    uint32_t skip = self->flushed - start;
+    size_t written = write(private, (const uint8_t*)data + skip, length - skip);
+    self->flushed += (uint32_t)MIN(written, (size_t)(length - skip));
+    return written == length - skip;
+}
+
+
+/**
+ * Check if the oldest record is partially written by interrupted flush
+ *
+ */
+static bool dart_capture_is_head_flushing(struct dart_capture *self)
+{
+    return self->header_written && self->flushed;
+}
+
+
+/**
+ * Release the oldest record
+ *
+ */
+static void dart_capture_pop(struct dart_capture *self, const struct dart_capture_hdr *hdr)
+{
+    uint32_t length = (uint32_t)sizeof(*hdr) + hdr->length;
+
+    self->head = (self->head + length) % self->size;
+    self->used -= length;
+    self->records--;
+}
+
+
+
+
+
+/**
+ * Initialize recorder
+ *
+ */
+void dart_capture_init(struct dart_capture *self, void *buffer, uint32_t size)
+{
+    self->buffer = (uint8_t*)buffer;
+    self->size = size;
+    dart_capture_reset(self);
+}
+
+
+/**
+ * Drop all records, the next flush starts new file
+ *
+ */
+void dart_capture_reset(struct dart_capture *self)
+{
+    self->head = 0;
+    self->tail = 0;
+    self->used = 0;
+    self->records = 0;
+    self->dropped = 0;
+    self->header_written = false;
+    self->flushed = 0;
+}
+
+
+/**
+ * Record chunk of line bytes
+ *
+ */
+void dart_capture_record(struct dart_capture *self, uint8_t dir, uint32_t tstamp, const uint8_t *data, uint32_t length)
+{
+    struct dart_iovec iov = {
+        .base = (uint8_t*)data,
+        .length = length
+    };
+
+    dart_capture_recordv(self, dir, tstamp, &iov, 1);
+}
+
+
+/**
+ * Record chunk of line bytes given by segments
+ *
+ * Segments form single record. The oldest records are overwritten to make room, so the call
+ * costs a few memcpy() and never blocks. Should be called from the context running DART
+ * handlers, as well as dart_capture_flush().
+ */
+void dart_capture_recordv(struct dart_capture *self, uint8_t dir, uint32_t tstamp, const struct dart_iovec *iov, int iovcnt)
+{
+    struct dart_capture_hdr hdr;
+    uint32_t length = 0;
+
+    for (int i=0; i<iovcnt; i++)
+        length += iov[i].length;
+
+    uint32_t needed = (uint32_t)sizeof(hdr) + length;
+    if (length > DART_CAPTURE_SNAPLEN - 1 || needed > self->size) {
+        self->dropped++;
+        return;
+    }
+
+    while (self->size - self->used < needed) {
+        if (dart_capture_is_head_flushing(self)) {
+            self->dropped++;                // Partially written record has to be completed
+            return;
+        }
+        struct dart_capture_hdr oldest;
+        dart_capture_get(self, self->head, &oldest, sizeof(oldest));
+        dart_capture_pop(self, &oldest);
+        self->dropped++;
+    }
+
+    hdr.tstamp = tstamp;
+    hdr.length = (uint16_t)length;
+    hdr.dir = dir;
+    hdr.reserved = 0;
+
+    uint32_t offset = self->head + self->used;
+    self->tail = offset % self->size;
+    dart_capture_put(self, offset, &hdr, sizeof(hdr));
+    offset += sizeof(hdr);
+    for (int i=0; i<iovcnt; i++) {
+        dart_capture_put(self, offset, iov[i].base, iov[i].length);
+        offset += iov[i].length;
+    }
+
+    self->used += needed;
+    self->records++;
+}
+
+
+/**
+ * Record line bytes, join them with the newest record if possible
+ *
+ * Bytes of the same direction captured within the same millisecond extend the newest record,
+ * so byte by byte reception does not cost record per byte. New record is started otherwise.
+ */
+void dart_capture_append(struct dart_capture *self, uint8_t dir, uint32_t tstamp, const uint8_t *data, uint32_t length)
+{
+    struct dart_capture_hdr hdr;
+
+    if (self->records && self->size - self->used >= length) {
+        dart_capture_get(self, self->tail, &hdr, sizeof(hdr));
+        bool flushing = (self->records == 1 && dart_capture_is_head_flushing(self));
+        if (hdr.dir == dir && hdr.tstamp == tstamp && !flushing && hdr.length + length <= DART_CAPTURE_SNAPLEN - 1) {
+            dart_capture_put(self, self->tail + (uint32_t)sizeof(hdr) + hdr.length, data, length);
+            hdr.length = (uint16_t)(hdr.length + length);
+            dart_capture_put(self, self->tail, &hdr, sizeof(hdr));
+            self->used += length;
+            return;
+        }
+    }
+
+    dart_capture_record(self, dir, tstamp, data, length);
+}
+
+
+/**
+ * Write recorded traffic in pcap format
+ *
+ * File header is written by the first flush, following flushes append packets only. Flushed
+ * records are released, the record which failed to write and the following ones are kept.
+ * Flush which failed in the middle of packet is continued by the next one where it stopped,
+ * so the file stays consistent. Returns number of written packets.
+ */
+int dart_capture_flush(struct dart_capture *self, void *private, dart_capture_write_fn write)
+{
+    uint32_t pos;
+
+    if (!self->header_written) {
+        struct dart_pcap_file_hdr file_hdr = {
+            .magic = DART_PCAP_MAGIC,
+            .version_major = DART_PCAP_VERSION_MAJOR,
+            .version_minor = DART_PCAP_VERSION_MINOR,
+            .thiszone = 0,
+            .sigfigs = 0,
+            .snaplen = DART_CAPTURE_SNAPLEN,
+            .linktype = DART_CAPTURE_LINKTYPE,
+        };
+        pos = 0;
+        if (!dart_capture_write(self, &pos, &file_hdr, sizeof(file_hdr), private, write))
+            return DART_ERR_NOT_POSSIBLE;
+        self->header_written = true;
+        self->flushed = 0;
+    }
+
+    int cnt = 0;
+    while (self->records) {
+        struct dart_capture_hdr hdr;
+        dart_capture_get(self, self->head, &hdr, sizeof(hdr));
+
+        struct dart_pcap_packet_hdr packet_hdr = {
+            .ts_sec = hdr.tstamp / 1000,
+            .ts_usec = (hdr.tstamp % 1000) * 1000,
+            .incl_len = 1 + (uint32_t)hdr.length,
+            .orig_len = 1 + (uint32_t)hdr.length,
+        };
+
+        // Record data is written directly from the ring, in two parts if it wraps
+        uint32_t data_pos = (self->head + (uint32_t)sizeof(hdr)) % self->size;
+        uint32_t first = MIN(hdr.length, self->size - data_pos);
+        pos = 0;
+        bool ok = dart_capture_write(self, &pos, &packet_hdr, sizeof(packet_hdr), private, write)
+               && dart_capture_write(self, &pos, &hdr.dir, sizeof(hdr.dir), private, write)
+               && dart_capture_write(self, &pos, &self->buffer[data_pos], first, private, write)
+               && dart_capture_write(self, &pos, self->buffer, hdr.length - first, private, write);
+
+        if (!ok)
+            return DART_ERR_NOT_POSSIBLE;   // Rest of record is written by the next flush
+        dart_capture_pop(self, &hdr);
+        self->flushed = 0;
+        cnt++;
+    }
+
+    return cnt;
+}
+
+
+/**
+ * Sink writing into stdio stream given as private parameter
+ *
+ */
+size_t dart_capture_fwrite(void *private, const void *data, size_t length)
+{
+    return fwrite(data, 1, length, (FILE*)private);
+}
+
+
+
+
+
+static uint32_t dart_replay_u32(struct dart_replay *self, const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return self->swapped ? __builtin_bswap32(value) : value;
+}
+
+
+/**
+ * Initialize replay of pcap capture held in memory
+ *
+ * Capture time is divided by 'speed', i.e. 1 replays traffic at original pace, 10 ten times
+ * faster. Value 0 feeds all packets on the first poll.
+ */
+int dart_replay_init(struct dart_replay *self, struct dart *dart, const void *data, size_t length, uint32_t speed)
+{
+    const uint8_t *bytes = (const uint8_t*)data;
+
+    self->dart = dart;
+    self->data = bytes;
+    self->length = length;
+    self->offset = sizeof(struct dart_pcap_file_hdr);
+    self->speed = speed;
+    self->started = false;
+
+    if (length < sizeof(struct dart_pcap_file_hdr))
+        return DART_ERR_BAD_LENGTH;
+
+    uint32_t magic;
+    memcpy(&magic, bytes, sizeof(magic));
+    if (magic != DART_PCAP_MAGIC && magic != DART_PCAP_MAGIC_SWAPPED)
+        return DART_ERR_NOT_SUPPORTED;
+    self->swapped = (magic == DART_PCAP_MAGIC_SWAPPED);
+
+    if (dart_replay_u32(self, &bytes[offsetof(struct dart_pcap_file_hdr, linktype)]) != DART_CAPTURE_LINKTYPE)
+        return DART_ERR_NOT_SUPPORTED;
+
+    return DART_SUCCESS;
+}
+
+
+/**
+ * Feed packets which are due at given time
+ *
+ * Should be called periodically, e.g. next to dart_handle_time(). Received bytes are passed
+ * to dart_handle_received_char() one by one, like an interrupt handler would do. Returns
+ * DART_PENDING until the whole capture is replayed.
+ */
+int dart_replay_poll(struct dart_replay *self, uint32_t now)
+{
+    while (self->offset < self->length) {
+        const uint8_t *packet = &self->data[self->offset];
+        if (self->length - self->offset < sizeof(struct dart_pcap_packet_hdr))
+            return DART_ERR_BAD_LENGTH;
+
+        uint32_t ts_sec = dart_replay_u32(self, &packet[offsetof(struct dart_pcap_packet_hdr, ts_sec)]);
+        uint32_t ts_usec = dart_replay_u32(self, &packet[offsetof(struct dart_pcap_packet_hdr, ts_usec)]);
+        uint32_t incl_len = dart_replay_u32(self, &packet[offsetof(struct dart_pcap_packet_hdr, incl_len)]);
+        uint32_t tstamp = ts_sec * 1000 + ts_usec / 1000;
+
+        if (incl_len < 1 || incl_len > self->length - self->offset - sizeof(struct dart_pcap_packet_hdr))
+            return DART_ERR_BAD_LENGTH;
+
+        if (!self->started) {
+            self->started = true;
+            self->first_tstamp = tstamp;
+            self->start = now;
+        }
+        if (self->speed && now - self->start < (tstamp - self->first_tstamp) / self->speed)
+            return DART_PENDING;
+
+        const uint8_t *data = &packet[sizeof(struct dart_pcap_packet_hdr)];
+        if (data[0] == DART_CAPTURE_RX) {
+            for (uint32_t i=1; i<incl_len; i++)
+                dart_handle_received_char(self->dart, data[i]);
+        }
+
+        self->offset += sizeof(struct dart_pcap_packet_hdr) + incl_len;
+    }
+
+    return DART_SUCCESS;
+}
@@ -0,0 +1,537 @@
+#ifdef __linux__
+
+#define _GNU_SOURCE
+
+#include "mx/core/dart-linux.h"
+#include "mx/misc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+
+
+
+
+#define DART_LINUX_EVENTS_MAX       16
+#define DART_LINUX_IOV_MAX          32
+
+
+
+/**
+ * Translate baudrate into termios speed
+ *
+ */
+static speed_t dart_linux_speed(uint32_t baudrate)
+{
+    switch (baudrate) {
+        case 1200:      return B1200;
+        case 2400:      return B2400;
+        case 4800:      return B4800;
+        case 9600:      return B9600;
+        case 19200:     return B19200;
+        case 38400:     return B38400;
+        case 57600:     return B57600;
+        case 115200:    return B115200;
+        case 230400:    return B230400;
+        case 460800:    return B460800;
+        case 921600:    return B921600;
+    }
+
+    return B0;
+}
+
+
+/**
+ * Configure raw, non-blocking terminal
+ *
+ * Baudrate 0 keeps current speed (e.g. pty).
+ */
+static int dart_linux_setup_tty(int fd, uint32_t baudrate)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) < 0)
+        return DART_ERR_NOT_POSSIBLE;
+
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    if (baudrate) {
+        speed_t speed = dart_linux_speed(baudrate);
+        if (speed == B0) {
+            errno = EINVAL;
+            return DART_ERR_NOT_SUPPORTED;
+        }
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
+
+    if (tcsetattr(fd, TCSANOW, &tio) < 0)
+        return DART_ERR_NOT_POSSIBLE;
+
+    return DART_SUCCESS;
+}
+
+
+
+
+
+/**
+ * Check if errno means that descriptor is not ready, not that it failed
+ *
+ */
+static bool dart_linux_is_busy(int err)
+{
+    return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+}
+
+
+/**
+ * Stop serving failed link
+ *
+ * Descriptor is removed from event loop, so hangup does not wake it up again, buffered bytes
+ * are dropped. Link stays open until dart_linux_close().
+ */
+static void dart_linux_fail(struct dart_linux_link *link, int err)
+{
+    if (link->error)
+        return;
+
+    link->error = err;
+    link->tx_dropped += (uint32_t)(link->tx_tail - link->tx_head);
+    link->tx_head = 0;
+    link->tx_tail = 0;
+    link->tx_polling = false;
+    if (link->loop)
+        epoll_ctl(link->loop->epoll_fd, EPOLL_CTL_DEL, link->fd, NULL);
+}
+
+
+/**
+ * Watch descriptor for writability only when there are buffered bytes
+ *
+ */
+static void dart_linux_set_tx_polling(struct dart_linux_link *link, bool enable)
+{
+    if (link->tx_polling == enable || !link->loop || link->error)
+        return;
+
+    struct epoll_event ev = {
+        .events = EPOLLIN | (enable ? EPOLLOUT : 0),
+        .data.ptr = link,
+    };
+    epoll_ctl(link->loop->epoll_fd, EPOLL_CTL_MOD, link->fd, &ev);
+    link->tx_polling = enable;
+}
+
+
+/**
+ * Buffer bytes which could not be written now
+ *
+ * Bytes not fitting into buffer are dropped, protocol retransmits the frame.
+ */
+static void dart_linux_queue(struct dart_linux_link *link, const uint8_t *buffer, size_t length)
+{
+    if (link->tx_tail + length > sizeof(link->tx_buffer) && link->tx_head) {
+        memmove(link->tx_buffer, &link->tx_buffer[link->tx_head], link->tx_tail - link->tx_head);
+        link->tx_tail -= link->tx_head;
+        link->tx_head = 0;
+    }
+
+    size_t space = sizeof(link->tx_buffer) - link->tx_tail;
+    if (length > space) {
+        link->tx_dropped += (uint32_t)(length - space);
+        length = space;
+    }
+
+    memcpy(&link->tx_buffer[link->tx_tail], buffer, length);
+    link->tx_tail += length;
+
+    dart_linux_set_tx_polling(link, true);
+}
+
+
+/**
+ * Write buffered bytes
+ *
+ */
+static void dart_linux_flush(struct dart_linux_link *link)
+{
+    while (link->tx_head < link->tx_tail) {
+        ssize_t written = write(link->fd, &link->tx_buffer[link->tx_head], link->tx_tail - link->tx_head);
+        if (written < 0 && !dart_linux_is_busy(errno)) {
+            dart_linux_fail(link, errno);
+            return;
+        }
+        if (written <= 0)
+            return;     // Wait for the next EPOLLOUT
+        link->tx_head += (size_t)written;
+    }
+
+    link->tx_head = 0;
+    link->tx_tail = 0;
+    dart_linux_set_tx_polling(link, false);
+}
+
+
+
+
+
+static void dart_linux_send(uint8_t *buffer, int32_t length, void *private)
+{
+    struct dart_linux_link *link = (struct dart_linux_link*)private;
+    size_t remaining = (size_t)length;
+
+    if (link->tx_head == link->tx_tail && !link->error) {
+        // Nothing buffered, bytes may go directly
+        ssize_t written = write(link->fd, buffer, remaining);
+        if (written > 0) {
+            buffer += written;
+            remaining -= (size_t)written;
+        } else if (written < 0 && !dart_linux_is_busy(errno)) {
+            dart_linux_fail(link, errno);
+        }
+    }
+
+    if (link->error)
+        link->tx_dropped += (uint32_t)remaining;
+    else if (remaining)
+        dart_linux_queue(link, buffer, remaining);
+}
+
+
+static void dart_linux_sendv(const struct dart_iovec *iov, int iovcnt, void *private)
+{
+    struct dart_linux_link *link = (struct dart_linux_link*)private;
+    struct iovec vec[DART_LINUX_IOV_MAX];
+    ssize_t written = 0;
+
+    if (link->tx_head == link->tx_tail && iovcnt > 0 && iovcnt <= DART_LINUX_IOV_MAX && !link->error) {
+        // Nothing buffered, whole frame within single system call
+        for (int i=0; i<iovcnt; i++) {
+            vec[i].iov_base = iov[i].base;
+            vec[i].iov_len = iov[i].length;
+        }
+        written = writev(link->fd, vec, iovcnt);
+        if (written < 0) {
+            if (!dart_linux_is_busy(errno))
+                dart_linux_fail(link, errno);
+            written = 0;
+        }
+    }
+
+    for (int i=0; i<iovcnt; i++) {
+        size_t skip = ((size_t)written < iov[i].length) ? (size_t)written : iov[i].length;
+        written -= (ssize_t)skip;
+        if (skip == iov[i].length)
+            continue;
+        if (link->error)
+            link->tx_dropped += (uint32_t)(iov[i].length - skip);
+        else
+            dart_linux_queue(link, &iov[i].base[skip], iov[i].length - skip);
+    }
+}
+
+
+static bool dart_linux_pin_get_state(int pin_e, void *private)
+{
+    struct dart_linux_link *link = (struct dart_linux_link*)private;
+
+    if (link->pins_mode == DART_LINUX_PINS_MODEM) {
+        int lines = 0;
+        if (ioctl(link->fd, TIOCMGET, &lines) < 0)
+            return false;
+        return (lines & ((pin_e == DART_RDY_PIN) ? TIOCM_CTS : TIOCM_RTS)) ? true : false;
+    }
+
+    if (pin_e == DART_RDY_PIN)
+        return link->peer ? link->peer->pins[DART_WRK_PIN] : true;
+
+    return link->pins[pin_e];
+}
+
+
+static void dart_linux_pin_set_state(int pin_e, bool state, void *private)
+{
+    struct dart_linux_link *link = (struct dart_linux_link*)private;
+
+    if (link->pins_mode == DART_LINUX_PINS_MODEM && pin_e == DART_WRK_PIN) {
+        int lines = TIOCM_RTS;
+        ioctl(link->fd, state ? TIOCMBIS : TIOCMBIC, &lines);
+    }
+
+    link->pins[pin_e] = state;
+}
+
+
+static uint32_t dart_linux_get_milis(void *private)
+{
+    UNUSED(private);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+}
+
+
+static const struct dart_ops dart_linux_ops = {
+    .send = dart_linux_send,
+    .sendv = dart_linux_sendv,
+    .pin_get_state = dart_linux_pin_get_state,
+    .pin_set_state = dart_linux_pin_set_state,
+    .get_milis = dart_linux_get_milis,
+};
+
+
+
+
+
+/**
+ * Initialize event loop
+ *
+ */
+int dart_linux_init(struct dart_linux *self)
+{
+    self->links = NULL;
+    self->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (self->epoll_fd < 0)
+        return DART_ERR_NOT_POSSIBLE;
+
+    return DART_SUCCESS;
+}
+
+
+/**
+ * Cleanup event loop, close all links
+ *
+ */
+void dart_linux_clean(struct dart_linux *self)
+{
+    while (self->links)
+        dart_linux_close(self, self->links);
+
+    if (self->epoll_fd >= 0)
+        close(self->epoll_fd);
+    self->epoll_fd = -1;
+}
+
+
+/**
+ * Bind descriptor to dart instance and register it within event loop
+ *
+ */
+static int dart_linux_attach(struct dart_linux *self, struct dart_linux_link *link, struct dart *dart, int fd, int pins_mode)
+{
+    link->dart = dart;
+    link->loop = self;
+    link->peer = NULL;
+    link->fd = fd;
+    link->pins_mode = pins_mode;
+    link->pins[DART_WRK_PIN] = false;
+    link->pins[DART_RDY_PIN] = false;
+    link->tx_head = 0;
+    link->tx_tail = 0;
+    link->tx_dropped = 0;
+    link->tx_polling = false;
+    link->error = 0;
+
+    struct epoll_event ev = {
+        .events = EPOLLIN,
+        .data.ptr = link,
+    };
+    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        return DART_ERR_NOT_POSSIBLE;
+
+    link->next = self->links;
+    self->links = link;
+
+    dart_set_ops(dart, link, &dart_linux_ops);
+    if (pins_mode == DART_LINUX_PINS_MODEM)
+        dart_linux_pin_set_state(DART_WRK_PIN, false, link);
+
+    return DART_SUCCESS;
+}
+
+
+/**
+ * Open serial device
+ *
+ * Baudrate 0 keeps current device speed.
+ */
+int dart_linux_open(struct dart_linux *self, struct dart_linux_link *link, struct dart *dart,
+                    const char *path, uint32_t baudrate, int pins_mode)
+{
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return DART_ERR_NOT_POSSIBLE;
+
+    int ret = dart_linux_setup_tty(fd, baudrate);
+    if (ret == DART_SUCCESS)
+        ret = dart_linux_attach(self, link, dart, fd, pins_mode);
+    if (ret != DART_SUCCESS) {
+        int err = errno;
+        close(fd);
+        errno = err;
+    }
+
+    return ret;
+}
+
+
+/**
+ * Open pseudo terminal pair connecting two dart instances
+ *
+ * Pins are simulated, RDY of one side follows WRK of the other one.
+ */
+int dart_linux_open_pty(struct dart_linux *self,
+                        struct dart_linux_link *master, struct dart *master_dart,
+                        struct dart_linux_link *slave, struct dart *slave_dart)
+{
+    char name[64];
+    int slave_fd = -1;
+    int master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (master_fd < 0)
+        return DART_ERR_NOT_POSSIBLE;
+
+    if (grantpt(master_fd) < 0 || unlockpt(master_fd) < 0 || ptsname_r(master_fd, name, sizeof(name)) != 0)
+        goto error;
+
+    slave_fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (slave_fd < 0)
+        goto error;
+
+    // Line discipline settings belong to the slave side
+    if (dart_linux_setup_tty(slave_fd, 0) != DART_SUCCESS)
+        goto error;
+
+    if (dart_linux_attach(self, master, master_dart, master_fd, DART_LINUX_PINS_SIMULATED) != DART_SUCCESS)
+        goto error;
+    if (dart_linux_attach(self, slave, slave_dart, slave_fd, DART_LINUX_PINS_SIMULATED) != DART_SUCCESS) {
+        int err = errno;
+        dart_linux_close(self, master);
+        if (slave_fd >= 0)
+            close(slave_fd);
+        errno = err;
+        return DART_ERR_NOT_POSSIBLE;
+    }
+
+    master->peer = slave;
+    slave->peer = master;
+    return DART_SUCCESS;
+
+error: {
+        int err = errno;
+        if (slave_fd >= 0)
+            close(slave_fd);
+        close(master_fd);
+        errno = err;
+    }
+    return DART_ERR_NOT_POSSIBLE;
+}
+
+
+/**
+ * Close link, dart instance is bound back to default transport
+ *
+ */
+void dart_linux_close(struct dart_linux *self, struct dart_linux_link *link)
+{
+    for (struct dart_linux_link **it = &self->links; *it; it = &(*it)->next) {
+        if (*it == link) {
+            *it = link->next;
+            break;
+        }
+    }
+
+    if (link->peer)
+        link->peer->peer = NULL;
+    link->peer = NULL;
+
+    if (!link->error)
+        epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, link->fd, NULL);
+    close(link->fd);
+    link->fd = -1;
+    link->loop = NULL;
+
+    dart_set_ops(link->dart, NULL, NULL);
+}
+
+
+/**
+ * Read all available bytes and pass them to receiver
+ *
+ */
+static void dart_linux_receive(struct dart_linux_link *link)
+{
+    uint8_t chunk[DART_LINUX_RX_CHUNK_LEN];
+
+    while (!link->error) {
+        ssize_t received = read(link->fd, chunk, sizeof(chunk));
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received < 0 && !dart_linux_is_busy(errno))
+            dart_linux_fail(link, errno);
+        if (received <= 0)
+            return;
+        dart_handle_received_buffer(link->dart, chunk, (size_t)received);
+    }
+}
+
+
+/**
+ * Wait for events and handle all links
+ *
+ * Timeout is given in milliseconds, dart_handle_time() is called for every link afterwards,
+ * hence timeout should not exceed 1ms while links are active. Returns number of handled
+ * events or negative value on failure. DART_ERR_NOT_POSSIBLE with errno of the link is also
+ * returned while there is a link which hung up or failed, it is marked by 'error' and should
+ * be closed by dart_linux_close().
+ */
+int dart_linux_poll(struct dart_linux *self, int timeout)
+{
+    int err = 0;
+
+    struct epoll_event events[DART_LINUX_EVENTS_MAX];
+
+    int cnt = epoll_wait(self->epoll_fd, events, DART_LINUX_EVENTS_MAX, timeout);
+    if (cnt < 0) {
+        if (errno != EINTR)
+            return DART_ERR_NOT_POSSIBLE;
+        cnt = 0;
+    }
+
+    for (int i=0; i<cnt; i++) {
+        struct dart_linux_link *link = (struct dart_linux_link*)events[i].data.ptr;
+        if (events[i].events & EPOLLOUT)
+            dart_linux_flush(link);
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            dart_linux_receive(link);   // Pending bytes are received before hangup
+        if (events[i].events & (EPOLLHUP | EPOLLERR))
+            dart_linux_fail(link, (events[i].events & EPOLLERR) ? EIO : EPIPE);
+    }
+
+    for (struct dart_linux_link *link = self->links; link; link = link->next) {
+        dart_handle_time(link->dart);
+        if (link->error)
+            err = link->error;
+    }
+
+    if (err) {
+        errno = err;
+        return DART_ERR_NOT_POSSIBLE;
+    }
+    return cnt;
+}
+
+
+#endif /* __linux__ */
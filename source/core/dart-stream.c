@@ -0,0 +1,369 @@
+
+#include "mx/core/dart-stream.h"
+#include "mx/misc.h"
+
+#include <stddef.h>
+#include <string.h>
+
+
+
+
+
+/**
+ * Stream event notification
+ *
+ */
+static void dart_stream_callback(struct dart_stream *self, int event, int dir, uint32_t done, uint32_t total)
+{
+    if (self->callback)
+        self->callback(event, dir, done, total, self->callback_private);
+}
+
+
+/**
+ * Check if message is fragment of given stream
+ *
+ */
+static const struct msg_fragment* dart_stream_view(struct dart_stream *self, void *msg, size_t msg_len)
+{
+    if (!msg || ((struct msg*)msg)->type != self->msgtype)
+        return NULL;
+
+    return msg_fragment_view((struct msg*)msg, msg_len);
+}
+
+
+
+
+
+/**
+ * Stop sending, fragments already passed to DART are not recalled
+ *
+ */
+static void dart_stream_abort_tx(struct dart_stream *self)
+{
+    struct dart_stream_tx *tx = &self->tx;
+
+    if (!tx->active)
+        return;
+
+    tx->active = false;
+    dart_stream_callback(self, DART_STREAM_ABORTED, DART_STREAM_TX, tx->acked, tx->total);
+}
+
+
+/**
+ * Pass next fragments to DART
+ *
+ * Only DART_STREAM_TX_DEPTH fragments are queued at once, so neither side has to keep the
+ * whole payload in memory. Data is read from the source just before queuing.
+ */
+static void dart_stream_fill(struct dart_stream *self)
+{
+    struct dart_stream_tx *tx = &self->tx;
+    uint8_t buffer[msg_fragment_size + DART_STREAM_FRAGMENT_LEN];
+    struct msg_fragment *fragment = (struct msg_fragment*)buffer;
+
+    // Empty payload is carried by single fragment
+    while (tx->active && tx->inflight < DART_STREAM_TX_DEPTH && (tx->queued < tx->total || tx->total == 0)) {
+        uint32_t length = MIN(tx->total - tx->queued, DART_STREAM_FRAGMENT_LEN);
+        if (length && tx->read(tx->read_private, tx->queued, &buffer[msg_fragment_size], length) != length) {
+            dart_stream_abort_tx(self);
+            return;
+        }
+
+        uint8_t flags = 0;
+        if (tx->queued == 0)
+            flags |= DART_FRAGMENT_FIRST;
+        if (tx->queued + length == tx->total)
+            flags |= DART_FRAGMENT_LAST;
+
+        fragment->type = self->msgtype;
+        msg_fragment_set_stream(fragment, tx->id);
+        msg_fragment_set_flags(fragment, flags);
+        msg_fragment_set_offset(fragment, tx->queued);
+        msg_fragment_set_total(fragment, tx->total);
+
+        int ret = dart_send_msg_ex(self->dart, DART_MSG_PRIO_ANY, (struct msg*)fragment, (dart_len_t)(msg_fragment_size + length));
+        if (ret == DART_ERR_NO_MEMORY && tx->inflight) {
+            break;      // Try again when queued fragment is released
+        }
+        if (ret < 0) {
+            dart_stream_abort_tx(self);
+            return;
+        }
+
+        tx->queued += length;
+        tx->inflight++;
+        if (tx->total == 0)
+            break;
+    }
+}
+
+
+/**
+ * Handle result of fragment transfer
+ *
+ */
+static void dart_stream_handle_tx_result(struct dart_stream *self, int code, const struct msg_fragment *fragment, size_t msg_len)
+{
+    struct dart_stream_tx *tx = &self->tx;
+
+    if (!tx->active || msg_fragment_get_stream(fragment) != tx->id)
+        return;
+
+    tx->inflight--;
+    if (code != DART_CLBK_TRANSFER_DONE) {
+        // Opponent will notice the gap and drop the stream as well
+        dart_stream_abort_tx(self);
+        return;
+    }
+
+    tx->acked += (uint32_t)(msg_len - msg_fragment_size);
+    if (tx->acked == tx->total && tx->inflight == 0 && tx->queued == tx->total) {
+        tx->active = false;
+        dart_stream_callback(self, DART_STREAM_DONE, DART_STREAM_TX, tx->acked, tx->total);
+        return;
+    }
+
+    dart_stream_callback(self, DART_STREAM_PROGRESS, DART_STREAM_TX, tx->acked, tx->total);
+    dart_stream_fill(self);
+}
+
+
+
+
+
+/**
+ * Drop stream being received
+ *
+ */
+static void dart_stream_abort_rx(struct dart_stream *self)
+{
+    struct dart_stream_rx *rx = &self->rx;
+
+    if (!rx->active)
+        return;
+
+    rx->active = false;
+    dart_stream_callback(self, DART_STREAM_ABORTED, DART_STREAM_RX, rx->received, rx->total);
+}
+
+
+/**
+ * Handle received fragment
+ *
+ * Fragments are expected in order, duplicates (retransmitted after lost acknowledge) are
+ * ignored, even the first fragment of already completed stream. Gap in offsets means
+ * a fragment was lost, so the stream is aborted.
+ */
+static void dart_stream_handle_fragment(struct dart_stream *self, const struct msg_fragment *fragment, size_t msg_len)
+{
+    struct dart_stream_rx *rx = &self->rx;
+    uint8_t id = msg_fragment_get_stream(fragment);
+    uint8_t flags = msg_fragment_get_flags(fragment);
+    uint32_t offset = msg_fragment_get_offset(fragment);
+    uint32_t total = msg_fragment_get_total(fragment);
+    uint32_t length = (uint32_t)(msg_len - msg_fragment_size);
+
+    if (flags & DART_FRAGMENT_FIRST) {
+        if (rx->id == id && rx->total == total && (rx->completed || (rx->active && rx->received > 0)))
+            return;     // Duplicate
+
+        dart_stream_abort_rx(self);
+        rx->id = id;
+        rx->total = total;
+        rx->received = 0;
+        rx->active = true;
+        rx->completed = false;
+        dart_stream_callback(self, DART_STREAM_STARTED, DART_STREAM_RX, 0, total);
+    }
+
+    if (!rx->active || rx->id != id)
+        return;
+
+    if (offset < rx->received)
+        return;         // Duplicate
+
+    if (offset > rx->received || total != rx->total || length > total - offset) {
+        dart_stream_abort_rx(self);
+        return;
+    }
+
+    if (length && (!rx->write || !rx->write(rx->write_private, offset, (const uint8_t*)fragment + msg_fragment_size, length))) {
+        dart_stream_abort_rx(self);
+        return;
+    }
+
+    rx->received += length;
+    if (rx->received == rx->total) {
+        rx->active = false;
+        rx->completed = true;
+        dart_stream_callback(self, DART_STREAM_DONE, DART_STREAM_RX, rx->received, rx->total);
+    }
+    else {
+        dart_stream_callback(self, DART_STREAM_PROGRESS, DART_STREAM_RX, rx->received, rx->total);
+    }
+}
+
+
+
+
+
+/**
+ * DART callback
+ *
+ * Fragments are consumed, remaining events are passed to the chained callback.
+ */
+static void dart_stream_dart_callback(int code, void *param1, void *param2, void *private)
+{
+    struct dart_stream *self = (struct dart_stream*)private;
+    const struct msg_fragment *fragment = dart_stream_view(self, param1, (size_t)param2);
+
+    if (fragment) {
+        switch (code) {
+            case DART_CLBK_MESSAGE_RECEIVED:
+                dart_stream_handle_fragment(self, fragment, (size_t)param2);
+                return;
+            case DART_CLBK_TRANSFER_DONE:
+            case DART_CLBK_TRANSFER_FAILURE:
+            case DART_CLBK_MESSAGE_EXPIRED:
+                dart_stream_handle_tx_result(self, code, fragment, (size_t)param2);
+                return;
+        }
+    }
+
+    if (self->dart_callback)
+        self->dart_callback(code, param1, param2, self->dart_callback_private);
+}
+
+
+
+
+
+/**
+ * Initialize stream layer
+ *
+ * Takes over DART callback, which should be set before, and forwards all events except the
+ * ones related to fragments of given message type.
+ */
+void dart_stream_init(struct dart_stream *self, struct dart *dart, msgtype_t msgtype)
+{
+    self->dart = dart;
+    self->msgtype = msgtype;
+
+    self->tx.active = false;
+    self->rx.active = false;
+    self->rx.completed = false;
+    self->rx.write = NULL;
+    self->rx.write_private = NULL;
+    self->next_id = 0;
+
+    self->callback = NULL;
+    self->callback_private = NULL;
+
+    self->dart_callback = dart->callback;
+    self->dart_callback_private = dart->callback_private;
+    dart_set_callback(dart, self, dart_stream_dart_callback);
+}
+
+
+/**
+ * Cleanup stream layer
+ *
+ * Restores chained DART callback.
+ */
+void dart_stream_clean(struct dart_stream *self)
+{
+    self->tx.active = false;
+    self->rx.active = false;
+
+    dart_set_callback(self->dart, self->dart_callback_private, self->dart_callback);
+}
+
+
+/**
+ * Stream event callback setter
+ *
+ */
+void dart_stream_set_callback(struct dart_stream *self, void *private, dart_stream_callback_fn callback)
+{
+    self->callback = callback;
+    self->callback_private = private;
+}
+
+
+/**
+ * Received data sink setter
+ *
+ */
+void dart_stream_set_sink(struct dart_stream *self, void *private, dart_stream_write_fn write)
+{
+    self->rx.write = write;
+    self->rx.write_private = private;
+}
+
+
+/**
+ * Start sending payload of given length
+ *
+ * Data is pulled from the source fragment by fragment. Only one stream may be sent at once.
+ */
+int dart_stream_send(struct dart_stream *self, uint32_t length, void *private, dart_stream_read_fn read)
+{
+    struct dart_stream_tx *tx = &self->tx;
+
+    if (tx->active || !read)
+        return DART_ERR_NOT_POSSIBLE;
+
+    tx->read = read;
+    tx->read_private = private;
+    tx->id = self->next_id++;
+    tx->total = length;
+    tx->queued = 0;
+    tx->acked = 0;
+    tx->inflight = 0;
+    tx->active = true;
+
+    dart_stream_fill(self);
+
+    return tx->active ? DART_SUCCESS : DART_ERR_NOT_POSSIBLE;
+}
+
+
+/**
+ * Abort stream being sent
+ *
+ */
+void dart_stream_abort(struct dart_stream *self)
+{
+    dart_stream_abort_tx(self);
+}
+
+
+bool dart_stream_is_sending(struct dart_stream *self)
+{
+    return self->tx.active;
+}
+
+
+bool dart_stream_is_receiving(struct dart_stream *self)
+{
+    return self->rx.active;
+}
+
+
+/**
+ * Sink writing into caller supplied buffer
+ *
+ */
+bool dart_stream_buffer_write(void *private, uint32_t offset, const uint8_t *data, size_t length)
+{
+    struct dart_stream_buffer *buffer = (struct dart_stream_buffer*)private;
+
+    if (offset > buffer->size || length > buffer->size - offset)
+        return false;
+
+    memcpy(&buffer->data[offset], data, length);
+    return true;
+}
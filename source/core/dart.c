@@ -1,12 +1,22 @@
 
 #include "mx/core/dart.h"
 
+#include "mx/lib/crc.h"
 #include "mx/misc.h"
 
 #include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 
+#if DART_CAPTURE
+  #include "mx/core/dart-capture.h"
+#endif
+#if DART_HANDLERS
+  #include "mx/core/process.h"
+#endif
+#if DART_COMPRESSION
+  #include "mx/lib/lzss.h"
+#endif
 #if DEBUG_DART
   #include "mx/trace.h"
 #endif
@@ -24,6 +34,46 @@
 #define DART_LEN_BYTES          (DART_SYNC_BYTES + DART_LEN_SIZE)
 #define DART_FRAME_BYTES(len)   (DART_LEN_BYTES + len + DART_CRC_SIZE)
 
+#define DART_FRAME_SEGMENTS     (2 * DART_AGGR_MAX_MSGS)    // Maximal number of frame data segments
+
+#define DART_HDR_SIZE           1               // Sequenced frame header, precedes message data
+#define DART_HDR_SEQ_MASK       0x07
+#define DART_HDR_RESYNC         0x40            // Receiver has to accept sequence number
+#define DART_HDR_LZ             0x80            // Message data is compressed
+
+#define DART_CTRL_MASK          0xF8            // Control byte code, low bits carry argument
+#define DART_LZ_SIZE_MASK       0x07            // DART_LZ argument, decompressed size class
+#define DART_LZ_SIZE_MIN        32              // Decompressed size of class 0, doubled by each class
+
+#define DART_ESC_XOR            0x20            // Escaped byte is XORed with this value
+
+#define DART_HANDLER_INDEX_MASK (DART_HANDLER_INDEX_LEN - 1)
+#define DART_HANDLER_SHARED     0xFF            // Lookup table entry shared by several handlers
+
+#if DART_STATS
+  #define DART_STATS_INC(self, counter)         ((self)->stats.counter++)
+  #define DART_STATS_ADD(self, counter, value)  ((self)->stats.counter += (value))
+#else
+  #define DART_STATS_INC(self, counter)
+  #define DART_STATS_ADD(self, counter, value)
+#endif
+#define DART_STUFFING_CHUNK_LEN 64              // Stuffed bytes pushed at once
+
+
+/**
+ * Late-bound message descriptor
+ *
+ * Stored right behind the type of queued message object, the object length covers the type
+ * only. Such objects are marked by 'private' pointing to dart_deferred_tag.
+ */
+struct dart_deferred
+{
+    dart_msg_generator_fn generator;
+    void *private;
+};
+
+static uint8_t dart_deferred_tag;
+
 
 
 static uint8_t* dart_get_data(uint8_t *buffer)
@@ -32,83 +82,165 @@ static uint8_t* dart_get_data(uint8_t *buffer)
 }
 
 
-static dart_len_t dart_get_data_len(uint8_t *buffer)
+static dart_len_t dart_load_len(const uint8_t *len_buffer)
 {
 #if DART_LEN_SIZE == 1
-    return buffer[DART_LEN_IDX];
+    return len_buffer[0];
 #elif DART_LEN_SIZE == 2
-    return (uint16_t)(buffer[DART_LEN_IDX] << 8 | buffer[DART_LEN_IDX+1]);
+    return (uint16_t)(len_buffer[0] << 8 | len_buffer[1]);
 #else
     return 0;
 #endif
 }
 
-static void dart_set_data_len(uint8_t *buffer, dart_len_t data_len)
+
+static void dart_store_len(uint8_t *len_buffer, dart_len_t len)
 {
 #if DART_LEN_SIZE == 1
-    buffer[DART_LEN_IDX] = (uint8_t)(data_len & 0xFF);
+    len_buffer[0] = (uint8_t)(len & 0xFF);
 #elif DART_LEN_SIZE == 2
-    buffer[DART_LEN_IDX] = (uint8_t)((data_len >> 8) & 0xFF);
-    buffer[DART_LEN_IDX+1] = (uint8_t)(data_len & 0xFF);
+    len_buffer[0] = (uint8_t)((len >> 8) & 0xFF);
+    len_buffer[1] = (uint8_t)(len & 0xFF);
 #endif
 }
 
 
+static dart_len_t dart_get_data_len(uint8_t *buffer)
+{
+    return dart_load_len(&buffer[DART_LEN_IDX]);
+}
+
+static void dart_set_data_len(uint8_t *buffer, dart_len_t data_len)
+{
+    dart_store_len(&buffer[DART_LEN_IDX], data_len);
+}
+
+
 static uint32_t dart_get_crc_value(uint8_t *buffer, dart_len_t data_len)
 {
 #if DART_CRC_SIZE == 1
     return buffer[DART_CRC_IDX(data_len)];
 #elif DART_CRC_SIZE == 2
     return (uint16_t)(buffer[DART_CRC_IDX(data_len)] << 8 | buffer[DART_CRC_IDX(data_len)+1]);
+#elif DART_CRC_SIZE == 4
+    return (uint32_t)buffer[DART_CRC_IDX(data_len)] << 24 |
+           (uint32_t)buffer[DART_CRC_IDX(data_len)+1] << 16 |
+           (uint32_t)buffer[DART_CRC_IDX(data_len)+2] << 8 |
+           (uint32_t)buffer[DART_CRC_IDX(data_len)+3];
 #else
     return 0;
 #endif
 }
 
 
-static void dart_set_crc_value(uint8_t *buffer, dart_len_t data_len, uint32_t crc)
+static void dart_set_crc_value(uint8_t *crc_buffer, uint32_t crc)
 {
 #if DART_CRC_SIZE == 1
-    buffer[DART_CRC_IDX(data_len)] = (uint8_t)(crc & 0xFF);
+    crc_buffer[0] = (uint8_t)(crc & 0xFF);
 #elif DART_CRC_SIZE == 2
-    buffer[DART_CRC_IDX(data_len)] = (uint8_t)((crc >> 8) & 0xFF);
-    buffer[DART_CRC_IDX(data_len)+1] = (uint8_t)(crc & 0xFF);
+    crc_buffer[0] = (uint8_t)((crc >> 8) & 0xFF);
+    crc_buffer[1] = (uint8_t)(crc & 0xFF);
+#elif DART_CRC_SIZE == 4
+    crc_buffer[0] = (uint8_t)((crc >> 24) & 0xFF);
+    crc_buffer[1] = (uint8_t)((crc >> 16) & 0xFF);
+    crc_buffer[2] = (uint8_t)((crc >> 8) & 0xFF);
+    crc_buffer[3] = (uint8_t)(crc & 0xFF);
 #endif
 }
 
 
-static uint32_t dart_calculate_crc(uint8_t *buffer, uint32_t length)
+#if DART_CRC_SIZE == 1
+  #define DART_CRC_INIT         0xFF
+#elif DART_CRC_SIZE == 2
+  #define DART_CRC_INIT         CRC16_CCITT_INIT
+#elif DART_CRC_SIZE == 4
+  #define DART_CRC_INIT         CRC32C_INIT
+#endif
+
+
+static uint32_t dart_update_crc(uint32_t crc, const uint8_t *buffer, uint32_t length)
 {
 #if DART_CRC_SIZE == 1
-    uint8_t crc = 0xFF;
     for (uint32_t i=0; i<length; i++) {
         crc ^= buffer[i];
     }
     return crc;
 #elif DART_CRC_SIZE == 2
-    uint16_t crc = 0xFFFF;
-    uint16_t x;
-    for (uint32_t i=0; i<length; i++) {
-        x = crc >> 8 ^ buffer[i];
-        x ^= x >> 4;
-        crc = (crc << 8) ^ ((uint16_t)(x << 12)) ^ ((uint16_t)(x <<5)) ^ ((uint16_t)x);
-    }
-    return crc;
+    return crc16_ccitt((uint16_t)crc, buffer, length);
+#elif DART_CRC_SIZE == 4
+    return crc32c(crc, buffer, length);
 #else
     return 0;
 #endif
 }
 
 
+static uint32_t dart_finalize_crc(uint32_t crc)
+{
+#if DART_CRC_SIZE == 4
+    return crc ^ CRC32C_XOROUT;
+#else
+    return crc;
+#endif
+}
+
+
+/**
+ * Check if given byte starts frame
+ *
+ */
+static bool dart_is_sync(uint8_t ch)
+{
+#if DART_WINDOW_SIZE > 1
+    if (ch == DART_SYNC_SEQ)
+        return true;
+#endif
+#if DART_COMPRESSION
+    if (ch == DART_SYNC_LZ)
+        return true;
+#endif
+    return (ch == DART_SYNC) || (ch == DART_SYNC_AGG);
+}
+
+
+#if DART_BYTE_STUFFING
+/**
+ * Check if given byte is one of sync bytes reserved by the protocol
+ *
+ * The set does not depend on build options, so peers built with and without windowing or
+ * compression agree on escaped bytes.
+ */
+static bool dart_is_reserved_sync(uint8_t ch)
+{
+    return (ch == DART_SYNC) || (ch == DART_SYNC_SEQ) || (ch == DART_SYNC_AGG) || (ch == DART_SYNC_LZ);
+}
+
+
+/**
+ * Check if given byte has to be escaped within frame
+ *
+ */
+static bool dart_is_stuffed(uint8_t ch)
+{
+    return dart_is_reserved_sync(ch) || (ch == DART_ESC);
+}
+#endif
+
+
 
 
 
 #define DART_BYTE_TIMER_VAL             30          // 30 milliseconds
 #define DART_CLOSING_TIMER_VAL          50          // 50 milliseconds
 #define DART_CHILL_TIMER_VAL            100         // 100 milliseconds
-#define DART_ACK_TIMER_VAL              300         // 300 milliseconds
+#define DART_ACK_TIMER_VAL              300         // 300 milliseconds, until round trip is measured
 #define DART_WAKEUP_TIMER_VAL           500         // 500 milliseconds
-#define DART_RESPONSE_TIMER_VAL         3000        // 3 seconds
+#define DART_RESPONSE_TIMER_VAL         3000        // 3 seconds, until response time is measured
+
+#define DART_ACK_TIMER_MIN_VAL          20          // 20 milliseconds
+#define DART_ACK_TIMER_MAX_VAL          3000        // 3 seconds
+#define DART_RESPONSE_TIMER_MAX_VAL     10000       // 10 seconds
+#define DART_RTO_BACKOFF_MAX            4
 
 #define DART_WAKEUP_ATTEMPTS            3
 #define DART_TX_ATTEMPTS                3
@@ -118,109 +250,88 @@ static uint32_t dart_calculate_crc(uint8_t *buffer, uint32_t length)
 
 
 int dart_transfer_msg(struct dart *self, struct msg_ptr *msg);
+void dart_retry_transfer(struct dart *self);
+int dart_push_byte(struct dart *self, uint8_t byte);
+static void dart_hold_request(struct dart *self, struct msg_ptr *msg_ptr);
+#if DART_WINDOW_SIZE > 1
+static void dart_resend_window(struct dart *self);
+static int dart_trigger_window_transfer(struct dart *self);
+#endif
 
 
 
-/**
- * Initialize module
- *
- */
-void dart_init(struct dart *self, void *mpool, uint16_t mpool_size, void *rx_buffer, uint16_t rx_buffer_size)
+static void dart_legacy_send(uint8_t *buffer, int32_t length, void *private)
 {
-    self->callback = NULL;
-    self->callback_private = NULL;
-    self->deferred_msg_callback = NULL;
-
-    dart_reset(self);
-
-    cba_init(&self->cba, mpool, mpool_size);
+    UNUSED(private);
+    dart_uart_send(buffer, length);
+}
 
-    self->rx_buffer = rx_buffer;
-    self->rx_buffer_size = rx_buffer_size;
 
-    self->running = true;
+static void dart_legacy_sendv(const struct dart_iovec *iov, int iovcnt, void *private)
+{
+    UNUSED(private);
+    dart_uart_sendv(iov, iovcnt);
 }
 
 
-/**
- * Cleanup module
- *
- */
-void dart_clean(struct dart *self)
+static bool dart_legacy_pin_get_state(int pin_e, void *private)
 {
-    dart_reset(self);
-
-    cba_clean(&self->cba);
+    UNUSED(private);
+    return dart_pin_get_state(pin_e);
 }
 
 
-/**
- * Reset module
- */
-void dart_reset(struct dart *self)
+static void dart_legacy_pin_set_state(int pin_e, bool state, void *private)
 {
-    self->transfering = NULL;
-    self->pending_request = NULL;
+    UNUSED(private);
+    dart_pin_set_state(pin_e, state);
+}
 
-    self->wakeup_attempts = 0;
-    timer_stop(&self->wakeup_timer);
 
-    self->tx_attempts = 0;
-    timer_stop(&self->tx_ack_timer);
-    timer_stop(&self->tx_response_timer);
+static const struct dart_ops dart_legacy_ops = {
+    .send = dart_legacy_send,
+    .sendv = dart_legacy_sendv,
+    .pin_get_state = dart_legacy_pin_get_state,
+    .pin_set_state = dart_legacy_pin_set_state,
+    .get_milis = NULL,
+};
 
-    self->rx_buffer_bytes = 0;
-    timer_stop(&self->rx_byte_timer);
 
-    timer_stop(&self->closing_timer);
+static bool dart_get_pin(struct dart *self, int pin_e)
+{
+    return self->ops->pin_get_state(pin_e, self->ops_private);
+}
 
-    msg_queue_init(&self->queue);
 
-    cba_reset(&self->cba);
+static void dart_set_pin(struct dart *self, int pin_e, bool state)
+{
+    self->ops->pin_set_state(pin_e, state, self->ops_private);
 }
 
 
-/**
- * Callback setter
- *
- */
-void dart_set_callback(struct dart *self, void *private, dart_callback_fn callback)
+static uint32_t dart_get_milis(struct dart *self)
 {
-    self->callback = callback;
-    self->callback_private = private;
+    if (self->ops->get_milis)
+        return self->ops->get_milis(self->ops_private);
+    return clock_get_milis();
 }
 
 
-/**
- * Deffered message callback setter
- */
-void dart_set_deferred_msg_callback(struct dart *self, dart_deferred_msg_callback_fn callback)
+static void dart_timer_start(struct dart *self, struct timer *timer, uint32_t interval)
 {
-    self->deferred_msg_callback = callback;
+    timer_start_at(timer, TIMER_MS, interval, dart_get_milis(self));
 }
 
 
-/**
- * Callback caller
- *
- */
-static void dart_callback(struct dart *self, int code, void *param1, void *param2)
+static void dart_timer_restart(struct dart *self, struct timer *timer)
 {
-    if (self->callback)
-        self->callback(code, param1, param2, self->callback_private);
+    timer_restart_at(timer, dart_get_milis(self));
 }
 
 
-/**
- * Deferred message callback caller
- *
- */
-static bool dart_deferred_msg_callback(struct dart *self, struct msg_ptr *msg_ptr)
+static bool dart_timer_expired(struct dart *self, struct timer *timer)
 {
-    if (self->deferred_msg_callback)
-        return self->deferred_msg_callback(self, msg_ptr->msg.type);
-
-    return false;
+    return timer_expired_at(timer, dart_get_milis(self));
 }
 
 
@@ -228,190 +339,1268 @@ static bool dart_deferred_msg_callback(struct dart *self, struct msg_ptr *msg_pt
 
 
 /**
- * Find non empty message queue
+ * Update round trip estimation with new sample
  *
+ * Jacobson/Karels algorithm - gains 1/8 for srtt and 1/4 for rttvar, values are kept scaled
+ * to use integer arithmetic only.
  */
-static struct msg_list* dart_find_next_message_queue(struct dart *self)
+static void dart_rtt_sample(struct dart_rtt *rtt, uint32_t sample)
 {
-    for (int i=0; i<MSG_PRIO_LENGTH; i++) {
-        struct msg_list *list = msg_queue_get_msg_list(&self->queue, i);
-        if (msg_list_length(list) > 0) {
-            struct msg_ptr *msg_ptr = msg_list_peek(list);
-            if (self->pending_request && ((msg_ptr->msg.type & MSG_TYPE_MASK) == MSG_REQUEST))
-                continue;   // Currently waiting for response, request could not be sent now
+    if (sample == 0)
+        sample = 1;     // Value 0 means 'not measured'
 
-            return list;
-        }
+    if (rtt->srtt == 0) {
+        rtt->srtt = sample << 3;
+        rtt->rttvar = sample << 1;
+        return;
     }
 
-    return NULL;
+    int32_t err = (int32_t)sample - (int32_t)(rtt->srtt >> 3);
+    rtt->srtt = (uint32_t)((int32_t)rtt->srtt + err);
+    if (rtt->srtt == 0)
+        rtt->srtt = 1;
+    if (err < 0)
+        err = -err;
+    rtt->rttvar = (uint32_t)((int32_t)rtt->rttvar + err - (int32_t)(rtt->rttvar >> 2));
 }
 
 
 /**
- * Check if sending or will sent in the future
+ * Return timeout derived from round trip estimation, i.e. srtt + 4 * rttvar
  *
  */
-bool dart_is_sending(struct dart *self)
+static uint32_t dart_rtt_timeout(struct dart_rtt *rtt, uint32_t initial, uint32_t min, uint32_t max)
 {
-    if (self->transfering)
-        return true;       // Sending
-
-    if (self->pending_request)
-        return true;       // Waiting for response
-
-    if (dart_find_next_message_queue(self))
-        return true;       // Message is waiting for transfer
-
-    return false;
+    if (rtt->srtt == 0)
+        return initial;
+
+    uint32_t timeout = (rtt->srtt >> 3) + rtt->rttvar;
+    if (timeout < min)
+        return min;
+    if (timeout > max)
+        return max;
+    return timeout;
 }
 
 
 /**
- * Check if receiving
+ * Start acknowledge timer with current retransmission timeout
  *
  */
-bool dart_is_receiving(struct dart *self)
+static void dart_start_ack_timer(struct dart *self)
 {
-    if (self->rx_buffer_bytes != 0)
-        return true;
-
-    return false;
+    dart_timer_start(self, &self->tx_ack_timer, dart_get_ack_timeout(self));
 }
 
 
 /**
- * Check if idle
+ * Note link activity, i.e. transfer started or bytes received
  *
+ * Stops closing and takes a sample of the gap between bursts if the link was quiet.
  */
-bool dart_is_idle(struct dart *self)
+static void dart_link_active(struct dart *self)
 {
-    if (dart_is_sending(self) || dart_is_receiving(self))
-        return false;
+    timer_stop(&self->closing_timer);
 
-    return true;
+    if (self->idle_sampling) {
+        self->idle_sampling = false;
+        if (self->keepalive_max) {
+            // Long sleeps are clamped, so the estimate recovers quickly once bursts get close
+            uint32_t gap = dart_get_milis(self) - self->idle_tstamp;
+            dart_rtt_sample(&self->idle_gap, MIN(gap, 2 * self->keepalive_max));
+        }
+    }
 }
 
 
+#if DART_STATS
 /**
- * Check if given message is pending
+ * Count latency sample in log2 scaled histogram
  *
  */
-bool dart_is_msg_pending(struct dart *self, uint8_t prio, msgtype_t type)
+static void dart_stats_latency(uint32_t *histogram, uint32_t sample)
 {
-    if (self->pending_request && self->pending_request->msg.type == type)
-        return true;
-
-    if (msg_queue_find_msgtype(&self->queue, &prio, type))
-        return true;
-
-    return false;
+    uint8_t bucket = 0;
+    while (sample && bucket < DART_STATS_BUCKETS - 1) {
+        sample >>= 1;
+        bucket++;
+    }
+    histogram[bucket]++;
 }
+#endif
 
 
 /**
- * Returns message type that is currently being processed
+ * Take acknowledge time sample of frame sent at given time
  *
+ * Caller has to skip retransmitted frames (Karn's rule), backoff is cleared by valid sample.
  */
-bool dart_get_current_msgtype(struct dart *self, msgtype_t *type)
+static void dart_ack_rtt_sample(struct dart *self, uint32_t tstamp)
 {
-    if (self->transfering) {
-        struct msg_ptr *msg_ptr = msg_list_peek(self->transfering);
-        *type = msg_ptr->msg.type;
-        return true;
-    }
-
-    if (self->pending_request) {
-        *type = self->pending_request->msg.type;
-        return true;
-    }
-
-
-    return false;
+    uint32_t sample = dart_get_milis(self) - tstamp;
+    dart_rtt_sample(&self->ack_rtt, sample);
+    self->rto_backoff = 0;
+#if DART_STATS
+    dart_stats_latency(self->stats.ack_latency, sample);
+#endif
 }
 
 
+
 /**
- * Finalize and clean transferred message
+ * Forget negotiated window
  *
+ * Opponent has to be asked again on the next connection.
  */
-void dart_finalize_transfer(struct dart *self)
+static void dart_reset_window(struct dart *self)
 {
-    if (self->transfering) {
-        struct msg_ptr *msg_ptr = msg_list_pop(self->transfering);
-        if (msg_ptr) {
-            msg_ptr_free(&self->cba, msg_ptr);
-        }
-        self->transfering = NULL;
-    }
+#if DART_WINDOW_SIZE > 1
+    self->window = 1;
+    self->tx_sequenced = false;
+    self->tx_resync = false;
+    self->tx_nak_pending = false;
+    self->tx_resent = 0;
+    self->hello_sent = false;
+    self->rx_nak_sent = false;
+    self->rx_resynced = false;
+#else
+    UNUSED(self);
+#endif
 }
 
 
 /**
- * Trigger new transfer
+ * Forget negotiated aggregation
  *
+ * Aggregation is offered again on the next connection.
  */
-int dart_trigger_transfer(struct dart *self)
+static void dart_reset_aggregation(struct dart *self)
 {
-    if (self->transfering)
-        return DART_PENDING;
-
-    if (!dart_pin_get_state(DART_WRK_PIN)) {
-        // We are triggering communication
-        if (self->wakeup_attempts++ < DART_WAKEUP_ATTEMPTS) {
-            // We need to notify the other module about last message
-            dart_pin_set_state(DART_WRK_PIN, true);
-            if (!timer_running(&self->wakeup_timer))
-                timer_start(&self->wakeup_timer, TIMER_MS, DART_WAKEUP_TIMER_VAL);
-        }
-        else {
-            // Looks like receiver is not responding
-            self->wakeup_attempts = 0;
-            dart_callback(self, DART_CLBK_TRANSFER_IMPOSSIBLE, NULL, NULL);
-            return DART_ERR_NOT_POSSIBLE;
-        }
-    }
-    if (!dart_pin_get_state(DART_RDY_PIN)) {
-        // Waiting for connection
-        dart_callback(self, DART_CLBK_WAITING, NULL, NULL);
-        return DART_WAITING;
-    }
-
-    self->transfering = dart_find_next_message_queue(self);
-    if (!self->transfering) {
-        if (self->pending_request)
-            return DART_PENDING;
-        return DART_IDLE;
-    }
-
-    self->tx_attempts = 0;
-    self->wakeup_attempts = 0;
-    timer_stop(&self->closing_timer);
-    timer_stop(&self->wakeup_timer);
-    return dart_transfer_msg(self, msg_list_peek(self->transfering));
+    self->aggr_offered = false;
+    self->aggr_peer = false;
 }
 
 
-
-
-
 /**
- * Transfer buffer through uart
+ * Forget negotiated compression
  *
+ * Compression is offered again on the next connection.
  */
-int dart_push(struct dart *self, uint8_t *buffer, uint32_t length)
+static void dart_reset_compression(struct dart *self)
 {
+#if DART_COMPRESSION
+    self->lz_offered = false;
+    self->lz_peer_size = 0;
+#else
     UNUSED(self);
-
-#if DEBUG_DART
-    TRACE_DATA("TX:", buffer, length);
 #endif
-    dart_uart_send(buffer, length);
-
-    return DART_SUCCESS;
 }
 
 
+#if DART_COMPRESSION
+/**
+ * Get size class of decompression buffer offered to the opponent
+ *
+ * The largest class not exceeding the buffer, dart_set_compression() guarantees at least class 0.
+ */
+static uint8_t dart_lz_size_class(const struct dart *self)
+{
+    uint8_t size_class = 0;
+    while (size_class < DART_LZ_SIZE_MASK && (DART_LZ_SIZE_MIN << (size_class + 1)) <= self->lz_buffer_size)
+        size_class++;
+    return size_class;
+}
+#endif
+
+
+
+/**
+ * Initialize module
+ *
+ */
+void dart_init(struct dart *self, void *mpool, uint16_t mpool_size, void *rx_buffer, uint16_t rx_buffer_size)
+{
+    self->transfering = NULL;
+    for (int i=0; i<DART_PENDING_REQUESTS; i++)
+        self->pending_requests[i].msg_ptr = NULL;
+    self->request_tag_offset = 0;
+#if DART_WINDOW_SIZE > 1
+    msg_list_init(&self->inflight);
+    self->tx_base = 0;
+    self->rx_seq = 0;
+#endif
+
+    self->ops = &dart_legacy_ops;
+    self->ops_private = NULL;
+
+    self->callback = NULL;
+    self->callback_private = NULL;
+    self->deferred_msg_callback = NULL;
+    self->deferred_buffer = NULL;
+    self->deferred_buffer_size = 0;
+#if DART_HANDLERS
+    for (int i=0; i<DART_HANDLERS; i++)
+        self->handlers[i].active = false;
+    memset(self->handler_index, 0, sizeof(self->handler_index));
+#endif
+
+    self->aggr_max_len = 0;
+    self->aggr_max_delay = 0;
+    self->keepalive_max = 0;
+    self->preempt_prio = DART_MSG_PRIO_ANY;
+
+#if DART_CAPTURE
+    self->capture = NULL;
+#endif
+#if DART_COMPRESSION
+    self->lz_tx_buffer = NULL;
+    self->lz_rx_buffer = NULL;
+    self->lz_buffer_size = 0;
+    self->lz_threshold = 0;
+#endif
+#if DART_STATS
+    dart_reset_stats(self);
+#endif
+
+    msg_queue_init(&self->queue);
+    dart_reset(self);
+
+    cba_init(&self->cba, mpool, mpool_size);
+
+    self->rx_buffer = rx_buffer;
+    self->rx_buffer_size = rx_buffer_size;
+
+    self->running = true;
+}
+
+
+/**
+ * Cleanup module
+ *
+ */
+void dart_clean(struct dart *self)
+{
+    dart_reset(self);
+
+    cba_clean(&self->cba);
+}
+
+
+/**
+ * Reset module
+ */
+void dart_reset(struct dart *self)
+{
+    // Release all messages, some of them might be forwarded from other allocators
+    struct msg_list released;
+    msg_list_init(&released);
+    for (int i=0; i<DART_PENDING_REQUESTS; i++) {
+        if (self->pending_requests[i].msg_ptr)
+            msg_list_push(&released, self->pending_requests[i].msg_ptr);
+        self->pending_requests[i].msg_ptr = NULL;
+        timer_stop(&self->pending_requests[i].timer);
+    }
+#if DART_WINDOW_SIZE > 1
+    msg_list_splice(&released, &self->inflight);
+#endif
+    msg_queue_drain_into(&self->queue, &released);
+
+    struct msg_ptr *msg_ptr;
+    while (msg_ptr = msg_list_pop(&released), msg_ptr)
+        msg_ptr_free(&self->cba, msg_ptr);
+
+    self->transfering = NULL;
+
+    self->wakeup_attempts = 0;
+    timer_stop(&self->wakeup_timer);
+
+    self->tx_attempts = 0;
+    self->tx_batch = 1;
+    self->tx_prio = 0;
+    self->tx_preempted = NULL;
+    self->tx_preempted_attempts = 0;
+    timer_stop(&self->tx_ack_timer);
+
+    self->ack_rtt.srtt = 0;
+    self->ack_rtt.rttvar = 0;
+    self->response_rtt.srtt = 0;
+    self->response_rtt.rttvar = 0;
+    self->rto_backoff = 0;
+
+    self->idle_gap.srtt = 0;
+    self->idle_gap.rttvar = 0;
+    self->idle_sampling = false;
+
+    dart_reset_window(self);
+    dart_reset_aggregation(self);
+    dart_reset_compression(self);
+
+    self->rx_buffer_bytes = 0;
+#if DART_BYTE_STUFFING
+    self->rx_escaped = false;
+#endif
+    timer_stop(&self->rx_byte_timer);
+
+    timer_stop(&self->closing_timer);
+
+    msg_queue_reset(&self->queue);
+
+    cba_reset(&self->cba);
+}
+
+
+/**
+ * Transport operations setter
+ *
+ * Binds the instance to its own link. NULL restores default transport, i.e. global
+ * dart_uart_send() and dart_pin_*() functions.
+ */
+void dart_set_ops(struct dart *self, void *private, const struct dart_ops *ops)
+{
+    self->ops = ops ? ops : &dart_legacy_ops;
+    self->ops_private = ops ? private : NULL;
+}
+
+
+/**
+ * Callback setter
+ *
+ */
+void dart_set_callback(struct dart *self, void *private, dart_callback_fn callback)
+{
+    self->callback = callback;
+    self->callback_private = private;
+}
+
+
+/**
+ * Deffered message callback setter
+ */
+void dart_set_deferred_msg_callback(struct dart *self, dart_deferred_msg_callback_fn callback)
+{
+    self->deferred_msg_callback = callback;
+}
+
+
+/**
+ * Set buffer for content of late-bound messages
+ *
+ * Content of messages sent by dart_send_deferred() is generated here right before the frame
+ * is pushed, so the buffer limits their length.
+ *
+ */
+void dart_set_deferred_buffer(struct dart *self, void *buffer, uint16_t size)
+{
+    self->deferred_buffer = (uint8_t*)buffer;
+    self->deferred_buffer_size = buffer ? size : 0;
+}
+
+
+#if DART_HANDLERS
+/**
+ * Put handler into lookup table
+ *
+ * Every entry covers message types of the same low bits. Entry hit by several handlers is
+ * marked as shared and resolved by scanning. With table as wide as msgtype there is always
+ * single handler per entry, as ranges do not overlap.
+ */
+static void dart_index_handler(struct dart *self, int slot)
+{
+    struct dart_handler *handler = &self->handlers[slot];
+    uint32_t cnt = (uint32_t)(handler->last - handler->first) + 1;
+    if (cnt > DART_HANDLER_INDEX_LEN)
+        cnt = DART_HANDLER_INDEX_LEN;
+
+    for (uint32_t i=0; i<cnt; i++) {
+        uint8_t *entry = &self->handler_index[(handler->first + i) & DART_HANDLER_INDEX_MASK];
+        *entry = (*entry == 0) ? (uint8_t)(slot + 1) : DART_HANDLER_SHARED;
+    }
+}
+
+
+/**
+ * Find handler registered for given message type
+ *
+ */
+static struct dart_handler* dart_find_handler(struct dart *self, msgtype_t type)
+{
+    uint8_t entry = self->handler_index[type & DART_HANDLER_INDEX_MASK];
+    if (entry == 0)
+        return NULL;
+
+    if (entry != DART_HANDLER_SHARED) {
+        struct dart_handler *handler = &self->handlers[entry - 1];
+        return (type >= handler->first && type <= handler->last) ? handler : NULL;
+    }
+
+    for (int i=0; i<DART_HANDLERS; i++) {
+        struct dart_handler *handler = &self->handlers[i];
+        if (handler->active && type >= handler->first && type <= handler->last)
+            return handler;
+    }
+    return NULL;
+}
+
+
+/**
+ * Register handler of received messages
+ *
+ * Messages of types from 'first' to 'last' are passed to the handler instead of the callback.
+ * With DART_HANDLER_POST the message is copied and posted to process given as 'private',
+ * 'handler' is not used then. Ranges of registered handlers must not overlap.
+ */
+int dart_register_handler(struct dart *self, msgtype_t first, msgtype_t last, uint8_t flags, void *private, dart_msg_handler_fn handler)
+{
+    if (last < first)
+        return DART_ERR_NOT_POSSIBLE;
+    if ((flags & DART_HANDLER_POST) ? !private : !handler)
+        return DART_ERR_NOT_POSSIBLE;
+
+    int slot = -1;
+    for (int i=0; i<DART_HANDLERS; i++) {
+        struct dart_handler *registered = &self->handlers[i];
+        if (!registered->active) {
+            if (slot < 0)
+                slot = i;
+        }
+        else if (first <= registered->last && last >= registered->first) {
+            return DART_ERR_NOT_POSSIBLE;
+        }
+    }
+    if (slot < 0)
+        return DART_ERR_NO_MEMORY;
+
+    struct dart_handler *registered = &self->handlers[slot];
+    registered->first = first;
+    registered->last = last;
+    registered->flags = flags;
+    registered->handler = handler;
+    registered->private = private;
+    registered->active = true;
+    dart_index_handler(self, slot);
+
+    return DART_SUCCESS;
+}
+
+
+/**
+ * Unregister handler starting with given message type
+ *
+ */
+int dart_unregister_handler(struct dart *self, msgtype_t first)
+{
+    bool found = false;
+    for (int i=0; i<DART_HANDLERS; i++) {
+        if (self->handlers[i].active && self->handlers[i].first == first) {
+            self->handlers[i].active = false;
+            found = true;
+        }
+    }
+    if (!found)
+        return DART_ERR_MSG_NOT_FOUND;
+
+    // Registrations are rare, just rebuild the table
+    memset(self->handler_index, 0, sizeof(self->handler_index));
+    for (int i=0; i<DART_HANDLERS; i++) {
+        if (self->handlers[i].active)
+            dart_index_handler(self, i);
+    }
+
+    return DART_SUCCESS;
+}
+#endif
+
+
+/**
+ * Callback caller
+ *
+ */
+static void dart_callback(struct dart *self, int code, void *param1, void *param2)
+{
+    if (self->callback)
+        self->callback(code, param1, param2, self->callback_private);
+}
+
+
+/**
+ * Deferred message callback caller
+ *
+ */
+static bool dart_deferred_msg_callback(struct dart *self, struct msg_ptr *msg_ptr)
+{
+    if (self->deferred_msg_callback)
+        return self->deferred_msg_callback(self, msg_ptr->msg.type);
+
+    return false;
+}
+
+
+static bool dart_is_late_bound(struct msg_ptr *msg_ptr)
+{
+    return msg_ptr->private == &dart_deferred_tag;
+}
+
+
+/**
+ * Check if content of message may be pushed
+ *
+ * Late-bound message needs deferred buffer, which may be removed while it is queued.
+ */
+static bool dart_is_msg_pushable(struct dart *self, struct msg_ptr *msg_ptr)
+{
+    return !dart_is_late_bound(msg_ptr) || self->deferred_buffer_size >= sizeof(msgtype_t);
+}
+
+
+
+
+
+/**
+ * Count request messages which were sent but are not acknowledged yet
+ *
+ */
+static uint8_t dart_count_requests_in_flight(struct dart *self)
+{
+    uint8_t cnt = 0;
+
+#if DART_WINDOW_SIZE > 1
+    for (struct msg_ptr *msg_ptr = self->inflight.msg_head; msg_ptr; msg_ptr = msg_ptr->next) {
+        if ((msg_ptr->msg.type & MSG_TYPE_MASK) == MSG_REQUEST)
+            cnt++;
+    }
+#else
+    UNUSED(self);
+#endif
+
+    return cnt;
+}
+
+
+/**
+ * Count request messages waiting for response
+ *
+ */
+static uint8_t dart_count_pending_requests(struct dart *self)
+{
+    uint8_t cnt = 0;
+
+    for (int i=0; i<DART_PENDING_REQUESTS; i++) {
+        if (self->pending_requests[i].msg_ptr)
+            cnt++;
+    }
+
+    return cnt;
+}
+
+
+/**
+ * Check if another request may be sent
+ *
+ * Requests in flight occupy their slots as soon as they are acknowledged.
+ */
+static bool dart_is_request_slot_free(struct dart *self)
+{
+    return dart_count_pending_requests(self) + dart_count_requests_in_flight(self) < DART_PENDING_REQUESTS;
+}
+
+
+/**
+ * Find the oldest request waiting for response
+ *
+ * If 'msg' is given, only requests matching this response are taken into account.
+ */
+static struct dart_request* dart_find_pending_request(struct dart *self, struct msg *msg, size_t msg_len)
+{
+    struct dart_request *found = NULL;
+
+    for (int i=0; i<DART_PENDING_REQUESTS; i++) {
+        struct dart_request *request = &self->pending_requests[i];
+        if (!request->msg_ptr)
+            continue;
+        if (found && (int32_t)(request->tstamp - found->tstamp) >= 0)
+            continue;
+        if (msg) {
+            if ((request->msg_ptr->msg.type & MSG_ID_MASK) != (msg->type & MSG_ID_MASK))
+                continue;   // Waiting for another response id
+            uint8_t offset = self->request_tag_offset;
+            if (offset) {
+                if (offset >= msg_len || offset >= request->msg_ptr->length)
+                    continue;
+                if (((uint8_t*)&request->msg_ptr->msg)[offset] != ((uint8_t*)msg)[offset])
+                    continue;   // Response to another request of the same id
+            }
+        }
+        found = request;
+    }
+
+    return found;
+}
+
+
+/**
+ * Find non empty message queue
+ *
+ */
+static struct msg_list* dart_find_next_message_queue(struct dart *self, uint8_t *prio)
+{
+    uint8_t exclude = 0;
+
+    if (!dart_is_request_slot_free(self)) {
+        for (int i=0; i<MSG_PRIO_LENGTH; i++) {
+            struct msg_ptr *msg_ptr = msg_list_peek(msg_queue_get_msg_list(&self->queue, i));
+            if (msg_ptr && ((msg_ptr->msg.type & MSG_TYPE_MASK) == MSG_REQUEST))
+                exclude |= (0x1 << i);  // Currently waiting for responses, request could not be sent now
+        }
+    }
+
+    return msg_queue_select_msg_list_at(&self->queue, prio, exclude, dart_get_milis(self));
+}
+
+
+/**
+ * Set aging limit of given priority
+ *
+ * Queued message waiting longer than 'max_delay' milliseconds is transferred before messages
+ * of higher priorities. Value 0 restores strict priority.
+ */
+void dart_set_max_delay(struct dart *self, uint8_t prio, uint32_t max_delay)
+{
+    msg_queue_set_max_delay(&self->queue, prio, max_delay);
+}
+
+
+/**
+ * Set dispatch order of given priority
+ *
+ * Messages of priority in EDF mode are transferred in order of their deadlines, see
+ * dart_send_msg_deadline(). Messages without deadline follow them in FIFO order. Message
+ * being transferred or waiting for retransmission keeps its place.
+ */
+void dart_set_edf(struct dart *self, uint8_t prio, bool edf)
+{
+    msg_queue_set_edf(&self->queue, prio, edf);
+}
+
+
+/**
+ * Set preemption policy
+ *
+ * Queued message of priority 'prio' or more urgent one is transferred ahead of less urgent
+ * message which waits for retransmission. The preempted message keeps its attempts and is
+ * retried afterwards. Value DART_MSG_PRIO_ANY disables preemption. Applies to stop-and-wait
+ * transfers only, windowed transfers keep several frames in flight anyway.
+ */
+void dart_set_preemption(struct dart *self, uint8_t prio)
+{
+    self->preempt_prio = (prio < MSG_PRIO_LENGTH) ? prio : DART_MSG_PRIO_ANY;
+}
+
+
+/**
+ * Return worst observed queueing delay of given priority
+ *
+ */
+uint32_t dart_get_worst_delay(struct dart *self, uint8_t prio)
+{
+    return msg_queue_get_worst_delay(&self->queue, prio);
+}
+
+
+/**
+ * Return negotiated window size
+ *
+ * Value 1 means legacy stop-and-wait transfer.
+ */
+uint8_t dart_get_window(struct dart *self)
+{
+#if DART_WINDOW_SIZE > 1
+    return self->window;
+#else
+    UNUSED(self);
+    return 1;
+#endif
+}
+
+
+/**
+ * Return current acknowledge timeout
+ *
+ * Derived from measured round trip time and doubled after every timeout.
+ */
+uint32_t dart_get_ack_timeout(struct dart *self)
+{
+    uint32_t timeout = dart_rtt_timeout(&self->ack_rtt, DART_ACK_TIMER_VAL, DART_ACK_TIMER_MIN_VAL, DART_ACK_TIMER_MAX_VAL);
+
+    timeout <<= self->rto_backoff;
+    return (timeout < DART_ACK_TIMER_MAX_VAL) ? timeout : DART_ACK_TIMER_MAX_VAL;
+}
+
+
+/**
+ * Return current response timeout
+ *
+ * Derived from measured response time, never shorter than DART_RESPONSE_TIMER_VAL. Estimate
+ * is shared by all request types, so fast ones must not cut the wait for slow ones short.
+ * Slow responses extend the timeout up to DART_RESPONSE_TIMER_MAX_VAL.
+ */
+uint32_t dart_get_response_timeout(struct dart *self)
+{
+    return dart_rtt_timeout(&self->response_rtt, DART_RESPONSE_TIMER_VAL, DART_RESPONSE_TIMER_VAL, DART_RESPONSE_TIMER_MAX_VAL);
+}
+
+
+/**
+ * Return time the link is held awake after the last activity
+ *
+ * Predicted gap to the next burst (mean + 4 * deviation) when it fits into keep-alive limit,
+ * DART_CLOSING_TIMER_VAL otherwise.
+ */
+uint32_t dart_get_closing_time(struct dart *self)
+{
+    if (self->keepalive_max == 0)
+        return DART_CLOSING_TIMER_VAL;
+
+    uint32_t expected = dart_rtt_timeout(&self->idle_gap, UINT32_MAX, DART_CLOSING_TIMER_VAL, UINT32_MAX);
+    return (expected <= self->keepalive_max) ? expected : DART_CLOSING_TIMER_VAL;
+}
+
+
+/**
+ * Configure request tag
+ *
+ * Byte at given offset of REQUEST message is expected to be echoed by its RESPONSE, so that
+ * several pending requests of the same id can be told apart. Value 0 disables tag matching,
+ * responses are matched by MSG_ID_MASK only.
+ */
+void dart_set_request_tag(struct dart *self, uint8_t offset)
+{
+    self->request_tag_offset = offset;
+}
+
+
+#if DART_STATS
+/**
+ * Take snapshot of link statistics
+ *
+ * Should be called from the context running DART handlers, so the snapshot is consistent.
+ */
+void dart_get_stats(struct dart *self, struct dart_stats *stats)
+{
+    memcpy(stats, &self->stats, sizeof(*stats));
+}
+
+
+/**
+ * Clear link statistics
+ *
+ * Statistics survive dart_reset(), so link problems may be tracked across reconnections.
+ */
+void dart_reset_stats(struct dart *self)
+{
+    memset(&self->stats, 0, sizeof(self->stats));
+}
+#endif
+
+
+#if DART_CAPTURE
+/**
+ * Traffic recorder setter
+ *
+ * Every chunk sent or received is recorded as is, i.e. including control bytes, stuffing
+ * and corrupted data. NULL stops capturing.
+ */
+void dart_set_capture(struct dart *self, struct dart_capture *capture)
+{
+    self->capture = capture;
+}
+#endif
+
+
+#if DART_COMPRESSION
+/**
+ * Configure payload compression
+ *
+ * Compression is offered to the opponent on every connection. Once accepted, messages of at
+ * least 'threshold' bytes are sent LZSS compressed unless it does not pay off. Given buffer
+ * is split into halves - compressed outgoing frame and decompressed incoming message, so each
+ * half limits message length. The offer tells the opponent how long messages it may send
+ * compressed, half of the buffer is rounded down to 32 bytes times a power of two for it.
+ * Value 0 of 'threshold' or half of the buffer shorter than 32 bytes disables compression,
+ * the opponent is not allowed to send compressed frames then. Should be called while the link
+ * is idle.
+ */
+void dart_set_compression(struct dart *self, dart_len_t threshold, void *buffer, uint16_t size)
+{
+    self->lz_buffer_size = (uint16_t)(size / 2);
+    self->lz_tx_buffer = (uint8_t*)buffer;
+    self->lz_rx_buffer = (uint8_t*)buffer + self->lz_buffer_size;
+    self->lz_threshold = (buffer && self->lz_buffer_size >= DART_LZ_SIZE_MIN) ? threshold : 0;
+}
+#endif
+
+
+/**
+ * Configure frame aggregation
+ *
+ * Queued messages of the same priority are packed into one frame as long as it does not
+ * exceed 'max_len' bytes. The first message may wait up to 'max_delay' milliseconds for
+ * companions. Value 0 of 'max_len' disables aggregation. Aggregation is offered to the
+ * opponent on every connection, frames carry single message until it is accepted. Windowed
+ * transfers always carry single message.
+ */
+void dart_set_aggregation(struct dart *self, dart_len_t max_len, uint32_t max_delay)
+{
+    self->aggr_max_len = max_len;
+    self->aggr_max_delay = max_delay;
+}
+
+
+/**
+ * Configure adaptive keep-alive
+ *
+ * Gaps between bursts of traffic are measured and when the next burst is expected within
+ * 'max_hold' milliseconds, the link is held awake instead of paying for another wake-up
+ * handshake. Higher values favour latency, lower ones power. Value 0 disables the policy,
+ * the link closes DART_CLOSING_TIMER_VAL after the last activity.
+ */
+void dart_set_keepalive(struct dart *self, uint32_t max_hold)
+{
+    self->keepalive_max = max_hold;
+    self->idle_gap.srtt = 0;
+    self->idle_gap.rttvar = 0;
+}
+
+
+/**
+ * Check if sending or will sent in the future
+ *
+ */
+bool dart_is_sending(struct dart *self)
+{
+    if (self->transfering)
+        return true;       // Sending
+
+    if (dart_count_pending_requests(self))
+        return true;       // Waiting for response
+
+    if (dart_find_next_message_queue(self, NULL))
+        return true;       // Message is waiting for transfer
+
+    return false;
+}
+
+
+/**
+ * Check if receiving
+ *
+ */
+bool dart_is_receiving(struct dart *self)
+{
+    if (self->rx_buffer_bytes != 0)
+        return true;
+
+    return false;
+}
+
+
+/**
+ * Check if idle
+ *
+ */
+bool dart_is_idle(struct dart *self)
+{
+    if (dart_is_sending(self) || dart_is_receiving(self))
+        return false;
+
+    return true;
+}
+
+
+/**
+ * Check if given message is pending
+ *
+ */
+bool dart_is_msg_pending(struct dart *self, uint8_t prio, msgtype_t type)
+{
+    for (int i=0; i<DART_PENDING_REQUESTS; i++) {
+        struct msg_ptr *msg_ptr = self->pending_requests[i].msg_ptr;
+        if (msg_ptr && msg_ptr->msg.type == type)
+            return true;
+    }
+
+#if DART_WINDOW_SIZE > 1
+    if (msg_list_find_msgtype(&self->inflight, type))
+        return true;
+#endif
+
+    if (msg_queue_find_msgtype(&self->queue, &prio, type))
+        return true;
+
+    return false;
+}
+
+
+/**
+ * Returns message type that is currently being processed
+ *
+ */
+bool dart_get_current_msgtype(struct dart *self, msgtype_t *type)
+{
+    if (self->transfering) {
+        struct msg_ptr *msg_ptr = msg_list_peek(self->transfering);
+        *type = msg_ptr->msg.type;
+        return true;
+    }
+
+    struct dart_request *request = dart_find_pending_request(self, NULL, 0);
+    if (request) {
+        *type = request->msg_ptr->msg.type;
+        return true;
+    }
+
+
+    return false;
+}
+
+
+/**
+ * Finalize and clean transferred message
+ *
+ */
+void dart_finalize_transfer(struct dart *self)
+{
+    if (self->transfering) {
+        struct msg_ptr *msg_ptr = msg_list_pop(self->transfering);
+        if (msg_ptr) {
+            msg_ptr_free(&self->cba, msg_ptr);
+        }
+#if DART_WINDOW_SIZE > 1
+        if (self->transfering == &self->inflight) {
+            // Frame is dropped, opponent has to follow sequence of the next one
+            self->tx_base = (self->tx_base + 1) & DART_HDR_SEQ_MASK;
+            self->tx_resync = true;
+            self->tx_attempts = 0;
+            if (msg_list_peek(&self->inflight)) {
+                dart_resend_window(self);
+                return;
+            }
+        }
+#endif
+        self->transfering = NULL;
+        self->tx_batch = 1;
+    }
+}
+
+
+/**
+ * Check if message has deadline which already passed
+ *
+ */
+static bool dart_msg_expired(struct dart *self, struct msg_ptr *msg_ptr)
+{
+    return msg_ptr_expired_at(msg_ptr, dart_get_milis(self));
+}
+
+
+/**
+ * Remove queued message which could not be sent with given notification
+ *
+ */
+static void dart_drop_msg(struct dart *self, struct msg_list *list, struct msg_ptr *msg_ptr, int code)
+{
+    msg_list_remove(list, msg_ptr);
+    if (self->tx_preempted == msg_ptr)
+        self->tx_preempted = NULL;
+    dart_callback(self, code, &msg_ptr->msg, (void*)msg_ptr->length);
+    msg_ptr_free(&self->cba, msg_ptr);
+}
+
+
+/**
+ * Drop queued messages which missed their deadline or could not be pushed
+ *
+ * Only heads of message lists are checked, messages are sent in order anyway. Followers
+ * joining aggregated frame are checked by dart_collect_batch().
+ */
+static void dart_drop_unsendable_msgs(struct dart *self)
+{
+    for (int i=0; i<MSG_PRIO_LENGTH; i++) {
+        struct msg_list *list = msg_queue_get_msg_list(&self->queue, i);
+        struct msg_ptr *msg_ptr;
+        while (msg_ptr = msg_list_peek(list), msg_ptr) {
+            if (dart_msg_expired(self, msg_ptr))
+                dart_drop_msg(self, list, msg_ptr, DART_CLBK_MESSAGE_EXPIRED);
+            else if (!dart_is_msg_pushable(self, msg_ptr))
+                dart_drop_msg(self, list, msg_ptr, DART_CLBK_TRANSFER_FAILURE);
+            else
+                break;
+        }
+    }
+}
+
+
+/**
+ * Check if another frame may be sent before previous ones are acknowledged
+ *
+ */
+static bool dart_is_window_open(struct dart *self)
+{
+#if DART_WINDOW_SIZE > 1
+    if (self->transfering != &self->inflight)
+        return false;   // Legacy frame is being transferred
+    if (!timer_running(&self->tx_ack_timer))
+        return true;    // Transfer suspended, frames have to be sent again
+    return msg_list_length(&self->inflight) < self->window;
+#else
+    UNUSED(self);
+    return false;
+#endif
+}
+
+
+/**
+ * Collect messages which may be transferred within one frame
+ *
+ * Consecutive messages of the list are taken as long as they fit into aggregation budget.
+ * Expired messages on the way are dropped, so they are not sent past their deadline. Request
+ * closes the batch, deferred messages are always sent alone. Aggregated frame is sent only
+ * if the opponent accepts it. The 'open' flag is set if the list was exhausted, i.e. frame
+ * could carry more messages.
+ */
+static uint8_t dart_collect_batch(struct dart *self, struct msg_list *list, bool *open)
+{
+    uint32_t batch_len = 0;
+    uint8_t batch = 0;
+
+    *open = false;
+    if (self->aggr_max_len == 0 || !self->aggr_peer)
+        return 1;
+
+    struct msg_ptr *next;
+    for (struct msg_ptr *msg_ptr = msg_list_peek(list); msg_ptr; msg_ptr = next) {
+        next = msg_ptr->next;
+        if (batch && dart_msg_expired(self, msg_ptr)) {
+            dart_drop_msg(self, list, msg_ptr, DART_CLBK_MESSAGE_EXPIRED);
+            if (!next)
+                *open = true;
+            continue;
+        }
+
+        bool request = ((msg_ptr->msg.type & MSG_TYPE_MASK) == MSG_REQUEST);
+        if (request && !dart_is_request_slot_free(self))
+            break;  // Limited number of requests may wait for response
+        if (self->deferred_msg_callback && msg_ptr->length == sizeof(struct msg))
+            break;  // Content is pushed by deferred message callback
+        if (dart_is_late_bound(msg_ptr))
+            break;  // Content is generated when pushed
+        if (batch_len + DART_LEN_SIZE + msg_ptr->length > self->aggr_max_len)
+            break;
+
+        batch_len += DART_LEN_SIZE + msg_ptr->length;
+        batch++;
+        if (request || batch == DART_AGGR_MAX_MSGS)
+            break;
+        if (!next)
+            *open = true;
+    }
+
+    return batch ? batch : 1;
+}
+
+
+/**
+ * Trigger new transfer
+ *
+ */
+int dart_trigger_transfer(struct dart *self)
+{
+    if (self->transfering && !dart_is_window_open(self))
+        return DART_PENDING;
+
+    dart_drop_unsendable_msgs(self);
+
+    if (!dart_get_pin(self, DART_WRK_PIN)) {
+        // We are triggering communication
+        if (self->wakeup_attempts++ < DART_WAKEUP_ATTEMPTS) {
+            // We need to notify the other module about last message
+            DART_STATS_INC(self, wakeup_attempts);
+            dart_set_pin(self, DART_WRK_PIN, true);
+            if (!timer_running(&self->wakeup_timer))
+                dart_timer_start(self, &self->wakeup_timer, DART_WAKEUP_TIMER_VAL);
+        }
+        else {
+            // Looks like receiver is not responding
+            self->wakeup_attempts = 0;
+            dart_callback(self, DART_CLBK_TRANSFER_IMPOSSIBLE, NULL, NULL);
+            return DART_ERR_NOT_POSSIBLE;
+        }
+    }
+    if (!dart_get_pin(self, DART_RDY_PIN)) {
+        // Waiting for connection
+        dart_callback(self, DART_CLBK_WAITING, NULL, NULL);
+        return DART_WAITING;
+    }
+
+    if (self->aggr_max_len && !self->aggr_offered) {
+        // Offer aggregation, legacy opponent ignores unknown control byte
+        self->aggr_offered = true;
+        dart_push_byte(self, DART_AGG);
+    }
+#if DART_COMPRESSION
+    if (self->lz_threshold && !self->lz_offered) {
+        // Offer compression, legacy opponent ignores unknown control byte
+        self->lz_offered = true;
+        dart_push_byte(self, DART_LZ | dart_lz_size_class(self));
+    }
+#endif
+#if DART_WINDOW_SIZE > 1
+    if (!self->hello_sent) {
+        // Offer windowed mode, legacy opponent ignores unknown control byte
+        self->hello_sent = true;
+        dart_push_byte(self, DART_HELLO | DART_WINDOW_SIZE);
+    }
+    if (self->window > 1 || msg_list_peek(&self->inflight))
+        return dart_trigger_window_transfer(self);
+#endif
+
+    uint8_t prio;
+    self->transfering = dart_find_next_message_queue(self, &prio);
+    if (!self->transfering) {
+        if (dart_count_pending_requests(self))
+            return DART_PENDING;
+        return DART_IDLE;
+    }
+
+    bool open;
+    self->tx_batch = dart_collect_batch(self, self->transfering, &open);
+    struct msg_ptr *msg_ptr = msg_list_peek(self->transfering);
+    if (open && dart_get_milis(self) - msg_ptr->tstamp < self->aggr_max_delay) {
+        // Wait for more messages, frame is sent at latest when the first one runs out of time
+        self->transfering = NULL;
+        self->tx_batch = 1;
+        self->wakeup_attempts = 0;
+        timer_stop(&self->wakeup_timer);
+        return DART_PENDING;
+    }
+
+    for (uint8_t i=0; i<self->tx_batch; i++, msg_ptr = msg_ptr->next)
+        msg_queue_account_delay_at(&self->queue, prio, msg_ptr, dart_get_milis(self));
+
+    self->tx_prio = prio;
+    self->tx_attempts = 0;
+    if (self->tx_preempted == msg_list_peek(self->transfering)) {
+        // Preempted message continues with attempts it already took
+        self->tx_attempts = self->tx_preempted_attempts;
+        self->tx_preempted = NULL;
+    }
+    self->wakeup_attempts = 0;
+    dart_link_active(self);
+    timer_stop(&self->wakeup_timer);
+    return dart_transfer_msg(self, msg_list_peek(self->transfering));
+}
+
+
+
+
+
+/**
+ * Default scatter-gather transmission
+ *
+ * Sends segments one by one with dart_uart_send(). Port may override it, e.g. to use
+ * writev(). Segments are valid only for the duration of the call, frame header and crc are
+ * kept on the stack, so the port has to copy them before returning. DMA chaining needs its
+ * own copy of the frame.
+ */
+__weak void dart_uart_sendv(const struct dart_iovec *iov, int iovcnt)
+{
+    for (int i=0; i<iovcnt; i++)
+        dart_uart_send(iov[i].base, (int32_t)iov[i].length);
+}
+
+
+/**
+ * Transfer buffer through uart
+ *
+ */
+int dart_push(struct dart *self, uint8_t *buffer, uint32_t length)
+{
+#if DEBUG_DART
+    TRACE_DATA("TX:", buffer, length);
+#endif
+#if DART_CAPTURE
+    if (self->capture)
+        dart_capture_record(self->capture, DART_CAPTURE_TX, dart_get_milis(self), buffer, length);
+#endif
+    self->ops->send(buffer, (int32_t)length, self->ops_private);
+
+    return DART_SUCCESS;
+}
+
+
+/**
+ * Transfer buffer segments through uart
+ *
+ */
+int dart_pushv(struct dart *self, const struct dart_iovec *iov, int iovcnt)
+{
+#if DEBUG_DART
+    for (int i=0; i<iovcnt; i++)
+        TRACE_DATA("TX:", iov[i].base, iov[i].length);
+#endif
+#if DART_CAPTURE
+    if (self->capture)
+        dart_capture_recordv(self->capture, DART_CAPTURE_TX, dart_get_milis(self), iov, iovcnt);
+#endif
+    if (self->ops->sendv) {
+        self->ops->sendv(iov, iovcnt, self->ops_private);
+    }
+    else {
+        for (int i=0; i<iovcnt; i++)
+            self->ops->send(iov[i].base, (int32_t)iov[i].length, self->ops_private);
+    }
+
+    return DART_SUCCESS;
+}
+
+
+#if DART_BYTE_STUFFING
+/**
+ * Transfer frame segments with escaped sync bytes
+ *
+ * The first byte is frame sync and is sent as is. Remaining bytes are stuffed into small
+ * buffer which is pushed whenever full, so sync byte may appear on the line only at frame start.
+ */
+static int dart_pushv_stuffed(struct dart *self, const struct dart_iovec *iov, int iovcnt)
+{
+    uint8_t buffer[DART_STUFFING_CHUNK_LEN];
+    uint32_t cnt = 0;
+    uint32_t skip = DART_SYNC_BYTES;
+
+    for (int i=0; i<iovcnt; i++) {
+        for (uint32_t j=0; j<iov[i].length; j++) {
+            uint8_t ch = iov[i].base[j];
+            if (skip) {
+                buffer[cnt++] = ch;
+                skip--;
+                continue;
+            }
+            if (cnt + 2 > sizeof(buffer)) {
+                dart_push(self, buffer, cnt);
+                cnt = 0;
+            }
+            if (dart_is_stuffed(ch)) {
+                buffer[cnt++] = DART_ESC;
+                ch ^= DART_ESC_XOR;
+            }
+            buffer[cnt++] = ch;
+        }
+    }
+
+    return dart_push(self, buffer, cnt);
+}
+#endif
+
+
 /**
  * Transfer single byte
  *
@@ -422,77 +1611,367 @@ int dart_push_byte(struct dart *self, uint8_t byte)
 }
 
 
+/**
+ * Handle aggregation offer
+ *
+ * Aggregated frames are always accepted, so the offer is answered even if aggregation is not
+ * configured here.
+ */
+static void dart_handle_aggr_offer(struct dart *self)
+{
+    self->aggr_peer = true;
+    if (!self->aggr_offered) {
+        self->aggr_offered = true;
+        dart_push_byte(self, DART_AGG);
+    }
+}
+
+
+#if DART_COMPRESSION
+/**
+ * Compress single message frame if the opponent accepts it and it pays off
+ *
+ * Deferred content pushed by dart_push_msg_payload() consists of two segments, it is sent as
+ * it is.
+ */
+static bool dart_compress_frame(struct dart *self, const struct dart_iovec *data, int data_cnt, struct dart_iovec *packed)
+{
+    if (!self->lz_peer_size || self->lz_threshold == 0)
+        return false;
+    if (data_cnt != 1 || data[0].length < self->lz_threshold)
+        return false;
+    if (data[0].length > self->lz_peer_size)
+        return false;   // Opponent would not fit it into its buffer
+
+    // Compressed frame has to be shorter, incompressible data fails early
+    size_t dst_size = MIN((size_t)self->lz_buffer_size, (size_t)data[0].length - 1);
+    size_t length = lzss_compress(data[0].base, data[0].length, self->lz_tx_buffer, dst_size);
+    if (length == 0)
+        return false;
+
+    packed->base = self->lz_tx_buffer;
+    packed->length = (uint32_t)length;
+    DART_STATS_INC(self, tx_compressed);
+    DART_STATS_ADD(self, tx_compress_saved, data[0].length - length);
+    return true;
+}
+
+
+/**
+ * Decompress received message
+ *
+ * Returns message length, 0 if the data is not valid compressed message.
+ */
+static size_t dart_decompress_msg(struct dart *self, const uint8_t *data, uint32_t data_len)
+{
+    if (self->lz_threshold == 0)
+        return 0;   // Compression was not offered
+
+    size_t msg_len = lzss_decompress(data, data_len, self->lz_rx_buffer, self->lz_buffer_size);
+    return (msg_len >= sizeof(struct msg)) ? msg_len : 0;
+}
+
+
+/**
+ * Handle compression offer
+ *
+ * Offer carries size class of the opponent's decompression buffer, longer messages are sent
+ * plain. Legacy offer without it falls to the smallest class.
+ */
+static void dart_handle_lz_offer(struct dart *self, uint8_t ch)
+{
+    self->lz_peer_size = (uint16_t)(DART_LZ_SIZE_MIN << (ch & DART_LZ_SIZE_MASK));
+    if (self->lz_threshold && !self->lz_offered) {
+        self->lz_offered = true;
+        dart_push_byte(self, DART_LZ | dart_lz_size_class(self));
+    }
+}
+#endif
+
+
+/**
+ * Compose and transfer frame based on given data segments
+ *
+ * Frame header and crc are sent as separate segments, data is not copied unless bytes are
+ * stuffed. Sequenced frame header is used when transferring within window.
+ */
+static int dart_push_framev(struct dart *self, uint8_t sync, const struct dart_iovec *data, int data_cnt)
+{
+    uint8_t head[DART_LEN_BYTES + DART_HDR_SIZE];
+    uint8_t tail[DART_CRC_SIZE];
+    struct dart_iovec iov[DART_FRAME_SEGMENTS + 2];
+    uint32_t data_len = 0;
+    uint32_t crc = DART_CRC_INIT;
+    int cnt = 0;
+
+#if DART_COMPRESSION
+    struct dart_iovec packed;
+    if (sync == DART_SYNC && dart_compress_frame(self, data, data_cnt, &packed)) {
+        sync = DART_SYNC_LZ;
+        data = &packed;
+        data_cnt = 1;
+    }
+#endif
+
+    head[DART_SYNC_IDX] = sync;
+    iov[cnt].base = head;
+    iov[cnt++].length = DART_LEN_BYTES;
+
+#if DART_WINDOW_SIZE > 1
+    if (self->tx_sequenced) {
+        head[DART_SYNC_IDX] = DART_SYNC_SEQ;
+        head[DART_DATA_IDX] = self->tx_hdr;
+        if (sync == DART_SYNC_LZ)
+            head[DART_DATA_IDX] |= DART_HDR_LZ;
+        crc = dart_update_crc(crc, &head[DART_DATA_IDX], DART_HDR_SIZE);
+        iov[0].length += DART_HDR_SIZE;
+        data_len += DART_HDR_SIZE;
+    }
+#endif
+
+    for (int i=0; i<data_cnt; i++) {
+        if (data[i].length == 0)
+            continue;
+        crc = dart_update_crc(crc, data[i].base, data[i].length);
+        data_len += data[i].length;
+        iov[cnt++] = data[i];
+    }
+
+    dart_set_data_len(head, (dart_len_t)data_len);
+    dart_set_crc_value(tail, dart_finalize_crc(crc));
+    DART_STATS_INC(self, tx_frames);
+    DART_STATS_ADD(self, tx_bytes, DART_FRAME_BYTES(data_len));
+    iov[cnt].base = tail;
+    iov[cnt++].length = DART_CRC_SIZE;
+
+#if DART_BYTE_STUFFING
+    return dart_pushv_stuffed(self, iov, cnt);
+#else
+    return dart_pushv(self, iov, cnt);
+#endif
+}
+
+
 /**
  *  Compose and transfer frame based on given message data
  *
  */
 int dart_push_frame(struct dart *self, uint8_t *data, dart_len_t data_len)
 {
-    uint32_t buffer_len = DART_FRAME_BYTES(data_len);
-    uint8_t buffer[buffer_len];
+    struct dart_iovec iov = {
+        .base = data,
+        .length = data_len
+    };
+
+    return dart_push_framev(self, DART_SYNC, &iov, 1);
+}
+
+
+/**
+ * Push message object
+ *
+ */
+int dart_push_msg(struct dart *self, struct msg *msg, dart_len_t msg_len)
+{
+    return dart_push_frame(self, (uint8_t*)msg, msg_len);
+}
+
+
+/**
+ * Push message constructed from msgtype and payload
+ *
+ */
+int dart_push_msg_payload(struct dart *self, msgtype_t msgtype, uint8_t *payload, dart_len_t payload_len)
+{
+    struct dart_iovec iov[] = {
+        { .base = (uint8_t*)&msgtype, .length = sizeof(msgtype) },
+        { .base = payload, .length = payload_len },
+    };
+
+    return dart_push_framev(self, DART_SYNC, iov, ARRAY_SIZE(iov));
+}
+
+
+/**
+ * Generate content of late-bound message and push it
+ *
+ * Content is generated into the deferred buffer for every transfer attempt, so it is always
+ * fresh and takes no pool memory. Nothing is pushed if the buffer was removed meanwhile.
+ */
+static bool dart_push_late_bound_frame(struct dart *self, struct msg_ptr *msg_ptr)
+{
+    if (!dart_is_msg_pushable(self, msg_ptr))
+        return false;
+
+    struct dart_deferred desc;
+    memcpy(&desc, (uint8_t*)&msg_ptr->msg + sizeof(msgtype_t), sizeof(desc));
+
+    struct msg *msg = (struct msg*)self->deferred_buffer;
+    dart_len_t max_len = (dart_len_t)MIN((uint32_t)self->deferred_buffer_size, (uint32_t)DART_MSG_MAX_LEN);
+
+    msg->type = msg_ptr->msg.type;
+    dart_len_t msg_len = desc.generator(msg, max_len, desc.private);
+    msg_len = MIN(MAX(msg_len, (dart_len_t)sizeof(msgtype_t)), max_len);
+
+    dart_push_frame(self, (uint8_t*)msg, msg_len);
+    return true;
+}
+
+
+/**
+ * Push message object, ask for deferred content if needed
+ *
+ * Returns false if content of late-bound message could not be generated.
+ */
+static bool dart_push_msg_frame(struct dart *self, struct msg_ptr *msg_ptr)
+{
+    bool transferred = false;
+
+    if (dart_is_late_bound(msg_ptr))
+        return dart_push_late_bound_frame(self, msg_ptr);
+
+    if (msg_ptr->length == sizeof(struct msg))
+        transferred = dart_deferred_msg_callback(self, msg_ptr);
+
+    if (!transferred)
+        dart_push_frame(self, (uint8_t*)&msg_ptr->msg, msg_ptr->length);
+    return true;
+}
 
-    buffer[DART_SYNC_IDX] = DART_SYNC;
-    dart_set_data_len(buffer, data_len);
 
-    memcpy(dart_get_data(buffer), data, data_len);
+/**
+ * Push several message objects within aggregated frame
+ *
+ * Each message is preceded by its length, message data is not copied.
+ */
+static void dart_push_batch_frame(struct dart *self, struct msg_ptr *msg_ptr, uint8_t batch)
+{
+    uint8_t lens[DART_AGGR_MAX_MSGS][DART_LEN_SIZE];
+    struct dart_iovec iov[DART_FRAME_SEGMENTS];
+    int cnt = 0;
+
+    for (uint8_t i=0; i<batch; i++, msg_ptr = msg_ptr->next) {
+        dart_store_len(lens[i], (dart_len_t)msg_ptr->length);
+        iov[cnt].base = lens[i];
+        iov[cnt++].length = DART_LEN_SIZE;
+        iov[cnt].base = (uint8_t*)&msg_ptr->msg;
+        iov[cnt++].length = msg_ptr->length;
+    }
+
+    dart_push_framev(self, DART_SYNC_AGG, iov, cnt);
+}
 
-    uint32_t crc = dart_calculate_crc(data, data_len);
-    dart_set_crc_value(buffer, data_len, crc);
 
-    dart_push(self, buffer, buffer_len);
+/**
+ * Transfer message object
+ *
+ * Batch of messages is transferred within aggregated frame.
+ */
+int dart_transfer_msg(struct dart *self, struct msg_ptr *msg_ptr)
+{
+    self->tx_tstamp = dart_get_milis(self);
+    if (self->tx_batch > 1) {
+        dart_push_batch_frame(self, msg_ptr, self->tx_batch);
+    }
+    else if (!dart_push_msg_frame(self, msg_ptr)) {
+        dart_retry_transfer(self);      // Reports failure
+        return DART_ERR_NOT_POSSIBLE;
+    }
 
+    dart_start_ack_timer(self);
     return DART_SUCCESS;
 }
 
 
+#if DART_WINDOW_SIZE > 1
 /**
- * Push message object
+ * Transfer message object within sequenced frame
  *
  */
-int dart_push_msg(struct dart *self, struct msg *msg, dart_len_t msg_len)
+static void dart_transfer_seq_msg(struct dart *self, struct msg_ptr *msg_ptr, uint8_t hdr)
 {
-    return dart_push_frame(self, (uint8_t*)msg, msg_len);
+    self->tx_hdr = hdr;
+    self->tx_seq_tstamp[hdr & DART_HDR_SEQ_MASK] = dart_get_milis(self);
+    self->tx_sequenced = true;
+    dart_push_msg_frame(self, msg_ptr);
+    self->tx_sequenced = false;
 }
 
 
 /**
- * Push message constructed from msgtype and payload
+ * Transfer all messages in flight again (go-back-N)
  *
  */
-int dart_push_msg_payload(struct dart *self, msgtype_t msgtype, uint8_t *payload, dart_len_t payload_len)
+static void dart_resend_window(struct dart *self)
 {
-    uint32_t msg_size = sizeof(struct msg_ptr) + payload_len;
-    uint8_t msg_buffer[msg_size];
-
-    struct msg_ptr *msg_ptr = (struct msg_ptr*)msg_buffer;
-    msg_ptr->length = sizeof(msgtype) + payload_len;
-
-    struct msg_data *msg = (struct msg_data*)&msg_ptr->msg;
-    msg->type = msgtype;
-    if (payload_len)
-        memcpy(&msg->data, payload, payload_len);
+    uint8_t seq = self->tx_base;
+
+    for (struct msg_ptr *msg_ptr = self->inflight.msg_head; msg_ptr; msg_ptr = msg_ptr->next) {
+        uint8_t hdr = seq;
+        if (msg_ptr == self->inflight.msg_head && self->tx_resync)
+            hdr |= DART_HDR_RESYNC;
+        dart_transfer_seq_msg(self, msg_ptr, hdr);
+        self->tx_resent |= (uint8_t)(0x1 << seq);
+        seq = (seq + 1) & DART_HDR_SEQ_MASK;
+    }
 
-    return dart_push_msg(self, (struct msg*)msg, msg_ptr->length);
+    self->tx_nak_pending = false;
+    dart_start_ack_timer(self);
 }
 
 
 /**
- * Transfer message object
+ * Fill transmission window with queued messages
  *
  */
-int dart_transfer_msg(struct dart *self, struct msg_ptr *msg_ptr)
+static int dart_trigger_window_transfer(struct dart *self)
 {
-    bool transferred = false;
+    bool started = (msg_list_peek(&self->inflight) == NULL);
+    int status = DART_PENDING;
 
-    if (msg_ptr->length == sizeof(struct msg))
-        transferred = dart_deferred_msg_callback(self, msg_ptr);
+    if (!started && !timer_running(&self->tx_ack_timer)) {
+        // Opponent is ready again, transfer suspended frames
+        dart_resend_window(self);
+    }
 
-    if (!transferred)
-        dart_push_frame(self, (uint8_t*)&msg_ptr->msg, msg_ptr->length);
+    uint8_t prio;
+    struct msg_list *list;
+    while (msg_list_length(&self->inflight) < self->window) {
+        list = dart_find_next_message_queue(self, &prio);
+        if (!list)
+            break;
+
+        struct msg_ptr *msg_ptr = msg_list_pop(list);
+        msg_queue_account_delay_at(&self->queue, prio, msg_ptr, dart_get_milis(self));
+
+        uint8_t hdr = (self->tx_base + msg_list_length(&self->inflight)) & DART_HDR_SEQ_MASK;
+        if (!msg_list_peek(&self->inflight) && self->tx_resync)
+            hdr |= DART_HDR_RESYNC;
+
+        msg_list_push(&self->inflight, msg_ptr);
+        self->transfering = &self->inflight;
+        self->tx_resent &= (uint8_t)~(0x1 << (hdr & DART_HDR_SEQ_MASK));
+        dart_transfer_seq_msg(self, msg_ptr, hdr);
+        status = DART_SUCCESS;
+    }
 
-    timer_start(&self->tx_ack_timer, TIMER_MS, DART_ACK_TIMER_VAL);
-    return DART_SUCCESS;
+    if (!self->transfering) {
+        if (dart_count_pending_requests(self))
+            return DART_PENDING;
+        return DART_IDLE;
+    }
+
+    if (started) {
+        self->tx_attempts = 0;
+        self->wakeup_attempts = 0;
+        dart_link_active(self);
+        timer_stop(&self->wakeup_timer);
+        dart_start_ack_timer(self);
+    }
+
+    return status;
 }
+#endif
 
 
 /**
@@ -504,13 +1983,82 @@ void dart_trigger_next_transfer(struct dart *self)
 {
     int status = dart_trigger_transfer(self);
 
-    if (!self->pending_request && status == DART_IDLE) {
+    if (!dart_count_pending_requests(self) && status == DART_IDLE) {
         // No more queued messages
         dart_callback(self, DART_CLBK_TRANSFER_COMPLETE, NULL, NULL);
     }
 }
 
 
+/**
+ * Push current message (or all messages in flight) again
+ *
+ */
+static void dart_resend_transfer(struct dart *self)
+{
+    DART_STATS_INC(self, tx_retries);
+#if DART_WINDOW_SIZE > 1
+    if (self->transfering == &self->inflight) {
+        dart_resend_window(self);
+        return;
+    }
+#endif
+    dart_transfer_msg(self, msg_list_peek(self->transfering));
+}
+
+
+/**
+ * Release messages which precede the last one of transferred batch
+ *
+ * Given notification is sent for every released message.
+ */
+static void dart_release_batch(struct dart *self, int code)
+{
+    while (self->tx_batch > 1) {
+        struct msg_ptr *msg_ptr = msg_list_pop(self->transfering);
+        dart_callback(self, code, &msg_ptr->msg, (void*)msg_ptr->length);
+        msg_ptr_free(&self->cba, msg_ptr);
+        self->tx_batch--;
+    }
+}
+
+
+/**
+ * Transfer more urgent queued message instead of retrying the current one
+ *
+ * Current message remains queued, it is retried once it is selected again. Returns false if
+ * there is no message allowed to preempt.
+ */
+static bool dart_preempt_transfer(struct dart *self)
+{
+    if (self->preempt_prio >= MSG_PRIO_LENGTH || self->transfering == NULL)
+        return false;
+#if DART_WINDOW_SIZE > 1
+    if (self->transfering == &self->inflight)
+        return false;
+#endif
+
+    uint8_t limit = MIN(self->tx_prio, (uint8_t)(self->preempt_prio + 1));
+    for (uint8_t i=0; i<limit; i++) {
+        struct msg_ptr *msg_ptr = msg_list_peek(msg_queue_get_msg_list(&self->queue, i));
+        if (!msg_ptr)
+            continue;
+        if ((msg_ptr->msg.type & MSG_TYPE_MASK) == MSG_REQUEST && !dart_is_request_slot_free(self))
+            continue;   // Request could not be sent now
+
+        DART_STATS_INC(self, tx_preemptions);
+        self->tx_preempted = msg_list_peek(self->transfering);
+        self->tx_preempted_attempts = self->tx_attempts;
+        self->transfering = NULL;
+        self->tx_batch = 1;
+        dart_trigger_transfer(self);
+        return true;
+    }
+
+    return false;
+}
+
+
 /**
  * Transfer current message again
  *
@@ -524,12 +2072,22 @@ void dart_retry_transfer(struct dart *self)
     struct msg_ptr *msg_ptr = msg_list_peek(self->transfering);
     if (msg_ptr) {
         timer_stop(&self->tx_ack_timer);
-        if (++self->tx_attempts < DART_TX_ATTEMPTS) {
-            // Resend message again
-            dart_transfer_msg(self, msg_ptr);
+        if (dart_msg_expired(self, msg_ptr)) {
+            // Message is useless now, do not waste the link
+            dart_callback(self, DART_CLBK_MESSAGE_EXPIRED, &msg_ptr->msg, (void*)msg_ptr->length);
+            dart_finalize_transfer(self);
+            dart_trigger_next_transfer(self);
+        }
+        else if (++self->tx_attempts < DART_TX_ATTEMPTS && dart_is_msg_pushable(self, msg_ptr)) {
+            // Resend message again unless more urgent one goes first
+            if (!dart_preempt_transfer(self))
+                dart_resend_transfer(self);
         }
         else {
             // Report permanent transfer failure
+            DART_STATS_INC(self, tx_failures);
+            dart_release_batch(self, DART_CLBK_TRANSFER_FAILURE);
+            msg_ptr = msg_list_peek(self->transfering);
             dart_callback(self, DART_CLBK_TRANSFER_FAILURE, &msg_ptr->msg, (void*)msg_ptr->length);
             dart_finalize_transfer(self);
             dart_trigger_next_transfer(self);
@@ -538,6 +2096,109 @@ void dart_retry_transfer(struct dart *self)
 }
 
 
+#if DART_WINDOW_SIZE > 1
+/**
+ * Acknowledge the oldest message in flight
+ *
+ * If acknowledged message is request, put it into pending list.
+ */
+static void dart_acknowledge_seq_msg(struct dart *self)
+{
+    struct msg_ptr *msg_ptr = msg_list_pop(&self->inflight);
+    self->tx_base = (self->tx_base + 1) & DART_HDR_SEQ_MASK;
+
+    if ((msg_ptr->msg.type & MSG_TYPE_MASK) == MSG_REQUEST) {
+        // We need to wait for response if message is REQUEST
+        dart_hold_request(self, msg_ptr);
+    }
+    else {
+        dart_callback(self, DART_CLBK_TRANSFER_DONE, &msg_ptr->msg, (void*)msg_ptr->length);
+        msg_ptr_free(&self->cba, msg_ptr);
+    }
+}
+
+
+/**
+ * Handle cumulative acknowledge
+ *
+ * DART_SACK confirms all frames up to given sequence number, DART_NAK confirms frames
+ * preceding given sequence number and requests retransmission of the remaining ones.
+ */
+static void dart_acknowledge_window(struct dart *self, uint8_t seq, bool nak)
+{
+    if (self->transfering != &self->inflight)
+        return;
+
+    size_t acked = (size_t)((seq - self->tx_base) & DART_HDR_SEQ_MASK);
+    if (!nak)
+        acked++;
+    if (acked > msg_list_length(&self->inflight))
+        return;     // Stale acknowledge
+
+    if (!nak && !(self->tx_resent & (0x1 << seq)))
+        dart_ack_rtt_sample(self, self->tx_seq_tstamp[seq]);
+
+    for (size_t i=0; i<acked; i++)
+        dart_acknowledge_seq_msg(self);
+
+    if (acked) {
+        self->tx_attempts = 0;
+        self->tx_resync = false;
+        self->tx_nak_pending = false;
+    }
+
+    if (!msg_list_peek(&self->inflight)) {
+        timer_stop(&self->tx_ack_timer);
+        self->transfering = NULL;
+    }
+    else if (nak && !self->tx_nak_pending) {
+        // Go back, opponent drops all frames following the missing one
+        dart_retry_transfer(self);
+        self->tx_nak_pending = true;
+        return;
+    }
+    else if (acked) {
+        dart_start_ack_timer(self);
+    }
+
+    if (acked)
+        dart_trigger_next_transfer(self);
+}
+
+
+/**
+ * Handle windowed mode control byte
+ *
+ */
+static void dart_handle_window_ctrl(struct dart *self, uint8_t ch)
+{
+    switch (ch & DART_CTRL_MASK) {
+        case DART_HELLO: {
+            uint8_t window = ch & DART_HDR_SEQ_MASK;
+            self->window = (window < DART_WINDOW_SIZE) ? window : DART_WINDOW_SIZE;
+            if (self->window == 0)
+                self->window = 1;
+            self->tx_resync = true;
+            self->rx_resynced = false;      // Opponent starts over
+            if (!self->hello_sent) {
+                self->hello_sent = true;
+                dart_push_byte(self, DART_HELLO | DART_WINDOW_SIZE);
+            }
+        }   break;
+        case DART_SACK:
+            dart_acknowledge_window(self, ch & DART_HDR_SEQ_MASK, false);
+            break;
+        case DART_NAK:
+            dart_acknowledge_window(self, ch & DART_HDR_SEQ_MASK, true);
+            break;
+        default:
+            // Missing sync byte, ignore
+            break;
+    }
+}
+#endif
+
+
 /**
  * Acknowledge current message
  *
@@ -548,15 +2209,27 @@ void dart_acknowledge_msg(struct dart *self)
     if (!self->transfering)
         return;
 
-    struct msg_ptr *msg_ptr = msg_list_peek(self->transfering);
-    if (!msg_ptr)
+#if DART_WINDOW_SIZE > 1
+    if (self->transfering == &self->inflight) {
+        // Plain acknowledge confirms the oldest frame only
+        dart_acknowledge_window(self, self->tx_base, false);
+        return;
+    }
+#endif
+
+    if (!msg_list_peek(self->transfering))
         return;
 
+    if (self->tx_attempts == 0)
+        dart_ack_rtt_sample(self, self->tx_tstamp);
+
     timer_stop(&self->tx_ack_timer);
+    dart_release_batch(self, DART_CLBK_TRANSFER_DONE);
+
+    struct msg_ptr *msg_ptr = msg_list_peek(self->transfering);
     if ((msg_ptr->msg.type & MSG_TYPE_MASK) == MSG_REQUEST) {
         // We need to wait for response if message is REQUEST
-        timer_start(&self->tx_response_timer, TIMER_MS, DART_RESPONSE_TIMER_VAL);
-        self->pending_request = msg_list_pop(self->transfering);
+        dart_hold_request(self, msg_list_pop(self->transfering));
         self->transfering = NULL;
     }
     else {
@@ -569,15 +2242,37 @@ void dart_acknowledge_msg(struct dart *self)
 }
 
 
+/**
+ * Put acknowledged request into pending table, wait for response
+ *
+ */
+static void dart_hold_request(struct dart *self, struct msg_ptr *msg_ptr)
+{
+    for (int i=0; i<DART_PENDING_REQUESTS; i++) {
+        struct dart_request *request = &self->pending_requests[i];
+        if (!request->msg_ptr) {
+            request->msg_ptr = msg_ptr;
+            request->tstamp = dart_get_milis(self);
+            dart_timer_start(self, &request->timer, dart_get_response_timeout(self));
+            return;
+        }
+    }
+
+    // Requests are sent only if there is a free slot, should not happen
+    dart_callback(self, DART_CLBK_MESSAGE_ABANDONED, &msg_ptr->msg, (void*)msg_ptr->length);
+    msg_ptr_free(&self->cba, msg_ptr);
+}
+
+
 /**
  * Finalize and clean pending request message
  *
  */
-void dart_finalize_request_msg(struct dart *self)
+void dart_finalize_request_msg(struct dart *self, struct dart_request *request)
 {
-    timer_stop(&self->tx_response_timer);
-    cba_free(&self->cba, self->pending_request);
-    self->pending_request = NULL;
+    timer_stop(&request->timer);
+    msg_ptr_free(&self->cba, request->msg_ptr);
+    request->msg_ptr = NULL;
 
     dart_trigger_next_transfer(self);
 }
@@ -588,83 +2283,329 @@ void dart_finalize_request_msg(struct dart *self)
  *
  * Send appropriate notification
  */
-void dart_abandon_request_msg(struct dart *self)
+void dart_abandon_request_msg(struct dart *self, struct dart_request *request)
+{
+    if (request->msg_ptr) {
+        // Estimation turned out to be too optimistic, start over
+        self->response_rtt.srtt = 0;
+        self->response_rtt.rttvar = 0;
+        DART_STATS_INC(self, requests_abandoned);
+        dart_callback(self, DART_CLBK_MESSAGE_ABANDONED, &request->msg_ptr->msg, (void*)request->msg_ptr->length);
+        dart_finalize_request_msg(self, request);
+    }
+}
+
+
+/**
+ * Pass received message to registered handler or to the callback
+ *
+ * Posting copy to process may fail for lack of memory, the callback gets the message then.
+ */
+static void dart_deliver_msg(struct dart *self, struct msg *msg, size_t msg_len)
+{
+#if DART_HANDLERS
+    struct dart_handler *handler = dart_find_handler(self, msg->type);
+    if (handler) {
+        if (!(handler->flags & DART_HANDLER_POST))
+            handler->handler(msg, msg_len, handler->private);
+        else if (process_send_msg((struct process*)handler->private, msg, (uint32_t)msg_len) != PROCESS_SUCCESS)
+            handler = NULL;     // Out of memory, do not lose the message silently
+
+        if (handler && !(handler->flags & DART_HANDLER_NOTIFY))
+            return;
+    }
+#endif
+    dart_callback(self, DART_CLBK_MESSAGE_RECEIVED, msg, (void*)msg_len);
+}
+
+
+/**
+ * Handle received data
+ *
+ * Check if received message is a response for pending request.
+ * Send appropriate notification.
+ */
+void dart_handle_received_msg(struct dart *self, struct msg *received_msg, size_t msg_len)
+{
+    // Find matching request first, message might be overwritten within callback
+    // to unify RESPONSE/REPORT message handler
+    struct dart_request *request = NULL;
+    if ((received_msg->type & MSG_TYPE_MASK) == MSG_RESPONSE)
+        request = dart_find_pending_request(self, received_msg, msg_len);
+
+    dart_deliver_msg(self, received_msg, msg_len);
+
+    if (!request || !request->msg_ptr)
+        return;     // Received message is not expected RESPONSE
+
+    uint32_t sample = dart_get_milis(self) - request->tstamp;
+    dart_rtt_sample(&self->response_rtt, sample);
+#if DART_STATS
+    dart_stats_latency(self->stats.response_latency, sample);
+#endif
+    dart_callback(self, DART_CLBK_TRANSFER_DONE, &request->msg_ptr->msg, (void*)msg_len);
+    dart_finalize_request_msg(self, request);
+}
+
+
+#if DART_WINDOW_SIZE > 1
+/**
+ * Ask for retransmission starting from expected frame
+ *
+ * Only the first frame of a gap is rejected, following ones are silently dropped.
+ */
+static void dart_reject_seq_frame(struct dart *self)
+{
+    if (!self->rx_nak_sent) {
+        self->rx_nak_sent = true;
+        dart_push_byte(self, DART_NAK | self->rx_seq);
+    }
+}
+
+
+/**
+ * Handle received sequenced frame
+ *
+ * Frames are accepted in order only (go-back-N), each accepted frame is acknowledged.
+ * Opponent keeps RESYNC flag until the frame is acknowledged, therefore RESYNC frame which
+ * was already accepted is acknowledged again without being delivered. It is recognized till
+ * the opponent's window moves past it.
+ */
+static void dart_handle_received_seq_frame(struct dart *self, uint8_t *data, dart_len_t data_len)
+{
+    uint8_t hdr = data[0];
+    uint8_t seq = hdr & DART_HDR_SEQ_MASK;
+
+    if (hdr & DART_HDR_RESYNC) {
+        if (self->rx_resynced && seq == self->rx_resync_seq) {
+            dart_push_byte(self, DART_SACK | seq);
+            return;
+        }
+        self->rx_seq = seq;
+    }
+
+    if (seq != self->rx_seq) {
+        dart_reject_seq_frame(self);
+        return;
+    }
+
+    struct msg *msg = (struct msg*)&data[DART_HDR_SIZE];
+    size_t msg_len = data_len - DART_HDR_SIZE;
+#if DART_COMPRESSION
+    if (hdr & DART_HDR_LZ) {
+        msg_len = dart_decompress_msg(self, &data[DART_HDR_SIZE], data_len - DART_HDR_SIZE);
+        if (msg_len == 0) {
+            dart_reject_seq_frame(self);
+            DART_STATS_INC(self, rx_crc_errors);
+            dart_callback(self, DART_CLBK_TRANSFER_CORRUPTED, NULL, NULL);
+            return;
+        }
+        msg = (struct msg*)self->lz_rx_buffer;
+    }
+#endif
+
+    if (hdr & DART_HDR_RESYNC) {
+        self->rx_resync_seq = seq;
+        self->rx_resynced = true;
+    }
+    else if (((seq - self->rx_resync_seq) & DART_HDR_SEQ_MASK) >= self->window) {
+        self->rx_resynced = false;
+    }
+
+    self->rx_seq = (seq + 1) & DART_HDR_SEQ_MASK;
+    self->rx_nak_sent = false;
+    dart_push_byte(self, DART_SACK | seq);
+    dart_handle_received_msg(self, msg, msg_len);
+}
+#endif
+
+
+/**
+ * Check records of aggregated frame
+ *
+ * Every record consists of message length followed by message data.
+ */
+static bool dart_is_batch_valid(uint8_t *data, uint32_t data_len)
+{
+    uint32_t idx = 0;
+
+    if (data_len == 0)
+        return false;
+
+    while (idx < data_len) {
+        if (data_len - idx < DART_LEN_SIZE)
+            return false;
+        uint32_t msg_len = dart_load_len(&data[idx]);
+        idx += DART_LEN_SIZE;
+        if (msg_len < sizeof(struct msg) || msg_len > data_len - idx)
+            return false;
+        idx += msg_len;
+    }
+
+    return true;
+}
+
+
+/**
+ * Split aggregated frame into separate messages
+ *
+ */
+static void dart_handle_received_batch(struct dart *self, uint8_t *data, uint32_t data_len)
+{
+    uint32_t idx = 0;
+
+    while (idx < data_len) {
+        uint32_t msg_len = dart_load_len(&data[idx]);
+        idx += DART_LEN_SIZE;
+        dart_handle_received_msg(self, (struct msg*)&data[idx], msg_len);
+        idx += msg_len;
+    }
+}
+
+
+/**
+ * Drop frame being received if the opponent stopped transmission
+ *
+ */
+static void dart_check_rx_timeout(struct dart *self)
+{
+    if (timer_running(&self->rx_byte_timer) && dart_timer_expired(self, &self->rx_byte_timer)) {
+#if DEBUG_DART
+        TRACE_DATA("RXE:", self->rx_buffer, self->rx_buffer_bytes);
+#endif
+        DART_STATS_INC(self, rx_timeouts);
+        dart_callback(self, DART_CLBK_TRANSFER_INCOMPLETE, NULL, NULL);
+        timer_stop(&self->rx_byte_timer);
+        self->rx_buffer_bytes = 0;
+    }
+}
+
+
+/**
+ * Handle complete frame
+ *
+ */
+static void dart_handle_received_frame(struct dart *self)
 {
-    if (self->pending_request) {
-        dart_callback(self, DART_CLBK_MESSAGE_ABANDONED, &self->pending_request->msg, (void*)self->pending_request->length);
-        dart_finalize_request_msg(self);
+    uint32_t data_len = dart_get_data_len(self->rx_buffer);
+
+#if DEBUG_DART
+    TRACE_DATA("RX:", self->rx_buffer, self->rx_buffer_bytes);
+#endif
+    uint32_t crc_received = dart_get_crc_value(self->rx_buffer, data_len);
+    uint32_t crc_calculated = dart_finalize_crc(self->rx_crc);
+#if DART_WINDOW_SIZE > 1
+    if (self->rx_buffer[DART_SYNC_IDX] == DART_SYNC_SEQ) {
+        if (crc_calculated != crc_received || data_len < DART_HDR_SIZE + sizeof(struct msg)) {
+            dart_reject_seq_frame(self);
+            DART_STATS_INC(self, rx_crc_errors);
+            dart_callback(self, DART_CLBK_TRANSFER_CORRUPTED, NULL, NULL);
+        }
+        else {
+            DART_STATS_INC(self, rx_frames);
+            DART_STATS_ADD(self, rx_bytes, DART_FRAME_BYTES(data_len));
+            dart_handle_received_seq_frame(self, dart_get_data(self->rx_buffer), data_len);
+        }
+    }
+    else
+#endif
+#if DART_COMPRESSION
+    if (self->rx_buffer[DART_SYNC_IDX] == DART_SYNC_LZ) {
+        size_t msg_len = 0;
+        if (crc_calculated == crc_received)
+            msg_len = dart_decompress_msg(self, dart_get_data(self->rx_buffer), data_len);
+        if (msg_len == 0) {
+            dart_push_byte(self, DART_BAD);
+            DART_STATS_INC(self, rx_crc_errors);
+            dart_callback(self, DART_CLBK_TRANSFER_CORRUPTED, NULL, NULL);
+        }
+        else {
+            DART_STATS_INC(self, rx_frames);
+            DART_STATS_ADD(self, rx_bytes, DART_FRAME_BYTES(data_len));
+            dart_push_byte(self, DART_ACK);
+            dart_handle_received_msg(self, (struct msg*)self->lz_rx_buffer, msg_len);
+        }
+    }
+    else
+#endif
+    if (self->rx_buffer[DART_SYNC_IDX] == DART_SYNC_AGG) {
+        if (crc_calculated != crc_received || !dart_is_batch_valid(dart_get_data(self->rx_buffer), data_len)) {
+            dart_push_byte(self, DART_BAD);
+            DART_STATS_INC(self, rx_crc_errors);
+            dart_callback(self, DART_CLBK_TRANSFER_CORRUPTED, NULL, NULL);
+        }
+        else {
+            DART_STATS_INC(self, rx_frames);
+            DART_STATS_ADD(self, rx_bytes, DART_FRAME_BYTES(data_len));
+            dart_push_byte(self, DART_ACK);
+            dart_handle_received_batch(self, dart_get_data(self->rx_buffer), data_len);
+        }
+    }
+    else if (crc_calculated != crc_received) {
+//        WARN("Invalid crc, expected %02X, received %02X", crc_calculated, crc_received);
+        dart_push_byte(self, DART_BAD);
+        DART_STATS_INC(self, rx_crc_errors);
+        dart_callback(self, DART_CLBK_TRANSFER_CORRUPTED, NULL, NULL);
+    }
+    else {
+        DART_STATS_INC(self, rx_frames);
+        DART_STATS_ADD(self, rx_bytes, DART_FRAME_BYTES(data_len));
+        dart_push_byte(self, DART_ACK);
+        dart_handle_received_msg(self, (struct msg*)&self->rx_buffer[DART_DATA_IDX], data_len);
     }
-}
-
-
-/**
- * Handle received data
- *
- * Check if received message is a response for pending request.
- * Send appropriate notification.
- */
-void dart_handle_received_msg(struct dart *self, struct msg *received_msg, size_t msg_len)
-{
-    // Save original msg type
-    // It might be overwritten within callback, to unify RESPONSE/REPORT message handler
-    msgtype_t received_msg_type = received_msg->type;
-
-    dart_callback(self, DART_CLBK_MESSAGE_RECEIVED, received_msg, (void*)msg_len);
-
-    // Check if received message is expected response
-    if (!self->pending_request)
-        return;     // We ware not waiting for response
-    if ((received_msg_type & MSG_TYPE_MASK) != MSG_RESPONSE)
-        return;     // Received message is not RESPONSE
-    if ((self->pending_request->msg.type & MSG_ID_MASK) != (received_msg_type & MSG_ID_MASK))
-        return;     // We are waiting for another response id
 
-    dart_callback(self, DART_CLBK_TRANSFER_DONE, &self->pending_request->msg, (void*)msg_len);
-    dart_finalize_request_msg(self);
+    self->rx_buffer_bytes = 0;
+    timer_stop(&self->rx_byte_timer);
 }
 
 
 /**
- * Receiving handler
+ * Handle byte preceding frame data - sync, control code or frame length
  *
  */
-void dart_handle_received_char(struct dart *self, uint8_t ch)
+static void dart_receive_header_char(struct dart *self, uint8_t ch)
 {
-    if (timer_running(&self->rx_byte_timer) && timer_expired(&self->rx_byte_timer)) {
-#if DEBUG_DART
-        TRACE_DATA("RXE:", self->rx_buffer, self->rx_buffer_bytes);
-#endif
-        dart_callback(self, DART_CLBK_TRANSFER_INCOMPLETE, NULL, NULL);
-        timer_stop(&self->rx_byte_timer);
-        self->rx_buffer_bytes = 0;
-    }
-
-    timer_stop(&self->closing_timer);
-    timer_restart(&self->rx_byte_timer);
     self->rx_buffer[self->rx_buffer_bytes++] = ch;
 
     if (self->rx_buffer_bytes == DART_SYNC_BYTES) {
-        if (ch == DART_SYNC) {
+        if (dart_is_sync(ch)) {
             // New message incoming
-            timer_start(&self->rx_byte_timer, TIMER_MS, DART_BYTE_TIMER_VAL);
-            if (!dart_pin_get_state(DART_WRK_PIN)) {
+            self->rx_crc = DART_CRC_INIT;
+            dart_timer_start(self, &self->rx_byte_timer, DART_BYTE_TIMER_VAL);
+            if (!dart_get_pin(self, DART_WRK_PIN)) {
                 // Probably the opponent started transfer just before our closing
-                dart_pin_set_state(DART_WRK_PIN, true);
+                dart_set_pin(self, DART_WRK_PIN, true);
             }
             return;
         }
-        if (dart_pin_get_state(DART_WRK_PIN)) {
+        if (dart_get_pin(self, DART_WRK_PIN)) {
             switch (ch) {
                 case DART_ACK:
                     dart_acknowledge_msg(self);
                     break;
                 case DART_BAD:
+#if DART_WINDOW_SIZE > 1
+                    if (self->transfering == &self->inflight)
+                        break;      // Sequenced frames are rejected with DART_NAK, this answers false sync
+#endif
                     dart_retry_transfer(self);
                     break;
                 case DART_CAN:
                     dart_trigger_transfer(self);
                     break;
+                case DART_AGG:
+                    dart_handle_aggr_offer(self);
+                    break;
                 default:
+#if DART_COMPRESSION
+                    if ((ch & DART_CTRL_MASK) == DART_LZ) {
+                        dart_handle_lz_offer(self, ch);
+                        break;
+                    }
+#endif
+#if DART_WINDOW_SIZE > 1
+                    dart_handle_window_ctrl(self, ch);
+#endif
                     // Missing sync byte, ignore
                     break;
             }
@@ -687,32 +2628,186 @@ void dart_handle_received_char(struct dart *self, uint8_t ch)
 #if DEBUG_DART
         TRACE_DATA("RXE:", self->rx_buffer, self->rx_buffer_bytes);
 #endif
+        DART_STATS_INC(self, rx_framing_errors);
         dart_callback(self, DART_CLBK_TRANSFER_CORRUPTED, NULL, NULL);
         timer_stop(&self->rx_byte_timer);
         self->rx_buffer_bytes = 0;
-        return;
     }
-    if (self->rx_buffer_bytes < frame_len)
-        return;     // Wait for entire frame
+}
+
+
+/**
+ * Append frame data and crc bytes
+ *
+ * Length must not exceed remaining part of the frame. Crc is calculated on the fly.
+ */
+static void dart_receive_frame_bytes(struct dart *self, const uint8_t *buffer, uint32_t length)
+{
+    uint32_t data_len = dart_get_data_len(self->rx_buffer);
+    uint32_t crc_idx = DART_CRC_IDX(data_len);
+
+    memcpy(&self->rx_buffer[self->rx_buffer_bytes], buffer, length);
+    if (self->rx_buffer_bytes < crc_idx) {
+        uint32_t crc_len = crc_idx - self->rx_buffer_bytes;
+        self->rx_crc = dart_update_crc(self->rx_crc, buffer, (length < crc_len) ? length : crc_len);
+    }
+    self->rx_buffer_bytes += length;
+
+    if (self->rx_buffer_bytes == DART_FRAME_BYTES(data_len))
+        dart_handle_received_frame(self);
+}
+
+
+#if DART_BYTE_STUFFING
+/**
+ * Remove escaping of frame byte
+ *
+ * Returns false if the byte was consumed. Sync byte within frame means the frame was broken,
+ * so it is dropped and reception restarts at once.
+ */
+static bool dart_unstuff_char(struct dart *self, uint8_t *ch)
+{
+    if (self->rx_buffer_bytes == 0) {
+        self->rx_escaped = false;
+        return true;        // Control byte or frame start
+    }
 
-    // Frame complete
+    if (dart_is_reserved_sync(*ch)) {
 #if DEBUG_DART
-    TRACE_DATA("RX:", self->rx_buffer, self->rx_buffer_bytes);
+        TRACE_DATA("RXE:", self->rx_buffer, self->rx_buffer_bytes);
 #endif
-    uint32_t crc_received = dart_get_crc_value(self->rx_buffer, data_len);
-    uint32_t crc_calculated = dart_calculate_crc(dart_get_data(self->rx_buffer), data_len);
-    if (crc_calculated != crc_received) {
-//        WARN("Invalid crc, expected %02X, received %02X", crc_calculated, crc_received);
-        dart_push_byte(self, DART_BAD);
+        DART_STATS_INC(self, rx_framing_errors);
         dart_callback(self, DART_CLBK_TRANSFER_CORRUPTED, NULL, NULL);
+        self->rx_buffer_bytes = 0;
+        self->rx_escaped = false;
+        return true;
     }
-    else {
-        dart_push_byte(self, DART_ACK);
-        dart_handle_received_msg(self, (struct msg*)&self->rx_buffer[DART_DATA_IDX], data_len);
+
+    if (*ch == DART_ESC) {
+        self->rx_escaped = true;
+        return false;
     }
 
-    self->rx_buffer_bytes = 0;
-    timer_stop(&self->rx_byte_timer);
+    if (self->rx_escaped) {
+        self->rx_escaped = false;
+        *ch ^= DART_ESC_XOR;
+    }
+    return true;
+}
+
+
+/**
+ * Count leading frame bytes which may be copied as they are
+ *
+ */
+static uint32_t dart_get_plain_span(struct dart *self, const uint8_t *buffer, uint32_t length)
+{
+    uint32_t span = 0;
+
+    if (self->rx_escaped)
+        return 0;
+    while (span < length && !dart_is_stuffed(buffer[span]))
+        span++;
+
+    return span;
+}
+#endif
+
+
+/**
+ * Handle single received byte
+ *
+ */
+static void dart_receive_char(struct dart *self, uint8_t ch)
+{
+#if DART_BYTE_STUFFING
+    if (!dart_unstuff_char(self, &ch))
+        return;
+#endif
+
+    if (self->rx_buffer_bytes < DART_LEN_BYTES)
+        dart_receive_header_char(self, ch);
+    else
+        dart_receive_frame_bytes(self, &ch, 1);
+}
+
+
+/**
+ * Receiving handler
+ *
+ */
+void dart_handle_received_char(struct dart *self, uint8_t ch)
+{
+#if DART_CAPTURE
+    if (self->capture)
+        dart_capture_append(self->capture, DART_CAPTURE_RX, dart_get_milis(self), &ch, 1);
+#endif
+    dart_check_rx_timeout(self);
+
+    dart_link_active(self);
+    dart_timer_restart(self, &self->rx_byte_timer);
+
+    dart_receive_char(self, ch);
+}
+
+
+/**
+ * Bulk receiving handler
+ *
+ * Handles chunk of received bytes (e.g. DMA buffer or read() result) at once, the chunk may
+ * contain several frames and control codes. Frame data is copied by spans, escaped bytes are
+ * handled one by one.
+ */
+void dart_handle_received_buffer(struct dart *self, const uint8_t *buffer, size_t length)
+{
+    if (length == 0)
+        return;
+
+#if DART_CAPTURE
+    if (self->capture)
+        dart_capture_append(self->capture, DART_CAPTURE_RX, dart_get_milis(self), buffer, (uint32_t)length);
+#endif
+    dart_check_rx_timeout(self);
+
+    dart_link_active(self);
+    dart_timer_restart(self, &self->rx_byte_timer);
+
+    while (length) {
+        uint32_t chunk = 0;
+        if (self->rx_buffer_bytes >= DART_LEN_BYTES) {
+            uint32_t remaining = DART_FRAME_BYTES(dart_get_data_len(self->rx_buffer)) - self->rx_buffer_bytes;
+            chunk = (length < remaining) ? (uint32_t)length : remaining;
+#if DART_BYTE_STUFFING
+            chunk = dart_get_plain_span(self, buffer, chunk);
+#endif
+        }
+
+        if (chunk == 0) {
+            dart_receive_char(self, *buffer++);
+            length--;
+            continue;
+        }
+
+        dart_receive_frame_bytes(self, buffer, chunk);
+        buffer += chunk;
+        length -= chunk;
+    }
+}
+
+
+/**
+ * Suspend transfer until the opponent is ready
+ *
+ * Legacy message stays in the queue, messages in flight are sent again on the next trigger.
+ */
+static void dart_suspend_transfer(struct dart *self)
+{
+#if DART_WINDOW_SIZE > 1
+    if (self->transfering == &self->inflight)
+        return;
+#endif
+    self->transfering = NULL;
+    self->tx_batch = 1;
 }
 
 
@@ -733,30 +2828,38 @@ void dart_handle_transfer_done(struct dart *self)
  */
 int dart_handle_time(struct dart *self)
 {
-    if (self->pending_request) {
-        if (timer_expired(&self->tx_response_timer)) {
-            dart_abandon_request_msg(self);
+    for (int i=0; i<DART_PENDING_REQUESTS; i++) {
+        struct dart_request *request = &self->pending_requests[i];
+        if (request->msg_ptr && dart_timer_expired(self, &request->timer)) {
+            dart_abandon_request_msg(self, request);
         }
     }
 
     if (self->transfering) {
-        if (timer_expired(&self->tx_ack_timer)) {
+        if (dart_timer_expired(self, &self->tx_ack_timer)) {
             timer_stop(&self->tx_ack_timer);
-            if (dart_pin_get_state(DART_RDY_PIN)) {
+            DART_STATS_INC(self, ack_timeouts);
+            if (dart_get_pin(self, DART_RDY_PIN)) {
+                if (self->rto_backoff < DART_RTO_BACKOFF_MAX)
+                    self->rto_backoff++;
                 dart_retry_transfer(self);
             } else {
                 // Looks like the opponent is not ready
-                self->transfering = NULL;
+                dart_suspend_transfer(self);
             }
         }
+        else if (!timer_running(&self->tx_ack_timer)) {
+            // Transfer suspended, re-try when opponent is ready
+            return dart_trigger_transfer(self);
+        }
     } else {
         // Nothing is being transferred
-        if (dart_find_next_message_queue(self)) {
-            if (timer_expired(&self->wakeup_timer)) {
+        if (dart_find_next_message_queue(self, NULL)) {
+            if (dart_timer_expired(self, &self->wakeup_timer)) {
                 // Looks like opponent is not responding
                 timer_stop(&self->wakeup_timer);
                 // Generate spike just in case opponent requires edge to wakup
-                dart_pin_set_state(DART_WRK_PIN, false);
+                dart_set_pin(self, DART_WRK_PIN, false);
                 return DART_WAITING;
             }
             else {
@@ -765,36 +2868,41 @@ int dart_handle_time(struct dart *self)
             }
         } else {
             // There are no more messages
-            if (!self->pending_request && (self->rx_buffer_bytes == 0)) {
-                if (dart_pin_get_state(DART_WRK_PIN)) {
+            if (!dart_count_pending_requests(self) && (self->rx_buffer_bytes == 0)) {
+                if (dart_get_pin(self, DART_WRK_PIN)) {
                     if (timer_running(&self->closing_timer)) {
                         // Closing
-                        if (timer_expired(&self->closing_timer)) {
+                        if (dart_timer_expired(self, &self->closing_timer)) {
                             // Wait some time before idle
-                            dart_pin_set_state(DART_WRK_PIN, false);
-                            timer_start(&self->closing_timer, TIMER_MS, DART_CHILL_TIMER_VAL);
+                            dart_set_pin(self, DART_WRK_PIN, false);
+                            dart_timer_start(self, &self->closing_timer, DART_CHILL_TIMER_VAL);
                         }
                     }
                     else {
                         // Working, wait some time before closing
-                        timer_start(&self->closing_timer, TIMER_MS, DART_CLOSING_TIMER_VAL);
+                        dart_timer_start(self, &self->closing_timer, dart_get_closing_time(self));
+                        self->idle_tstamp = dart_get_milis(self);
+                        self->idle_sampling = true;
                     }
                 }
                 else {
                     if (timer_running(&self->closing_timer)) {
                         // Chilling
-                        if (timer_expired(&self->closing_timer)) {
+                        if (dart_timer_expired(self, &self->closing_timer)) {
                             timer_stop(&self->closing_timer);
-                            if (!dart_pin_get_state(DART_RDY_PIN)) {
+                            if (!dart_get_pin(self, DART_RDY_PIN)) {
                                 // Finally idle
+                                dart_reset_window(self);
+                                dart_reset_aggregation(self);
+                                dart_reset_compression(self);
                                 dart_callback(self, DART_CLBK_IDLE, NULL, NULL);
                             }
                         }
                     }
                     else {
                         // Idle
-                        if (dart_pin_get_state(DART_RDY_PIN)) {
-                            dart_pin_set_state(DART_WRK_PIN, true);
+                        if (dart_get_pin(self, DART_RDY_PIN)) {
+                            dart_set_pin(self, DART_WRK_PIN, true);
                             return DART_PENDING;
                         }
                     }
@@ -829,10 +2937,31 @@ uint8_t dart_guess_priority(uint8_t msg_type)
 
 
 /**
- * Send message data
+ * Queue message object
+ *
+ * Messages at the head of the list which are being transferred or were preempted are never
+ * overtaken, receiver would see them out of order.
  *
  */
-int dart_send_msg_ex(struct dart *self, uint8_t prio, struct msg *msg, dart_len_t msg_len)
+static void dart_enqueue_msg(struct dart *self, uint8_t prio, struct msg_ptr *msg_ptr)
+{
+    struct msg_list *list = &self->queue.list_prio[prio];
+    size_t pinned = 0;
+
+    if (self->transfering == list)
+        pinned = self->tx_batch;
+    if (pinned == 0 && self->tx_preempted && self->tx_preempted == msg_list_peek(list))
+        pinned = 1;
+
+    msg_queue_push_pinned_at(&self->queue, prio, msg_ptr, dart_get_milis(self), pinned);
+}
+
+
+/**
+ * Queue copy of message data
+ *
+ */
+static int dart_queue_msg(struct dart *self, uint8_t prio, struct msg *msg, dart_len_t msg_len, bool has_deadline, uint32_t deadline)
 {
     if (!self->running)
         return DART_ERR_NOT_POSSIBLE;
@@ -841,6 +2970,10 @@ int dart_send_msg_ex(struct dart *self, uint8_t prio, struct msg *msg, dart_len_
         prio = dart_guess_priority(msg->type);
     if (prio >= MSG_PRIO_LENGTH)
         return DART_ERR_NOT_POSSIBLE;
+#if DART_WINDOW_SIZE > 1
+    if (msg_len > DART_MSG_MAX_LEN)
+        return DART_ERR_BAD_LENGTH;
+#endif
 
     struct msg_ptr *msg_ptr = msg_ptr_malloc(&self->cba, msg_len);
     if (!msg_ptr)
@@ -848,12 +2981,196 @@ int dart_send_msg_ex(struct dart *self, uint8_t prio, struct msg *msg, dart_len_
 
     memcpy(&msg_ptr->msg, msg, msg_len);
     msg_ptr->length = msg_len;
+    msg_ptr->has_deadline = has_deadline;
+    msg_ptr->deadline = deadline;
+
+    dart_enqueue_msg(self, prio, msg_ptr);
+    return dart_trigger_transfer(self);
+}
+
+
+/**
+ * Send message data
+ *
+ */
+int dart_send_msg_ex(struct dart *self, uint8_t prio, struct msg *msg, dart_len_t msg_len)
+{
+    return dart_queue_msg(self, prio, msg, msg_len, false, 0);
+}
+
+
+/**
+ * Send message data which is useful only till given deadline
+ *
+ * Deadline is a timestamp of the link clock, i.e. 'get_milis' operation if given, otherwise
+ * clock_get_milis(). Every value is a deadline, 0 included, clock wrapping is handled.
+ * Message which missed its deadline is dropped with DART_CLBK_MESSAGE_EXPIRED notification.
+ * Messages of the same priority are transferred in FIFO order unless dart_set_edf() is set.
+ *
+ */
+int dart_send_msg_deadline(struct dart *self, uint8_t prio, struct msg *msg, dart_len_t msg_len, uint32_t deadline)
+{
+    return dart_queue_msg(self, prio, msg, msg_len, true, deadline);
+}
+
+
+/**
+ * Forward message object without copying
+ *
+ * Message has to be allocated with msg_ptr_malloc() (e.g. taken with process_take_msg())
+ * and must not be listed elsewhere. On success module takes over the caller's reference,
+ * otherwise it remains with the caller.
+ *
+ */
+int dart_forward_msg(struct dart *self, uint8_t prio, struct msg *msg)
+{
+    if (!self->running)
+        return DART_ERR_NOT_POSSIBLE;
+
+    if (prio == DART_MSG_PRIO_ANY)
+        prio = dart_guess_priority(msg->type);
+    if (prio >= MSG_PRIO_LENGTH)
+        return DART_ERR_NOT_POSSIBLE;
+
+    struct msg_ptr *msg_ptr = cast_msg_ptr(msg);
+    if (msg_ptr->length > DART_MSG_MAX_LEN)
+        return DART_ERR_BAD_LENGTH;
+
+    msg_ptr->has_deadline = false;
+    dart_enqueue_msg(self, prio, msg_ptr);
+    return dart_trigger_transfer(self);
+}
+
+
+/**
+ * Send message which content is generated at transfer time
+ *
+ * Only small descriptor is queued. Whenever the frame is pushed 'generator' fills the message
+ * within deferred buffer (type included, already set) and returns its length. It is called
+ * again for every retransmission, so the content is always fresh. Callbacks report the
+ * message type only.
+ *
+ */
+int dart_send_deferred(struct dart *self, uint8_t prio, msgtype_t msgtype, dart_msg_generator_fn generator, void *private)
+{
+    if (!self->running)
+        return DART_ERR_NOT_POSSIBLE;
+
+    if (prio == DART_MSG_PRIO_ANY)
+        prio = dart_guess_priority(msgtype);
+    if (prio >= MSG_PRIO_LENGTH)
+        return DART_ERR_NOT_POSSIBLE;
+    if ((msgtype & MSG_TYPE_MASK) == MSG_REQUEST && self->request_tag_offset)
+        return DART_ERR_NOT_SUPPORTED;  // Tag is not known before transfer
+    if (self->deferred_buffer_size < sizeof(msgtype_t))
+        return DART_ERR_NOT_POSSIBLE;   // No deferred buffer
+
+    struct dart_deferred desc = {
+        .generator = generator,
+        .private = private
+    };
+
+    struct msg_ptr *msg_ptr = msg_ptr_malloc(&self->cba, sizeof(msgtype_t) + sizeof(desc));
+    if (!msg_ptr)
+        return DART_ERR_NO_MEMORY;
+
+    msg_ptr->msg.type = msgtype;
+    memcpy((uint8_t*)&msg_ptr->msg + sizeof(msgtype_t), &desc, sizeof(desc));
+    msg_ptr->length = sizeof(msgtype_t);
+    msg_ptr->private = &dart_deferred_tag;
 
-    msg_queue_push(&self->queue, prio, msg_ptr);
+    dart_enqueue_msg(self, prio, msg_ptr);
     return dart_trigger_transfer(self);
 }
 
 
+/**
+ * Check if message is carried by the frame being transferred
+ *
+ */
+static bool dart_is_msg_transferred(struct dart *self, struct msg_ptr *msg_ptr)
+{
+    if (!self->transfering)
+        return false;
+
+    struct msg_ptr *ptr = msg_list_peek(self->transfering);
+    for (uint8_t i=0; ptr && i<self->tx_batch; i++, ptr = ptr->next) {
+        if (ptr == msg_ptr)
+            return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * Remove message from queue list, unless it is being transferred
+ *
+ */
+static bool dart_cancel_queued_msg(struct dart *self, struct msg_list *list, struct msg_ptr *msg_ptr)
+{
+    if (dart_is_msg_transferred(self, msg_ptr) || !msg_list_remove(list, msg_ptr))
+        return false;
+
+    if (self->tx_preempted == msg_ptr)
+        self->tx_preempted = NULL;
+    DART_STATS_INC(self, tx_cancelled);
+    msg_ptr_free(&self->cba, msg_ptr);
+    return true;
+}
+
+
+/**
+ * Cancel queued messages of given type
+ *
+ * Messages are released without being sent and without notification. Message being
+ * transferred, already sent within window or waiting for response is not affected. Value
+ * DART_MSG_PRIO_ANY of 'prio' searches all priorities. Returns number of cancelled messages.
+ *
+ */
+int dart_cancel_msgtype(struct dart *self, uint8_t prio, msgtype_t msgtype)
+{
+    int cnt = 0;
+
+    for (uint8_t i=0; i<MSG_PRIO_LENGTH; i++) {
+        if (prio != DART_MSG_PRIO_ANY && prio != i)
+            continue;
+
+        struct msg_list *list = msg_queue_get_msg_list(&self->queue, i);
+        struct msg_ptr *msg_ptr = msg_list_peek(list);
+        while (msg_ptr) {
+            struct msg_ptr *next = msg_ptr->next;
+            if (msg_ptr->msg.type == msgtype && dart_cancel_queued_msg(self, list, msg_ptr))
+                cnt++;
+            msg_ptr = next;
+        }
+    }
+
+    return cnt;
+}
+
+
+/**
+ * Cancel queued message object
+ *
+ * Message is the one given to dart_forward_msg(). Caller which wants to keep the handle
+ * valid till cancellation has to retain the message object before forwarding. Returns
+ * DART_ERR_NOT_POSSIBLE if message is not queued or is being transferred already.
+ *
+ */
+int dart_cancel_msg(struct dart *self, struct msg *msg)
+{
+    struct msg_ptr *msg_ptr = cast_msg_ptr(msg);
+
+    for (uint8_t i=0; i<MSG_PRIO_LENGTH; i++) {
+        if (dart_cancel_queued_msg(self, msg_queue_get_msg_list(&self->queue, i), msg_ptr))
+            return DART_SUCCESS;
+    }
+
+    return DART_ERR_NOT_POSSIBLE;
+}
+
+
 /**
  * Send message type
  *
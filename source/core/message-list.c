@@ -21,6 +21,28 @@ struct msg_ptr* msg_ptr_malloc(struct cba *cba, size_t msg_size)
     msg_ptr->next = NULL;
     msg_ptr->private = NULL;
     msg_ptr->length = msg_size;
+    msg_ptr->tstamp = 0;
+    msg_ptr->deadline = 0;
+    msg_ptr->has_deadline = false;
+    msg_ptr->cba = cba;
+    msg_ptr->refs = 1;
+    return msg_ptr;
+}
+
+
+/**
+ * Take additional reference of message pointer object
+ *
+ * Every reference has to be released with msg_ptr_free(). Message object may be linked
+ * into a single list at a time. Returns NULL if the counter is saturated.
+ *
+ */
+struct msg_ptr* msg_ptr_retain(struct msg_ptr *msg_ptr)
+{
+    if (msg_ptr->refs == UINT16_MAX)
+        return NULL;    // Counter would wrap
+
+    msg_ptr->refs++;
     return msg_ptr;
 }
 
@@ -28,13 +50,39 @@ struct msg_ptr* msg_ptr_malloc(struct cba *cba, size_t msg_size)
 /**
  * Free message pointer object
  *
+ * Memory is returned to the allocator which created the object when the last reference
+ * is released. The 'cba' parameter is used only for objects without known allocator.
+ *
  */
 struct msg_ptr* msg_ptr_free(struct cba *cba, struct msg_ptr *msg_ptr)
 {
+    if (msg_ptr == NULL)
+        return NULL;
+
+    if (msg_ptr->refs > 1) {
+        msg_ptr->refs--;
+        return NULL;
+    }
+
+    msg_ptr->refs = 0;
+    if (msg_ptr->cba)
+        cba = msg_ptr->cba;
+
     return cba_free(cba, msg_ptr);
 }
 
 
+/**
+ * Check if message deadline has passed at given time
+ *
+ * Message without deadline never expires.
+ */
+bool msg_ptr_expired_at(struct msg_ptr *msg_ptr, uint32_t now)
+{
+    return msg_ptr->has_deadline && (int32_t)(now - msg_ptr->deadline) > 0;
+}
+
+
 
 
 
@@ -75,6 +123,32 @@ struct msg_ptr* msg_list_push(struct msg_list *self, struct msg_ptr *msg_ptr)
 }
 
 
+/**
+ * Insert message object behind 'pos' message
+ *
+ * Value NULL of 'pos' inserts message at the head of the list.
+ *
+ */
+struct msg_ptr* msg_list_insert_after(struct msg_list *self, struct msg_ptr *pos, struct msg_ptr *msg_ptr)
+{
+    if (pos == NULL) {
+        msg_ptr->next = self->msg_head;
+        self->msg_head = msg_ptr;
+    }
+    else {
+        msg_ptr->next = pos->next;
+        pos->next = msg_ptr;
+    }
+
+    if (msg_ptr->next == NULL)
+        self->msg_tail = msg_ptr;
+
+    self->length++;
+
+    return msg_ptr;
+}
+
+
 /**
  * Pop message object
  *
@@ -116,13 +190,18 @@ struct msg_ptr* msg_list_remove(struct msg_list *self, struct msg_ptr *msg_ptr)
     struct msg_ptr *ptr = self->msg_head;
     struct msg_ptr **tmp = &self->msg_head;
 
+    struct msg_ptr *prev = NULL;
+
     while (ptr) {
         if (ptr == msg_ptr) {
             *tmp = ptr->next;
+            if (self->msg_tail == ptr)
+                self->msg_tail = prev;
             if (self->length > 0)
                 self->length--;
             return ptr;
         }
+        prev = ptr;
         tmp = &ptr->next;
         ptr = ptr->next;
     }
@@ -131,6 +210,65 @@ struct msg_ptr* msg_list_remove(struct msg_list *self, struct msg_ptr *msg_ptr)
 }
 
 
+/**
+ * Move all messages from 'src' list to the end of this list
+ *
+ * Messages are moved as a whole chain, the 'src' list is empty afterwards.
+ *
+ */
+void msg_list_splice(struct msg_list *self, struct msg_list *src)
+{
+    if (src->msg_head == NULL)
+        return;
+
+    if (self->msg_tail)
+        self->msg_tail->next = src->msg_head;
+    else
+        self->msg_head = src->msg_head;
+    self->msg_tail = src->msg_tail;
+    self->length += src->length;
+
+    msg_list_init(src);
+}
+
+
+/**
+ * Pop up to 'n' messages and append them to 'dst' list
+ *
+ * Returns number of moved messages.
+ *
+ */
+size_t msg_list_pop_n(struct msg_list *self, struct msg_list *dst, size_t n)
+{
+    if (n == 0 || self->msg_head == NULL)
+        return 0;
+
+    if (n >= self->length) {
+        n = self->length;
+        msg_list_splice(dst, self);
+        return n;
+    }
+
+    struct msg_ptr *head = self->msg_head;
+    struct msg_ptr *last = head;
+    for (size_t i=1; i<n; i++)
+        last = last->next;
+
+    self->msg_head = last->next;
+    self->length -= n;
+    last->next = NULL;
+
+    if (dst->msg_tail)
+        dst->msg_tail->next = head;
+    else
+        dst->msg_head = head;
+    dst->msg_tail = last;
+    dst->length += n;
+
+    return n;
+}
+
+
 /**
  * Find message after message type
  *
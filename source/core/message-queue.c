@@ -1,5 +1,6 @@
 
 #include "mx/core/message-queue.h"
+#include "mx/timer.h"
 
 
 
@@ -12,6 +13,23 @@
  *
  */
 void msg_queue_init(struct msg_queue *self)
+{
+    for (unsigned int i=0; i<MSG_PRIO_LENGTH; i++) {
+        msg_list_init(&self->list_prio[i]);
+        self->max_delay[i] = 0;
+        self->worst_delay[i] = 0;
+        self->edf[i] = false;
+    }
+}
+
+
+/**
+ * Reset message queue
+ *
+ * Drops all listed messages, aging configuration and statistics are preserved.
+ *
+ */
+void msg_queue_reset(struct msg_queue *self)
 {
     for (unsigned int i=0; i<MSG_PRIO_LENGTH; i++)
         msg_list_init(&self->list_prio[i]);
@@ -29,15 +47,75 @@ struct msg_list* msg_queue_get_msg_list(struct msg_queue *self, uint8_t prio)
     if (prio < MSG_PRIO_LENGTH)
         return &self->list_prio[prio];
 
-    if (prio == MSG_PRIO_ANY) {
+    if (prio == MSG_PRIO_ANY)
+        return msg_queue_select_msg_list(self, NULL, 0);
+
+    return NULL;
+}
+
+
+/**
+ * Return message list which should be served next
+ *
+ * Lists are served in priority order unless head message of some list waits longer than
+ * its aging limit. Overdue lists are served first, the one which exceeded its limit the most
+ * wins. Therefore head-of-line delay of every aged class is bounded by its limit plus
+ * transfer time of one message per other overdue class.
+ *
+ * The 'exclude' parameter is a bitmask of priorities which should not be taken into account.
+ *
+ */
+struct msg_list* msg_queue_select_msg_list(struct msg_queue *self, uint8_t *prio, uint8_t exclude)
+{
+    return msg_queue_select_msg_list_at(self, prio, exclude, clock_get_milis());
+}
+
+
+/**
+ * Return message list which should be served next at given time
+ *
+ * Same as msg_queue_select_msg_list(), for owners running on their own clock.
+ *
+ */
+struct msg_list* msg_queue_select_msg_list_at(struct msg_queue *self, uint8_t *prio, uint8_t exclude, uint32_t now)
+{
+    int selected = -1;
+    int32_t selected_overdue = 0;
+
+    for (unsigned int i=0; i<MSG_PRIO_LENGTH; i++) {
+        if (exclude & (0x1 << i))
+            continue;
+        if (self->max_delay[i] == 0)
+            continue;   // Strict priority
+
+        struct msg_ptr *msg_ptr = msg_list_peek(&self->list_prio[i]);
+        if (msg_ptr == NULL)
+            continue;
+
+        int32_t overdue = (int32_t)(now - msg_ptr->tstamp - self->max_delay[i]);
+        if (overdue >= 0 && (selected < 0 || overdue > selected_overdue)) {
+            selected = i;
+            selected_overdue = overdue;
+        }
+    }
+
+    if (selected < 0) {
         for (unsigned int i=0; i<MSG_PRIO_LENGTH; i++) {
-            struct msg_list *list = &self->list_prio[i];
-            if (msg_list_peek(list))
-                return list;
+            if (exclude & (0x1 << i))
+                continue;
+            if (msg_list_peek(&self->list_prio[i])) {
+                selected = i;
+                break;
+            }
         }
     }
 
-    return NULL;;
+    if (selected < 0)
+        return NULL;
+
+    if (prio)
+        *prio = selected;
+    return &self->list_prio[selected];
 }
 
 
@@ -48,11 +126,54 @@ struct msg_list* msg_queue_get_msg_list(struct msg_queue *self, uint8_t prio)
  *
  */
 struct msg_ptr* msg_queue_push(struct msg_queue *self, uint8_t prio, struct msg_ptr *msg_ptr)
+{
+    return msg_queue_push_at(self, prio, msg_ptr, clock_get_milis());
+}
+
+
+/**
+ * Push message object queued at given time
+ *
+ */
+struct msg_ptr* msg_queue_push_at(struct msg_queue *self, uint8_t prio, struct msg_ptr *msg_ptr, uint32_t now)
+{
+    return msg_queue_push_pinned_at(self, prio, msg_ptr, now, 0);
+}
+
+
+/**
+ * Push message object queued at given time behind pinned messages
+ *
+ * First 'pinned' messages of the list are being served by the owner and keep their place.
+ * List in EDF mode is ordered by deadline behind them, messages with equal deadline keep
+ * FIFO order and messages without deadline follow all the others. Otherwise message is
+ * appended to the list. Insertion walks the list, which is O(n), but keeps intrusive list
+ * shared with FIFO mode and needs no extra memory, queues of a link are short anyway.
+ *
+ */
+struct msg_ptr* msg_queue_push_pinned_at(struct msg_queue *self, uint8_t prio, struct msg_ptr *msg_ptr, uint32_t now, size_t pinned)
 {
     if (prio >= MSG_PRIO_LENGTH)
         return NULL;
 
-    return msg_list_push(&self->list_prio[prio], msg_ptr);
+    struct msg_list *list = &self->list_prio[prio];
+    msg_ptr->tstamp = now;
+    if (!self->edf[prio] || !msg_ptr->has_deadline)
+        return msg_list_push(list, msg_ptr);
+
+    struct msg_ptr *pos = NULL;
+    struct msg_ptr *ptr = msg_list_peek(list);
+    for (; ptr && pinned; pinned--) {
+        pos = ptr;
+        ptr = ptr->next;
+    }
+
+    while (ptr && ptr->has_deadline && (int32_t)(ptr->deadline - msg_ptr->deadline) <= 0) {
+        pos = ptr;
+        ptr = ptr->next;
+    }
+
+    return msg_list_insert_after(list, pos, msg_ptr);
 }
 
 
@@ -62,16 +183,16 @@ struct msg_ptr* msg_queue_push(struct msg_queue *self, uint8_t prio, struct msg_
  */
 struct msg_ptr* msg_queue_pop(struct msg_queue *self, uint8_t *prio)
 {
-    for (unsigned int i=0; i<MSG_PRIO_LENGTH; i++) {
-        struct msg_ptr *msg_ptr = msg_list_pop(&self->list_prio[i]);
-        if (msg_ptr) {
-            if (prio)
-                *prio = i;
-            return msg_ptr;
-        }
-    }
+    uint8_t selected;
+    struct msg_list *list = msg_queue_select_msg_list(self, &selected, 0);
+    if (list == NULL)
+        return NULL;
 
-    return NULL;
+    struct msg_ptr *msg_ptr = msg_list_pop(list);
+    msg_queue_account_delay(self, selected, msg_ptr);
+    if (prio)
+        *prio = selected;
+    return msg_ptr;
 }
 
 
@@ -81,16 +202,11 @@ struct msg_ptr* msg_queue_pop(struct msg_queue *self, uint8_t *prio)
  */
 struct msg_ptr* msg_queue_peek(struct msg_queue *self, uint8_t *prio)
 {
-    for (unsigned int i=0; i<MSG_PRIO_LENGTH; i++) {
-        struct msg_ptr *msg_ptr = msg_list_peek(&self->list_prio[i]);
-        if (msg_ptr) {
-            if (prio)
-                *prio = i;
-            return msg_ptr;
-        }
-    }
+    struct msg_list *list = msg_queue_select_msg_list(self, prio, 0);
+    if (list == NULL)
+        return NULL;
 
-    return NULL;
+    return msg_list_peek(list);
 }
 
 
@@ -116,6 +232,25 @@ struct msg_ptr* msg_queue_find_msgtype(struct msg_queue *self, uint8_t *prio, ms
 }
 
 
+/**
+ * Move all queued messages to the end of 'dst' list
+ *
+ * Messages are ordered by priority, every priority list is moved as a whole chain.
+ * Returns number of moved messages.
+ *
+ */
+size_t msg_queue_drain_into(struct msg_queue *self, struct msg_list *dst)
+{
+    size_t length = 0;
+    for (unsigned int i=0; i<MSG_PRIO_LENGTH; i++) {
+        length += msg_list_length(&self->list_prio[i]);
+        msg_list_splice(dst, &self->list_prio[i]);
+    }
+
+    return length;
+}
+
+
 /**
  * Return number of queued messages
  *
@@ -130,3 +265,67 @@ size_t msg_queue_length(struct msg_queue *self)
 }
 
 
+/**
+ * Set aging limit of given priority
+ *
+ * Message waiting longer than 'max_delay' milliseconds is served before messages of higher
+ * priorities. Value 0 restores strict priority.
+ *
+ */
+void msg_queue_set_max_delay(struct msg_queue *self, uint8_t prio, uint32_t max_delay)
+{
+    if (prio < MSG_PRIO_LENGTH)
+        self->max_delay[prio] = max_delay;
+}
+
+
+/**
+ * Account queueing delay of message which is being served
+ *
+ */
+void msg_queue_account_delay(struct msg_queue *self, uint8_t prio, struct msg_ptr *msg_ptr)
+{
+    msg_queue_account_delay_at(self, prio, msg_ptr, clock_get_milis());
+}
+
+
+/**
+ * Account queueing delay of message which is being served at given time
+ *
+ */
+void msg_queue_account_delay_at(struct msg_queue *self, uint8_t prio, struct msg_ptr *msg_ptr, uint32_t now)
+{
+    if (prio >= MSG_PRIO_LENGTH || msg_ptr == NULL)
+        return;
+
+    uint32_t delay = now - msg_ptr->tstamp;
+    if (delay > self->worst_delay[prio])
+        self->worst_delay[prio] = delay;
+}
+
+
+/**
+ * Return worst observed queueing delay of given priority
+ *
+ */
+uint32_t msg_queue_get_worst_delay(struct msg_queue *self, uint8_t prio)
+{
+    if (prio < MSG_PRIO_LENGTH)
+        return self->worst_delay[prio];
+
+    return 0;
+}
+
+
+/**
+ * Set dispatch order of given priority
+ *
+ * List in EDF mode serves message with the earliest deadline first, see msg_queue_push_pinned_at().
+ * Already queued messages keep their order.
+ *
+ */
+void msg_queue_set_edf(struct msg_queue *self, uint8_t prio, bool edf)
+{
+    if (prio < MSG_PRIO_LENGTH)
+        self->edf[prio] = edf;
+}
@@ -130,6 +130,35 @@ int process_post_msg(struct process *self, struct msg *msg)
 }
 
 
+/**
+ * Take received message
+ *
+ * Message object is kept alive after processing, it has to be released with process_free().
+ * Only message received from the queue may be taken, NULL is returned otherwise. Every
+ * receiver of broadcast may take the same message.
+ *
+ */
+struct msg* process_take_msg(struct msg *msg)
+{
+    return scheduler_take_msg(&default_scheduler, msg);
+}
+
+
+/**
+ * Forward received message
+ *
+ * Message buffer is shared with the receiver, it is never copied.
+ *
+ */
+int process_forward_msg(struct process *self, struct msg *msg)
+{
+    if (scheduler_forward_msg(&default_scheduler, self, msg) == NULL)
+        return PROCESS_ERR_NOT_POSSIBLE;
+
+    return PROCESS_SUCCESS;
+}
+
+
 /**
  * Directly handle message
  *
@@ -113,6 +113,22 @@ void call_process(struct process *proc, msgtype_t ev, struct msg *msg)
 
 
 
+/**
+ * Queue entry of shared message
+ *
+ * Message object may be linked into a single list only, so forwarded message is queued
+ * via separate entry holding its reference. Such entries are marked by 'private' pointing
+ * to scheduler_msg_ref_tag.
+ */
+struct scheduler_msg_ref
+{
+    struct process *receiver;
+    struct msg_ptr *shared;
+};
+
+static uint8_t scheduler_msg_ref_tag;
+
+
 static void scheduler_utilize_poll(struct scheduler *self);
 static void scheduler_utilize_message(struct scheduler *self);
 
@@ -125,6 +141,7 @@ void scheduler_init(struct scheduler *self, void *buffer, uint16_t len)
 {
     cba_init(&self->cba, buffer, len);
     msg_list_init(&self->messages);
+    self->dispatched = NULL;
     self->process_head = NULL;
     self->process_current = NULL;
     self->poll_requested = 0;
@@ -241,8 +258,17 @@ void scheduler_utilize_message(struct scheduler *self)
     if (msg_ptr == NULL)
         return;
 
-    struct msg *msg = &msg_ptr->msg;
     struct process *receiver = (struct process*)msg_ptr->private;
+    if (msg_ptr->private == &scheduler_msg_ref_tag) {
+        struct scheduler_msg_ref *ref = (struct scheduler_msg_ref*)&msg_ptr->msg;
+        receiver = ref->receiver;
+        struct msg_ptr *entry = msg_ptr;
+        msg_ptr = ref->shared;
+        msg_ptr_free(&self->cba, entry);
+    }
+
+    struct msg *msg = &msg_ptr->msg;
+    self->dispatched = msg_ptr;
 
     if (receiver == PROCESS_BROADCAST) {
         struct process *p;
@@ -262,6 +288,7 @@ void scheduler_utilize_message(struct scheduler *self)
         call_process(receiver, msg->type, msg);
     }
 
+    self->dispatched = NULL;
     msg_ptr_free(&self->cba, msg_ptr);
 }
 
@@ -292,6 +319,28 @@ struct msg* scheduler_free(struct scheduler *self, struct msg *msg)
 }
 
 
+/**
+ * Take reference of message being dispatched
+ *
+ * Allows to keep or pass received message further without copying. Only message
+ * dispatched from the queue may be taken, NULL is returned otherwise. Every receiver of
+ * broadcast may take the same message, every reference has to be released with
+ * scheduler_free(). Taken message may be linked into a single list, use
+ * scheduler_forward_msg() to queue it for more processes.
+ *
+ */
+struct msg* scheduler_take_msg(struct scheduler *self, struct msg *msg)
+{
+    if (self->dispatched == NULL || &self->dispatched->msg != msg)
+        return NULL;
+
+    if (!msg_ptr_retain(self->dispatched))
+        return NULL;
+
+    return msg;
+}
+
+
 /**
  * Post message
  *
@@ -312,6 +361,46 @@ void scheduler_post_msg(struct scheduler *self, struct process *proc, struct msg
 }
 
 
+/**
+ * Forward message being dispatched to another process
+ *
+ * Message buffer is never copied, the receiver gets reference of the same object. Message
+ * may be forwarded any number of times, every forward allocates small queue entry only.
+ * Returns forwarded message object or NULL in case of failure.
+ *
+ */
+struct msg* scheduler_forward_msg(struct scheduler *self, struct process *proc, struct msg *msg)
+{
+    if (self->dispatched == NULL || &self->dispatched->msg != msg)
+        return NULL;
+
+    struct msg_ptr *entry = msg_ptr_malloc(&self->cba, sizeof(struct scheduler_msg_ref));
+    if (entry == NULL)
+        return NULL;
+
+    if (scheduler_take_msg(self, msg) == NULL) {
+        msg_ptr_free(&self->cba, entry);
+        return NULL;
+    }
+
+    struct scheduler_msg_ref *ref = (struct scheduler_msg_ref*)&entry->msg;
+    ref->receiver = proc;
+    ref->shared = self->dispatched;
+
+#if (DEBUG_PROCESS >= 2)
+    TRACE_DEBUG("sched: Process '%s' forwards event %02X to process '%s', waiting events %lu",
+                    self->process_current == NULL ? "<sys>" : PROCESS_NAME_STRING(self->process_current),
+                    msg->type,
+                    proc == PROCESS_BROADCAST ? "<broadcast>" : PROCESS_NAME_STRING(proc),
+                    (unsigned long)msg_list_length(&self->messages));
+#endif
+
+    entry->private = &scheduler_msg_ref_tag;
+    msg_list_push(&self->messages, entry);
+    return msg;
+}
+
+
 /**
  * Handle message directly
  *
@@ -0,0 +1,133 @@
+
+#include "mx/lib/lzss.h"
+#include "mx/misc.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/**
+ * Find the longest match of input at given position within preceding window
+ *
+ * The nearest match wins among equal ones. Returns match length, 0 if shorter than
+ * LZSS_MIN_MATCH.
+ */
+static size_t lzss_find_match(const uint8_t *src, size_t src_len, size_t pos, size_t *offset)
+{
+    size_t max_len = MIN(src_len - pos, (size_t)LZSS_MAX_MATCH);
+    size_t start = (pos > LZSS_WINDOW) ? pos - LZSS_WINDOW : 0;
+    size_t best_len = 0;
+
+    if (max_len < LZSS_MIN_MATCH)
+        return 0;
+
+    for (size_t i=pos; i-- > start;) {
+        if (src[i] != src[pos] || src[i + best_len] != src[pos + best_len])
+            continue;   // Cannot be longer than the best one
+
+        size_t len = 1;
+        while (len < max_len && src[i + len] == src[pos + len])
+            len++;
+        if (len > best_len) {
+            best_len = len;
+            *offset = pos - i;
+            if (len == max_len)
+                break;
+        }
+    }
+
+    return (best_len >= LZSS_MIN_MATCH) ? best_len : 0;
+}
+
+
+/**
+ * Compress data
+ *
+ * Returns compressed length, 0 if the result does not fit into 'dst_size' bytes. Passing
+ * 'dst_size' lower than 'src_len' makes incompressible data fail fast.
+ */
+size_t lzss_compress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_size)
+{
+    size_t in = 0;
+    size_t out = 0;
+    size_t flags_idx = 0;
+    uint8_t bit = 0;
+
+    while (in < src_len) {
+        if (bit == 0) {
+            if (out >= dst_size)
+                return 0;
+            flags_idx = out;
+            dst[out++] = 0;
+            bit = 0x01;
+        }
+
+        size_t offset = 0;
+        size_t len = lzss_find_match(src, src_len, in, &offset);
+        if (len) {
+            if (dst_size - out < 2)
+                return 0;
+            uint16_t token = (uint16_t)((offset - 1) << 4 | (len - LZSS_MIN_MATCH));
+            dst[flags_idx] |= bit;
+            dst[out++] = (uint8_t)(token >> 8);
+            dst[out++] = (uint8_t)(token & 0xFF);
+            in += len;
+        }
+        else {
+            if (out >= dst_size)
+                return 0;
+            dst[out++] = src[in++];
+        }
+
+        bit = (uint8_t)(bit << 1);
+    }
+
+    return out;
+}
+
+
+/**
+ * Decompress data
+ *
+ * Returns decompressed length, 0 if input is malformed or the result does not fit into
+ * 'dst_size' bytes.
+ */
+size_t lzss_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_size)
+{
+    size_t in = 0;
+    size_t out = 0;
+    uint8_t flags = 0;
+    uint8_t bit = 0;
+
+    while (in < src_len) {
+        if (bit == 0) {
+            flags = src[in++];
+            bit = 0x01;
+            if (in == src_len)
+                return 0;   // Flags without items
+        }
+
+        if (flags & bit) {
+            if (src_len - in < 2)
+                return 0;
+            uint16_t token = (uint16_t)(src[in] << 8 | src[in + 1]);
+            size_t offset = (size_t)(token >> 4) + 1;
+            size_t len = (size_t)(token & 0x0F) + LZSS_MIN_MATCH;
+            in += 2;
+            if (offset > out || len > dst_size - out)
+                return 0;
+            for (size_t i=0; i<len; i++, out++)
+                dst[out] = dst[out - offset];     // Byte by byte, match may overlap
+        }
+        else {
+            if (out >= dst_size)
+                return 0;
+            dst[out++] = src[in++];
+        }
+
+        bit = (uint8_t)(bit << 1);
+    }
+
+    return out;
+}
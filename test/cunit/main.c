@@ -30,11 +30,19 @@ static bool args_parse(int argc, char *argv[], struct args *args);
 
 
 extern CU_ErrorCode cu_test_cba();
+extern CU_ErrorCode cu_test_crc();
 extern CU_ErrorCode cu_test_dart();
+extern CU_ErrorCode cu_test_dart_bench();
+extern CU_ErrorCode cu_test_dart_capture();
+extern CU_ErrorCode cu_test_dart_linux();
+extern CU_ErrorCode cu_test_dart_stream();
+extern CU_ErrorCode cu_test_lzss();
 extern CU_ErrorCode cu_test_process();
 extern CU_ErrorCode cu_test_avg();
 extern CU_ErrorCode cu_test_message_list();
 extern CU_ErrorCode cu_test_message_queue();
+extern CU_ErrorCode cu_test_message_schema();
+extern CU_ErrorCode cu_test_message_schema_hpp();
 
 
 int main(int argc, char *argv[])
@@ -48,11 +56,19 @@ int main(int argc, char *argv[])
 
     /* Add modules */
     cu_test_cba();
+    cu_test_crc();
     cu_test_dart();
+    cu_test_dart_bench();
+    cu_test_dart_capture();
+    cu_test_dart_linux();
+    cu_test_dart_stream();
+    cu_test_lzss();
     cu_test_process();
     cu_test_avg();
     cu_test_message_list();
     cu_test_message_queue();
+    cu_test_message_schema();
+    cu_test_message_schema_hpp();
 
     if (args.basic) {
         /* Run all tests using the CUnit Basic interface */
@@ -0,0 +1,191 @@
+
+#include <CUnit/Basic.h>
+
+#include "mx/lib/crc.h"
+#include "mx/misc.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+
+static void test_crc16_check_value(void);
+static void test_crc16_engines_equal(void);
+static void test_crc16_benchmark(void);
+static void test_crc32c(void);
+
+
+CU_ErrorCode cu_test_crc()
+{
+    // Test logging to terminal
+    CU_pSuite suite = CU_add_suite("Test CRC module", NULL, NULL);
+    if ( !suite ) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_add_test(suite, "Test crc16 check value",            test_crc16_check_value);
+    CU_add_test(suite, "Test crc16 engines equal",          test_crc16_engines_equal);
+    CU_add_test(suite, "Test crc16 benchmark",              test_crc16_benchmark);
+    CU_add_test(suite, "Test crc32c",                       test_crc32c);
+
+    return CU_get_error();
+}
+
+
+
+typedef uint16_t (*crc16_fn)(uint16_t crc, const uint8_t *buffer, size_t length);
+
+struct crc16_engine
+{
+    const char *name;
+    crc16_fn calculate;
+};
+
+static const struct crc16_engine crc16_engines[] = {
+    { "shift",  crc16_ccitt_shift },
+#if CRC16_ENGINE_BUILT(CRC16_ENGINE_NIBBLE)
+    { "nibble", crc16_ccitt_nibble },
+#endif
+#if CRC16_ENGINE_BUILT(CRC16_ENGINE_TABLE)
+    { "table",  crc16_ccitt_table },
+#endif
+#if CRC16_ENGINE_BUILT(CRC16_ENGINE_SLICE4)
+    { "slice4", crc16_ccitt_slice4 },
+#endif
+#if CRC16_ENGINE_BUILT(CRC16_ENGINE_SLICE8)
+    { "slice8", crc16_ccitt_slice8 },
+#endif
+};
+
+
+
+void test_crc16_check_value(void)
+{
+    const uint8_t check[] = "123456789";
+
+    for (size_t i=0; i<ARRAY_SIZE(crc16_engines); i++) {
+        uint16_t crc = crc16_engines[i].calculate(CRC16_CCITT_INIT, check, 9);
+        CU_ASSERT_EQUAL(crc, 0x29B1);
+    }
+
+    CU_ASSERT_EQUAL(crc16_ccitt(CRC16_CCITT_INIT, check, 9), 0x29B1);
+    CU_ASSERT_EQUAL(crc16_ccitt(CRC16_CCITT_INIT, check, 0), CRC16_CCITT_INIT);
+}
+
+
+
+void test_crc16_engines_equal(void)
+{
+    uint8_t buffer[67];
+    for (size_t i=0; i<sizeof(buffer); i++)
+        buffer[i] = (uint8_t)(i * 151 + 7);
+
+    // Every length and alignment gives the same result
+    unsigned int mismatches = 0;
+    for (size_t offset=0; offset<3; offset++) {
+        for (size_t len=0; len<=sizeof(buffer)-offset; len++) {
+            uint16_t expected = crc16_ccitt_shift(CRC16_CCITT_INIT, &buffer[offset], len);
+            for (size_t i=1; i<ARRAY_SIZE(crc16_engines); i++) {
+                uint16_t crc = crc16_engines[i].calculate(CRC16_CCITT_INIT, &buffer[offset], len);
+                if (crc != expected)
+                    mismatches++;
+            }
+        }
+    }
+    CU_ASSERT_EQUAL(mismatches, 0);
+
+    // Calculation may be continued
+    for (size_t i=0; i<ARRAY_SIZE(crc16_engines); i++) {
+        uint16_t crc = crc16_engines[i].calculate(CRC16_CCITT_INIT, buffer, 13);
+        crc = crc16_engines[i].calculate(crc, &buffer[13], sizeof(buffer) - 13);
+        CU_ASSERT_EQUAL(crc, crc16_ccitt_shift(CRC16_CCITT_INIT, buffer, sizeof(buffer)));
+    }
+}
+
+
+
+#define CRC_BENCH_BUFFER_LEN        4096
+#define CRC_BENCH_ROUNDS            256
+
+static uint64_t crc_bench_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+
+void test_crc16_benchmark(void)
+{
+    static uint8_t buffer[CRC_BENCH_BUFFER_LEN];
+    for (size_t i=0; i<sizeof(buffer); i++)
+        buffer[i] = (uint8_t)(i * 31 + 3);
+
+#if defined(__x86_64__) || defined(__i386__)
+    const char *unit = "tick";      // Time stamp counter, runs at nominal frequency
+#else
+    const char *unit = "ns";
+#endif
+
+    printf("\n");
+    for (size_t i=0; i<ARRAY_SIZE(crc16_engines); i++) {
+        uint16_t crc = CRC16_CCITT_INIT;
+        uint64_t start = crc_bench_ticks();
+        for (int r=0; r<CRC_BENCH_ROUNDS; r++)
+            crc = crc16_engines[i].calculate(crc, buffer, sizeof(buffer));
+        uint64_t ticks = crc_bench_ticks() - start;
+
+        double bytes = (double)CRC_BENCH_BUFFER_LEN * CRC_BENCH_ROUNDS;
+        printf("    crc16 %-6s: %6.3f bytes/%s (crc %04X)\n", crc16_engines[i].name,
+               ticks ? bytes / (double)ticks : 0.0, unit, crc);
+        CU_ASSERT_NOT_EQUAL(ticks, 0);
+    }
+}
+
+
+
+void test_crc32c(void)
+{
+    const uint8_t check[] = "123456789";
+
+    CU_ASSERT_EQUAL(crc32c_sw(CRC32C_INIT, check, 9) ^ CRC32C_XOROUT, 0xE3069283);
+    CU_ASSERT_EQUAL(crc32c(CRC32C_INIT, check, 9) ^ CRC32C_XOROUT, 0xE3069283);
+
+    static uint8_t buffer[CRC_BENCH_BUFFER_LEN];
+    for (size_t i=0; i<sizeof(buffer); i++)
+        buffer[i] = (uint8_t)(i * 31 + 3);
+
+    // Dispatched implementation matches portable one for every length and alignment
+    unsigned int mismatches = 0;
+    for (size_t offset=0; offset<8; offset++) {
+        for (size_t len=0; len<=64; len++) {
+            if (crc32c(CRC32C_INIT, &buffer[offset], len) != crc32c_sw(CRC32C_INIT, &buffer[offset], len))
+                mismatches++;
+        }
+    }
+    CU_ASSERT_EQUAL(mismatches, 0);
+
+    uint32_t crc = crc32c(CRC32C_INIT, buffer, 1000);
+    crc = crc32c(crc, &buffer[1000], sizeof(buffer) - 1000);
+    CU_ASSERT_EQUAL(crc, crc32c_sw(CRC32C_INIT, buffer, sizeof(buffer)));
+
+    uint64_t start = crc_bench_ticks();
+    for (int r=0; r<CRC_BENCH_ROUNDS; r++)
+        crc = crc32c_sw(crc, buffer, sizeof(buffer));
+    uint64_t ticks_sw = crc_bench_ticks() - start;
+
+    start = crc_bench_ticks();
+    for (int r=0; r<CRC_BENCH_ROUNDS; r++)
+        crc = crc32c(crc, buffer, sizeof(buffer));
+    uint64_t ticks = crc_bench_ticks() - start;
+
+    double bytes = (double)CRC_BENCH_BUFFER_LEN * CRC_BENCH_ROUNDS;
+    printf("\n    crc32c sw    : %6.3f bytes/tick\n", ticks_sw ? bytes / (double)ticks_sw : 0.0);
+    printf("    crc32c      : %6.3f bytes/tick (crc %08X)\n", ticks ? bytes / (double)ticks : 0.0, crc);
+}
@@ -3,11 +3,14 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 
 #include "mx/core/dart.h"
+#include "mx/core/process.h"
+#include "mx/cba.h"
 #include "mx/timer.h"
 #include "mx/misc.h"
 
@@ -26,12 +29,15 @@ void LOG_DATA(const char *prefix, uint8_t *data, uint32_t data_len)
 
 static void test_receiving_problems(void);
 static void test_receiving_messages(void);
+static void test_receiving_buffer(void);
 static void test_sending_problems(void);
 static void test_resending(void);
 static void test_sending_reports(void);
+#if DART_PENDING_REQUESTS == 1
 static void test_sending_requests(void);
 static void test_abandon_requests(void);
 static void test_sending_reports_while_waiting_for_response(void);
+#endif
 
 static void test_idle_scenario(void);
 static void test_waiting_scenario(void);
@@ -39,6 +45,35 @@ static void test_sending_scenario(void);
 static void test_receiving_scenario(void);
 
 static void test_deferred_msg_content(void);
+static void test_frame_segments(void);
+static void test_late_bound_msg(void);
+static void test_frame_aggregation(void);
+static void test_transport_ops(void);
+static void test_adaptive_timeouts(void);
+static void test_adaptive_keepalive(void);
+static void test_pending_requests(void);
+static void test_byte_stuffing(void);
+#if DART_BYTE_STUFFING
+static void test_stuffing_across_builds(void);
+#endif
+#if DART_STATS
+static void test_link_statistics(void);
+#endif
+#if DART_HANDLERS
+static void test_handler_registry(void);
+#endif
+#if DART_COMPRESSION
+static void test_payload_compression(void);
+#endif
+static void test_request_aging(void);
+static void test_msg_deadline(void);
+static void test_forward_msg(void);
+static void test_preemption_and_cancel(void);
+static void test_window_negotiation(void);
+static void test_window_receiving(void);
+#if DART_WINDOW_SIZE > 1
+static void test_window_bad_report(void);
+#endif
 
 
 CU_ErrorCode cu_test_dart()
@@ -53,12 +88,15 @@ CU_ErrorCode cu_test_dart()
     }
     CU_add_test(suite, "Receiving problems",                            test_receiving_problems);
     CU_add_test(suite, "Receiving messages",                            test_receiving_messages);
+    CU_add_test(suite, "Receiving buffer",                              test_receiving_buffer);
     CU_add_test(suite, "Sending problems",                              test_sending_problems);
     CU_add_test(suite, "Resending",                                     test_resending);
     CU_add_test(suite, "Sending reports",                               test_sending_reports);
+#if DART_PENDING_REQUESTS == 1
     CU_add_test(suite, "Sending requests",                              test_sending_requests);
     CU_add_test(suite, "Abandon requests",                              test_abandon_requests);
     CU_add_test(suite, "Sending reports while waiting for responses",   test_sending_reports_while_waiting_for_response);
+#endif
 
     CU_add_test(suite, "Idle scenario",                                 test_idle_scenario);
     CU_add_test(suite, "Waiting scenario",                              test_waiting_scenario);
@@ -66,6 +104,35 @@ CU_ErrorCode cu_test_dart()
     CU_add_test(suite, "Receiving scenario",                            test_receiving_scenario);
 
     CU_add_test(suite, "Deffered message content",                      test_deferred_msg_content);
+    CU_add_test(suite, "Frame segments",                                test_frame_segments);
+    CU_add_test(suite, "Late-bound messages",                           test_late_bound_msg);
+    CU_add_test(suite, "Frame aggregation",                             test_frame_aggregation);
+    CU_add_test(suite, "Transport operations",                          test_transport_ops);
+    CU_add_test(suite, "Adaptive timeouts",                             test_adaptive_timeouts);
+    CU_add_test(suite, "Adaptive keep-alive",                           test_adaptive_keepalive);
+    CU_add_test(suite, "Pending requests",                              test_pending_requests);
+    CU_add_test(suite, "Byte stuffing",                                 test_byte_stuffing);
+#if DART_BYTE_STUFFING
+    CU_add_test(suite, "Byte stuffing across builds",                   test_stuffing_across_builds);
+#endif
+#if DART_STATS
+    CU_add_test(suite, "Link statistics",                               test_link_statistics);
+#endif
+#if DART_HANDLERS
+    CU_add_test(suite, "Handler registry",                              test_handler_registry);
+#endif
+#if DART_COMPRESSION
+    CU_add_test(suite, "Payload compression",                           test_payload_compression);
+#endif
+    CU_add_test(suite, "Request aging",                                 test_request_aging);
+    CU_add_test(suite, "Message deadline",                              test_msg_deadline);
+    CU_add_test(suite, "Forward message",                               test_forward_msg);
+    CU_add_test(suite, "Preemption and cancellation",                   test_preemption_and_cancel);
+    CU_add_test(suite, "Window negotiation",                            test_window_negotiation);
+    CU_add_test(suite, "Window receiving",                              test_window_receiving);
+#if DART_WINDOW_SIZE > 1
+    CU_add_test(suite, "Window bad frame report",                       test_window_bad_report);
+#endif
 
     return CU_get_error();
 }
@@ -76,10 +143,17 @@ static bool pin_rdy_state = true;
 
 void dart_uart_open(void) {}
 void dart_uart_close(void) {}
+static uint8_t uart_tx_buffer[64];
+static size_t uart_tx_bytes = 0;
+
 void dart_uart_send(uint8_t *buffer, int32_t length)
 {
-    UNUSED(buffer);
-    UNUSED(length);
+    // Keep the latest transmitted bytes
+    for (int32_t i=0; i<length; i++) {
+        if (uart_tx_bytes == sizeof(uart_tx_buffer))
+            uart_tx_bytes = 0;
+        uart_tx_buffer[uart_tx_bytes++] = buffer[i];
+    }
 }
 bool dart_pin_get_state(int pin_e)
 {
@@ -136,7 +210,8 @@ void clbk_validator(int code, void *param1, void *param2, void *private)
         case DART_CLBK_TRANSFER_DONE:
         case DART_CLBK_TRANSFER_FAILURE:
         case DART_CLBK_MESSAGE_RECEIVED:
-        case DART_CLBK_MESSAGE_ABANDONED: {
+        case DART_CLBK_MESSAGE_ABANDONED:
+        case DART_CLBK_MESSAGE_EXPIRED: {
             struct msg *msg = (struct msg*)param1;
             size_t msg_len = (size_t)param2;
             dv->msg_type = msg->type;
@@ -182,6 +257,9 @@ bool clbk_deferred_msg_content(struct dart *drt, msgtype_t msgtype)
 
 
 
+#define DART_FRAME_LEN(msg_len)         (1 + DART_LEN_SIZE + 1 + msg_len + DART_CRC_SIZE)
+#define DART_PLAIN_FRAME_LEN(data_len)  (1 + DART_LEN_SIZE + data_len + DART_CRC_SIZE)
+
 #define DART_RX_BUFFER_LEN              128
 #define DART_MEMORY_POOL_SIZE           512
 
@@ -239,6 +317,12 @@ uint8_t msg_invalid_len[] = {0x55, 0x00, 0xFF};
 uint8_t msg_valid[] = {0x55, 0x00, 0x02, 0x12, 0x34, 0x0E, 0xC9};
 #endif
 
+#if (DART_LEN_SIZE == 2) && (DART_CRC_SIZE == 4)
+uint8_t msg_invalid_crc[] = {0x55, 0x00, 0x01, 0x01, 0xFF, 0xFF, 0xFF, 0xFF};
+uint8_t msg_invalid_len[] = {0x55, 0x00, 0xFF};
+uint8_t msg_valid[] = {0x55, 0x00, 0x02, 0x12, 0x34, 0x1E, 0x98, 0x68, 0x13};
+#endif
+
 void clbk_receiving_messages(int code, void *param1, void *param2, void *private)
 {
     struct dart_validator *dv = (struct dart_validator*)private;
@@ -283,6 +367,77 @@ void test_receiving_messages(void)
 
 
 
+void clbk_counter(int code, void *param1, void *param2, void *private)
+{
+    UNUSED(param1);
+    UNUSED(param2);
+
+    int *counters = (int*)private;
+    counters[code]++;
+}
+
+void test_receiving_buffer(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    int counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    memset(counters, 0, sizeof(counters));
+    dart_set_callback(drt, counters, clbk_counter);
+
+    // Several frames and control codes within single chunk
+    uint8_t chunk[3 * sizeof(msg_valid) + sizeof(msg_invalid_crc) + 1];
+    size_t len = 0;
+    memcpy(&chunk[len], msg_valid, sizeof(msg_valid));
+    len += sizeof(msg_valid);
+    memcpy(&chunk[len], msg_invalid_crc, sizeof(msg_invalid_crc));
+    len += sizeof(msg_invalid_crc);
+    chunk[len++] = DART_DONE;
+    memcpy(&chunk[len], msg_valid, sizeof(msg_valid));
+    len += sizeof(msg_valid);
+    memcpy(&chunk[len], msg_valid, sizeof(msg_valid));
+    len += sizeof(msg_valid);
+
+    uart_tx_bytes = 0;
+    dart_handle_received_buffer(drt, chunk, len);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 3);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_CORRUPTED], 1);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 4);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_ACK);
+    CU_ASSERT_EQUAL(uart_tx_buffer[1], DART_BAD);
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    // Frames split at every possible position
+    memset(counters, 0, sizeof(counters));
+    for (size_t split=1; split<len; split++) {
+        dart_handle_received_buffer(drt, chunk, split);
+        dart_handle_received_buffer(drt, &chunk[split], len - split);
+    }
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], (int)(3 * (len - 1)));
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_CORRUPTED], (int)(len - 1));
+
+    // Per byte and bulk calls may be mixed
+    memset(counters, 0, sizeof(counters));
+    dart_handle_received_char(drt, msg_valid[0]);
+    dart_handle_received_buffer(drt, &msg_valid[1], 2);
+    dart_handle_received_char(drt, msg_valid[3]);
+    dart_handle_received_buffer(drt, &msg_valid[4], sizeof(msg_valid) - 4);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 1);
+
+    // Unfinished frame is dropped on the next chunk
+    memset(counters, 0, sizeof(counters));
+    dart_handle_received_buffer(drt, msg_valid, 3);
+    clock_update(100, 0);
+    dart_handle_received_buffer(drt, msg_valid, sizeof(msg_valid));
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_INCOMPLETE], 1);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 1);
+
+    dart_clean(drt);
+}
+
+
+
 void test_sending_problems(void)
 {
     int ret;
@@ -478,6 +633,14 @@ uint8_t msg_response_11[] = {0x55, 0x00, 0x01, MSG_RESPONSE | 0x11, 0x72, 0x68};
 uint8_t msg_response_12[] = {0x55, 0x00, 0x01, MSG_RESPONSE | 0x12, 0x42, 0x0B};
 #endif
 
+#if (DART_LEN_SIZE == 2) && (DART_CRC_SIZE == 4)
+uint8_t msg_report_11[] = {0x55, 0x00, 0x01, MSG_REPORT | 0x11, 0xB0, 0x48, 0x17, 0x3D};
+uint8_t msg_request_11[] = {0x55, 0x00, 0x01, MSG_REQUEST | 0x11, 0xF1, 0x33, 0x0A, 0x81};
+uint8_t msg_response_11[] = {0x55, 0x00, 0x01, MSG_RESPONSE | 0x11, 0x32, 0xBE, 0x2C, 0x45};
+uint8_t msg_response_12[] = {0x55, 0x00, 0x01, MSG_RESPONSE | 0x12, 0x21, 0xEE, 0xDF, 0xB1};
+#endif
+
+#if DART_PENDING_REQUESTS == 1
 void test_sending_requests(void)
 {
     int ret;
@@ -668,6 +831,7 @@ void test_sending_reports_while_waiting_for_response(void)
 
     dart_clean(drt);
 }
+#endif /* DART_PENDING_REQUESTS == 1 */
 
 
 void test_idle_scenario(void)
@@ -960,3 +1124,1713 @@ void test_deferred_msg_content(void)
 
     dart_clean(drt);
 }
+
+
+struct dart_loopback
+{
+    uint8_t msg[16];
+    size_t msg_len;
+};
+
+void clbk_loopback(int code, void *param1, void *param2, void *private)
+{
+    struct dart_loopback *lb = (struct dart_loopback*)private;
+
+    if (code == DART_CLBK_MESSAGE_RECEIVED) {
+        lb->msg_len = (size_t)param2;
+        memcpy(lb->msg, param1, lb->msg_len);
+    }
+}
+
+void test_frame_segments(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+    dart_set_deferred_msg_callback(drt, clbk_deferred_msg_content);
+
+    // Receiver decodes transmitted frames
+    static uint8_t peer_rx_buffer[DART_RX_BUFFER_LEN];
+    static uint8_t peer_memory_pool[DART_MEMORY_POOL_SIZE];
+    struct dart _peer;
+    struct dart *peer = &_peer;
+    dart_init(peer, peer_memory_pool, sizeof(peer_memory_pool), peer_rx_buffer, sizeof(peer_rx_buffer));
+
+    struct dart_loopback lb;
+    lb.msg_len = 0;
+    dart_set_callback(peer, &lb, clbk_loopback);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Message object
+    struct msg_p2 msg = { .type = 0x21, .param1 = 0x01, .param2 = 0x02 };
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    dart_handle_received_buffer(peer, uart_tx_buffer, uart_tx_bytes);
+    CU_ASSERT_EQUAL(lb.msg_len, sizeof(msg));
+    CU_ASSERT_EQUAL(memcmp(lb.msg, &msg, sizeof(msg)), 0);
+    dart_handle_received_char(drt, DART_ACK);
+
+    // Message type and payload segments
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, 0x12), DART_SUCCESS);
+    dart_handle_received_buffer(peer, uart_tx_buffer, uart_tx_bytes);
+    CU_ASSERT_EQUAL(lb.msg_len, sizeof(msgtype_t) + 2);
+    CU_ASSERT_EQUAL(((struct msg*)lb.msg)->type, 0x12);
+    CU_ASSERT_EQUAL(lb.msg[sizeof(msgtype_t)], 0x01);
+    CU_ASSERT_EQUAL(lb.msg[sizeof(msgtype_t) + 1], 0x02);
+    dart_handle_received_char(drt, DART_ACK);
+
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    dart_clean(peer);
+    dart_clean(drt);
+}
+
+
+struct dart_snapshot
+{
+    uint8_t value;
+    int calls;
+};
+
+dart_len_t gen_snapshot(struct msg *msg, dart_len_t max_len, void *private)
+{
+    struct dart_snapshot *snapshot = (struct dart_snapshot*)private;
+    uint8_t *data = (uint8_t*)msg + sizeof(msgtype_t);
+
+    CU_ASSERT_EQUAL(max_len, 250);
+    snapshot->calls++;
+    data[0] = snapshot->value;
+    data[1] = (uint8_t)snapshot->calls;
+    return sizeof(msgtype_t) + 2;
+}
+
+void test_late_bound_msg(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    struct dart_validator dv;
+    dart_validator_init(&dv);
+    dart_set_callback(drt, &dv, clbk_validator);
+
+    static uint8_t peer_rx_buffer[DART_RX_BUFFER_LEN];
+    static uint8_t peer_memory_pool[DART_MEMORY_POOL_SIZE];
+    struct dart _peer;
+    struct dart *peer = &_peer;
+    dart_init(peer, peer_memory_pool, sizeof(peer_memory_pool), peer_rx_buffer, sizeof(peer_rx_buffer));
+
+    struct dart_loopback lb;
+    lb.msg_len = 0;
+    dart_set_callback(peer, &lb, clbk_loopback);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Content needs deferred buffer
+    struct dart_snapshot snapshot = { .value = 1, .calls = 0 };
+    CU_ASSERT_EQUAL(dart_send_deferred(drt, DART_MSG_PRIO_ANY, MSG_REPORT | 0x31, gen_snapshot, &snapshot), DART_ERR_NOT_POSSIBLE);
+    static uint8_t deferred_buffer[250];
+    dart_set_deferred_buffer(drt, deferred_buffer, sizeof(deferred_buffer));
+
+    // Queued descriptors take no room for the content
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x30), DART_SUCCESS);
+    for (int i=0; i<3; i++)
+        CU_ASSERT_EQUAL(dart_send_deferred(drt, DART_MSG_PRIO_ANY, MSG_REPORT | 0x31, gen_snapshot, &snapshot), DART_PENDING);
+    CU_ASSERT(3 * sizeof(deferred_buffer) > DART_MEMORY_POOL_SIZE);
+    CU_ASSERT_EQUAL(snapshot.calls, 0);
+
+    // Content is generated when pushed, never aggregated
+    snapshot.value = 7;
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(snapshot.calls, 1);
+    dart_handle_received_buffer(peer, uart_tx_buffer, uart_tx_bytes);
+    CU_ASSERT_EQUAL(lb.msg_len, sizeof(msgtype_t) + 2);
+    CU_ASSERT_EQUAL(((struct msg*)lb.msg)->type, MSG_REPORT | 0x31);
+    CU_ASSERT_EQUAL(lb.msg[sizeof(msgtype_t)], 7);
+
+    // Retransmission carries fresh content
+    snapshot.value = 8;
+    uart_tx_bytes = 0;
+    clock_update(dart_get_ack_timeout(drt) + 1, 0);
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(snapshot.calls, 2);
+    dart_handle_received_buffer(peer, uart_tx_buffer, uart_tx_bytes);
+    CU_ASSERT_EQUAL(lb.msg[sizeof(msgtype_t)], 8);
+    CU_ASSERT_EQUAL(lb.msg[sizeof(msgtype_t) + 1], 2);
+
+    // Callbacks report message type only
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_DONE);
+    CU_ASSERT_EQUAL(dv.msg_type, MSG_REPORT | 0x31);
+    CU_ASSERT_EQUAL(dv.msg_length, sizeof(msgtype_t));
+    CU_ASSERT_EQUAL(snapshot.calls, 3);
+
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(snapshot.calls, 4);
+    dart_handle_received_char(drt, DART_ACK);
+    dart_handle_received_char(drt, DART_DONE);
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    // Message fails once deferred buffer is removed, both in transfer and queued
+    for (int i=0; i<2; i++)
+        CU_ASSERT_EQUAL(dart_send_deferred(drt, DART_MSG_PRIO_ANY, MSG_REPORT | (0x32 + i), gen_snapshot, &snapshot), i ? DART_PENDING : DART_SUCCESS);
+    CU_ASSERT_EQUAL(snapshot.calls, 5);
+    dart_set_deferred_buffer(drt, NULL, 0);
+    int counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    memset(counters, 0, sizeof(counters));
+    dart_set_callback(drt, counters, clbk_counter);
+    uart_tx_bytes = 0;
+    clock_update(dart_get_ack_timeout(drt) + 1, 0);
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(snapshot.calls, 5);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 0);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_FAILURE], 2);
+    CU_ASSERT_FALSE(dart_is_msg_pending(drt, DART_MSG_PRIO_ANY, MSG_REPORT | 0x32));
+    CU_ASSERT_FALSE(dart_is_msg_pending(drt, DART_MSG_PRIO_ANY, MSG_REPORT | 0x33));
+
+    dart_clean(peer);
+    dart_clean(drt);
+}
+
+
+void test_frame_aggregation(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+    dart_set_aggregation(drt, 32, 0);
+
+    int counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    memset(counters, 0, sizeof(counters));
+    dart_set_callback(drt, counters, clbk_counter);
+
+    static uint8_t peer_rx_buffer[DART_RX_BUFFER_LEN];
+    static uint8_t peer_memory_pool[DART_MEMORY_POOL_SIZE];
+    struct dart _peer;
+    struct dart *peer = &_peer;
+    dart_init(peer, peer_memory_pool, sizeof(peer_memory_pool), peer_rx_buffer, sizeof(peer_rx_buffer));
+
+    int peer_counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    memset(peer_counters, 0, sizeof(peer_counters));
+    dart_set_callback(peer, peer_counters, clbk_counter);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Single message is sent within plain frame, aggregation is offered
+    struct msg_p1 msg = { .type = 0x21, .param1 = 0x01 };
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_AGG);
+    CU_ASSERT_EQUAL(uart_tx_buffer[uart_tx_bytes - DART_PLAIN_FRAME_LEN(sizeof(msg))], DART_SYNC);
+
+    // Legacy opponent does not answer, queued messages are sent one by one
+    for (int i=0; i<2; i++) {
+        msg.type++;
+        CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_PENDING);
+    }
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_SYNC);
+    CU_ASSERT(uart_tx_bytes >= DART_PLAIN_FRAME_LEN(sizeof(msg)));         // Stuffing may add bytes
+    CU_ASSERT(uart_tx_bytes < DART_PLAIN_FRAME_LEN(2 * sizeof(msg)));
+
+    // Opponent accepts aggregated frames, offer is not repeated
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_AGG);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 0);
+
+    // Messages queued meanwhile are aggregated
+    for (int i=0; i<2; i++) {
+        msg.type++;
+        CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_PENDING);
+    }
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_DONE], 2);
+    CU_ASSERT_EQUAL(uart_tx_bytes, DART_PLAIN_FRAME_LEN(3 * (DART_LEN_SIZE + sizeof(msg))));
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_SYNC_AGG);
+
+    uint8_t frame[64];
+    size_t frame_len = uart_tx_bytes;
+    memcpy(frame, uart_tx_buffer, frame_len);
+
+    // Receiver splits frame into separate messages
+    uart_tx_bytes = 0;
+    dart_handle_received_buffer(peer, frame, frame_len);
+    CU_ASSERT_EQUAL(peer_counters[DART_CLBK_MESSAGE_RECEIVED], 3);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 1);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_ACK);
+
+    // Single acknowledge completes all of them
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_DONE], 5);
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    // Corrupted aggregated frame is rejected as a whole
+    frame[DART_PLAIN_FRAME_LEN(0) - DART_CRC_SIZE] ^= 0x01;
+    uart_tx_bytes = 0;
+    dart_handle_received_buffer(peer, frame, frame_len);
+    CU_ASSERT_EQUAL(peer_counters[DART_CLBK_MESSAGE_RECEIVED], 3);
+    CU_ASSERT_EQUAL(peer_counters[DART_CLBK_TRANSFER_CORRUPTED], 1);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_BAD);
+
+    // The first message waits for companions within latency budget
+    dart_set_aggregation(drt, 32, 10);
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_PENDING);
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_PENDING);
+    CU_ASSERT_EQUAL(dart_handle_time(drt), DART_PENDING);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 0);
+
+    clock_update(10, 0);
+    CU_ASSERT_EQUAL(dart_handle_time(drt), DART_SUCCESS);
+    CU_ASSERT_EQUAL(uart_tx_bytes, DART_PLAIN_FRAME_LEN(2 * (DART_LEN_SIZE + sizeof(msg))));
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_SYNC_AGG);
+
+    // Permanent failure is reported for every message
+    dart_handle_received_char(drt, DART_BAD);
+    dart_handle_received_char(drt, DART_BAD);
+    dart_handle_received_char(drt, DART_BAD);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_FAILURE], 2);
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    // Expired companion is dropped instead of being sent late
+    dart_set_aggregation(drt, 32, 0);
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_PENDING);
+    CU_ASSERT_EQUAL(dart_send_msg_deadline(drt, DART_MSG_PRIO_ANY, (struct msg*)&msg, sizeof(msg), clock_get_milis() + 5), DART_PENDING);
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_PENDING);
+    clock_update(10, 0);
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_EXPIRED], 1);
+    CU_ASSERT_EQUAL(uart_tx_bytes, DART_PLAIN_FRAME_LEN(2 * (DART_LEN_SIZE + sizeof(msg))));
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_SYNC_AGG);
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_DONE], 8);
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    dart_clean(peer);
+    dart_clean(drt);
+}
+
+
+struct test_link
+{
+    bool pins[2];
+    uint8_t tx_buffer[64];
+    size_t tx_bytes;
+    uint32_t milis;
+};
+
+void test_link_send(uint8_t *buffer, int32_t length, void *private)
+{
+    struct test_link *link = (struct test_link*)private;
+    for (int32_t i=0; i<length; i++)
+        link->tx_buffer[link->tx_bytes++ % sizeof(link->tx_buffer)] = buffer[i];
+}
+
+bool test_link_pin_get_state(int pin_e, void *private)
+{
+    struct test_link *link = (struct test_link*)private;
+    return link->pins[pin_e];
+}
+
+void test_link_pin_set_state(int pin_e, bool state, void *private)
+{
+    struct test_link *link = (struct test_link*)private;
+    link->pins[pin_e] = state;
+}
+
+uint32_t test_link_get_milis(void *private)
+{
+    struct test_link *link = (struct test_link*)private;
+    return link->milis;
+}
+
+void test_transport_ops(void)
+{
+    static const struct dart_ops ops = {
+        .send = test_link_send,
+        .pin_get_state = test_link_pin_get_state,
+        .pin_set_state = test_link_pin_set_state,
+        .get_milis = test_link_get_milis,
+    };
+
+    // Two links driven by one process, default transport is down
+    dart_pin_set_state(DART_RDY_PIN, false);
+    dart_pin_set_state(DART_WRK_PIN, false);
+
+    struct test_link link_a = { .pins = { true, true }, .tx_bytes = 0, .milis = 0 };
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+    dart_set_ops(drt, &link_a, &ops);
+
+    int counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    memset(counters, 0, sizeof(counters));
+    dart_set_callback(drt, counters, clbk_counter);
+
+    static uint8_t peer_rx_buffer[DART_RX_BUFFER_LEN];
+    static uint8_t peer_memory_pool[DART_MEMORY_POOL_SIZE];
+    struct test_link link_b = { .pins = { true, true }, .tx_bytes = 0, .milis = 0 };
+    struct dart _peer;
+    struct dart *peer = &_peer;
+    dart_init(peer, peer_memory_pool, sizeof(peer_memory_pool), peer_rx_buffer, sizeof(peer_rx_buffer));
+    dart_set_ops(peer, &link_b, &ops);
+
+    int peer_counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    memset(peer_counters, 0, sizeof(peer_counters));
+    dart_set_callback(peer, peer_counters, clbk_counter);
+
+    uart_tx_bytes = 0;
+    struct msg_p1 msg = { .type = 0x21, .param1 = 0x01 };
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    CU_ASSERT_NOT_EQUAL(link_a.tx_bytes, 0);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 0);
+
+    // Retransmission follows own clock of the link
+    size_t frame_len = DART_PLAIN_FRAME_LEN(sizeof(msg));
+    size_t sent = link_a.tx_bytes;
+    clock_update(1000, 0);
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(link_a.tx_bytes, sent);
+    link_a.milis += 1000;
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(link_a.tx_bytes, sent + frame_len);
+
+    // Opponent receives and acknowledges through its own link
+    dart_handle_received_buffer(peer, &link_a.tx_buffer[sent], frame_len);
+    CU_ASSERT_EQUAL(peer_counters[DART_CLBK_MESSAGE_RECEIVED], 1);
+    dart_handle_received_buffer(drt, link_b.tx_buffer, link_b.tx_bytes);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_DONE], 1);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 0);
+
+    // Pins of the link are used
+    link_a.milis += 1000;
+    dart_handle_time(drt);
+    link_a.milis += 1000;
+    dart_handle_time(drt);
+    CU_ASSERT_FALSE(link_a.pins[DART_WRK_PIN]);
+    CU_ASSERT_TRUE(link_b.pins[DART_WRK_PIN]);
+
+    // Deadlines follow the link clock
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_send_msg_deadline(drt, DART_MSG_PRIO_ANY, (struct msg*)&msg, sizeof(msg), link_a.milis + 5), DART_PENDING);
+    CU_ASSERT_EQUAL(dart_send_msg_deadline(drt, DART_MSG_PRIO_ANY, (struct msg*)&msg, sizeof(msg), link_a.milis + 50), DART_PENDING);
+    link_a.milis += 10;
+    sent = link_a.tx_bytes;
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_EXPIRED], 1);
+    CU_ASSERT_EQUAL(link_a.tx_bytes, sent + frame_len);
+    dart_handle_received_char(drt, DART_ACK);
+
+    // So does the wait for aggregated messages
+    dart_set_aggregation(drt, 32, 10);
+    dart_handle_received_char(drt, DART_AGG);
+    sent = link_a.tx_bytes;
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_PENDING);
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(link_a.tx_bytes, sent);
+    link_a.milis += 10;
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(link_a.tx_bytes, sent + frame_len);
+    dart_handle_received_char(drt, DART_ACK);
+    dart_set_aggregation(drt, 0, 0);
+
+    // Default transport restored
+    dart_set_ops(drt, NULL, NULL);
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    CU_ASSERT_NOT_EQUAL(uart_tx_bytes, 0);
+
+    dart_clean(peer);
+    dart_clean(drt);
+}
+
+
+void test_adaptive_timeouts(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    int counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    memset(counters, 0, sizeof(counters));
+    dart_set_callback(drt, counters, clbk_counter);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Default values until round trip is measured
+    CU_ASSERT_EQUAL(dart_get_ack_timeout(drt), 300);
+    CU_ASSERT_EQUAL(dart_get_response_timeout(drt), 3000);
+
+    // srtt = 10, rttvar = 5
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x11), DART_SUCCESS);
+    clock_update(10, 0);
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dart_get_ack_timeout(drt), 30);
+
+    // Timeout is doubled after every retransmission
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x12), DART_SUCCESS);
+    clock_update(30, 0);
+    uart_tx_bytes = 0;
+    dart_handle_time(drt);
+    CU_ASSERT_NOT_EQUAL(uart_tx_bytes, 0);
+    CU_ASSERT_EQUAL(dart_get_ack_timeout(drt), 60);
+
+    // Acknowledge of retransmitted frame is ambiguous, it is not sampled (Karn's rule)
+    clock_update(5, 0);
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_DONE], 2);
+    CU_ASSERT_EQUAL(dart_get_ack_timeout(drt), 60);
+
+    // Valid sample clears backoff, srtt = 10, rttvar = 3.75
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x13), DART_SUCCESS);
+    clock_update(10, 0);
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dart_get_ack_timeout(drt), 25);
+
+    // Response time is measured from request acknowledge
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REQUEST | 0x11), DART_SUCCESS);
+    clock_update(10, 0);
+    dart_handle_received_char(drt, DART_ACK);
+    clock_update(50, 0);
+    dart_handle_received_buffer(drt, msg_response_11, sizeof(msg_response_11));
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_DONE], 4);
+    CU_ASSERT_EQUAL(dart_get_response_timeout(drt), 3000);     // Fast responses do not shorten it
+
+    // Abandoned request restores default response timeout
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REQUEST | 0x11), DART_SUCCESS);
+    clock_update(10, 0);
+    dart_handle_received_char(drt, DART_ACK);
+    clock_update(3000, 0);
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_ABANDONED], 1);
+    CU_ASSERT_EQUAL(dart_get_response_timeout(drt), 3000);
+
+    // Slow response extends timeout, srtt = 2500, rttvar = 1250
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REQUEST | 0x11), DART_SUCCESS);
+    clock_update(10, 0);
+    dart_handle_received_char(drt, DART_ACK);
+    clock_update(2500, 0);
+    dart_handle_received_buffer(drt, msg_response_11, sizeof(msg_response_11));
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_DONE], 5);
+    CU_ASSERT_EQUAL(dart_get_response_timeout(drt), 7500);
+
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REQUEST | 0x11), DART_SUCCESS);
+    clock_update(10, 0);
+    dart_handle_received_char(drt, DART_ACK);
+    clock_update(5000, 0);
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_ABANDONED], 1);
+    dart_handle_received_buffer(drt, msg_response_11, sizeof(msg_response_11));
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_DONE], 6);
+
+    dart_clean(drt);
+}
+
+
+/**
+ * Send single message and let the link go quiet
+ *
+ */
+static void keepalive_burst(struct dart *drt)
+{
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x11), DART_SUCCESS);
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dart_handle_time(drt), DART_IDLE);
+}
+
+void test_adaptive_keepalive(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Disabled by default
+    CU_ASSERT_EQUAL(dart_get_closing_time(drt), 50);
+    dart_set_keepalive(drt, 500);
+    CU_ASSERT_EQUAL(dart_get_closing_time(drt), 50);
+
+    // Bursts every 200 ms, srtt = 200, rttvar = 100 after the second gap
+    keepalive_burst(drt);
+    clock_update(200, 0);
+    keepalive_burst(drt);
+    CU_ASSERT_EQUAL(dart_get_closing_time(drt), 50);
+    clock_update(200, 0);
+    keepalive_burst(drt);
+    CU_ASSERT_EQUAL(dart_get_closing_time(drt), 500);
+    clock_update(200, 0);
+    keepalive_burst(drt);
+    CU_ASSERT_EQUAL(dart_get_closing_time(drt), 425);
+
+    // Link is held awake over the gap
+    clock_update(200, 0);
+    CU_ASSERT_EQUAL(dart_handle_time(drt), DART_IDLE);
+    CU_ASSERT_TRUE(dart_pin_get_state(DART_WRK_PIN));
+    keepalive_burst(drt);
+
+    // Long silence closes the link when the hold expires
+    clock_update(400, 0);
+    dart_handle_time(drt);
+    CU_ASSERT_FALSE(dart_pin_get_state(DART_WRK_PIN));
+
+    // Sparse traffic restores default closing
+    dart_pin_set_state(DART_WRK_PIN, true);
+    clock_update(5000, 0);
+    keepalive_burst(drt);
+    CU_ASSERT_EQUAL(dart_get_closing_time(drt), 50);
+
+    dart_clean(drt);
+}
+
+
+struct request_tracker
+{
+    int counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    uint8_t done_tag;
+};
+
+void clbk_request_tracker(int code, void *param1, void *param2, void *private)
+{
+    UNUSED(param2);
+
+    struct request_tracker *rt = (struct request_tracker*)private;
+    rt->counters[code]++;
+    if (code == DART_CLBK_TRANSFER_DONE)
+        rt->done_tag = ((struct msg_p1*)param1)->param1;
+}
+
+void dart_feed_msg(struct dart *drt, struct dart *peer, struct msg *msg, dart_len_t msg_len)
+{
+    // Opponent composes the frame, window offer is skipped
+    uint8_t frame[64];
+    size_t frame_len = DART_PLAIN_FRAME_LEN(msg_len);
+    uart_tx_bytes = 0;
+    dart_send_msg(peer, msg, msg_len);
+    memcpy(frame, &uart_tx_buffer[uart_tx_bytes - frame_len], frame_len);
+    dart_handle_received_char(peer, DART_ACK);
+    uart_tx_bytes = 0;
+
+    dart_handle_received_buffer(drt, frame, frame_len);
+}
+
+void test_pending_requests(void)
+{
+    int ret;
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+    dart_set_request_tag(drt, 1);
+
+    struct request_tracker rt;
+    memset(&rt, 0, sizeof(rt));
+    dart_set_callback(drt, &rt, clbk_request_tracker);
+
+    static uint8_t peer_rx_buffer[DART_RX_BUFFER_LEN];
+    static uint8_t peer_memory_pool[DART_MEMORY_POOL_SIZE];
+    struct dart _peer;
+    struct dart *peer = &_peer;
+    dart_init(peer, peer_memory_pool, sizeof(peer_memory_pool), peer_rx_buffer, sizeof(peer_rx_buffer));
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    struct msg_p1 request = { .type = MSG_REQUEST | 0x11, .param1 = 1 };
+    struct msg_p1 response = { .type = MSG_RESPONSE | 0x11, .param1 = 1 };
+
+    ret = dart_send_msg(drt, (struct msg*)&request, sizeof(request));
+    CU_ASSERT_EQUAL(ret, DART_SUCCESS);
+    dart_handle_received_char(drt, DART_ACK);
+
+#if DART_PENDING_REQUESTS > 1
+    // Independent requests overlap, even the ones of the same id
+    request.param1 = 2;
+    ret = dart_send_msg(drt, (struct msg*)&request, sizeof(request));
+    CU_ASSERT_EQUAL(ret, DART_SUCCESS);
+    dart_handle_received_char(drt, DART_ACK);
+    request.type = MSG_REQUEST | 0x12;
+    request.param1 = 3;
+    for (int i=2; i<DART_PENDING_REQUESTS; i++) {
+        ret = dart_send_msg(drt, (struct msg*)&request, sizeof(request));
+        CU_ASSERT_EQUAL(ret, DART_SUCCESS);
+        dart_handle_received_char(drt, DART_ACK);
+    }
+
+    // Table is full
+    request.type = MSG_REQUEST | 0x13;
+    request.param1 = 4;
+    ret = dart_send_msg(drt, (struct msg*)&request, sizeof(request));
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+
+    // Response is matched by id and tag, not by order
+    response.param1 = 2;
+    dart_feed_msg(drt, peer, (struct msg*)&response, sizeof(response));
+    CU_ASSERT_EQUAL(rt.counters[DART_CLBK_TRANSFER_DONE], 1);
+    CU_ASSERT_EQUAL(rt.done_tag, 2);
+    CU_ASSERT_TRUE(dart_is_msg_pending(drt, DART_MSG_PRIO_ANY, MSG_REQUEST | 0x11));
+
+    // Freed slot is taken by queued request
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_ACK);
+    CU_ASSERT_EQUAL(uart_tx_buffer[1], DART_SYNC);
+    CU_ASSERT_EQUAL(uart_tx_buffer[3 + DART_LEN_SIZE], 4);
+    dart_handle_received_char(drt, DART_ACK);
+
+    // Response with unknown tag is just a message
+    response.param1 = 5;
+    dart_feed_msg(drt, peer, (struct msg*)&response, sizeof(response));
+    CU_ASSERT_EQUAL(rt.counters[DART_CLBK_MESSAGE_RECEIVED], 2);
+    CU_ASSERT_EQUAL(rt.counters[DART_CLBK_TRANSFER_DONE], 1);
+
+    response.param1 = 1;
+    dart_feed_msg(drt, peer, (struct msg*)&response, sizeof(response));
+    CU_ASSERT_EQUAL(rt.done_tag, 1);
+
+    // Every request has its own timeout
+    clock_update(3000, 0);
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(rt.counters[DART_CLBK_MESSAGE_ABANDONED], DART_PENDING_REQUESTS - 1);
+    CU_ASSERT_FALSE(dart_is_sending(drt));
+#else
+    // Another request waits for response
+    request.param1 = 2;
+    ret = dart_send_msg(drt, (struct msg*)&request, sizeof(request));
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+
+    // Response is matched by tag
+    response.param1 = 2;
+    dart_feed_msg(drt, peer, (struct msg*)&response, sizeof(response));
+    CU_ASSERT_EQUAL(rt.counters[DART_CLBK_TRANSFER_DONE], 0);
+
+    response.param1 = 1;
+    dart_feed_msg(drt, peer, (struct msg*)&response, sizeof(response));
+    CU_ASSERT_EQUAL(rt.counters[DART_CLBK_TRANSFER_DONE], 1);
+    CU_ASSERT_EQUAL(rt.done_tag, 1);
+    CU_ASSERT_EQUAL(uart_tx_buffer[1], DART_SYNC);
+    CU_ASSERT_EQUAL(uart_tx_buffer[3 + DART_LEN_SIZE], 2);
+    dart_handle_received_char(drt, DART_ACK);
+
+    clock_update(3000, 0);
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(rt.counters[DART_CLBK_MESSAGE_ABANDONED], 1);
+#endif
+
+    dart_clean(peer);
+    dart_clean(drt);
+}
+
+
+void test_byte_stuffing(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    static uint8_t peer_rx_buffer[DART_RX_BUFFER_LEN];
+    static uint8_t peer_memory_pool[DART_MEMORY_POOL_SIZE];
+    struct dart _peer;
+    struct dart *peer = &_peer;
+    dart_init(peer, peer_memory_pool, sizeof(peer_memory_pool), peer_rx_buffer, sizeof(peer_rx_buffer));
+
+    struct dart_loopback lb;
+    lb.msg_len = 0;
+    dart_set_callback(peer, &lb, clbk_loopback);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Message data contains sync and escape bytes
+    struct msg_p2 msg = { .type = 0x21, .param1 = DART_SYNC, .param2 = DART_ESC };
+    uint8_t wire[32];
+    size_t wire_len;
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    wire_len = uart_tx_bytes;
+    memcpy(wire, uart_tx_buffer, wire_len);
+    dart_handle_received_char(drt, DART_ACK);
+
+    // Window offer may precede the frame
+    size_t frame_start = wire_len;
+    int syncs = 0;
+    for (size_t i=0; i<wire_len; i++) {
+        if (wire[i] == DART_SYNC) {
+            frame_start = (syncs == 0) ? i : frame_start;
+            syncs++;
+        }
+    }
+
+#if DART_BYTE_STUFFING
+    // Sync byte appears at frame start only, both special bytes are escaped
+    CU_ASSERT_EQUAL(syncs, 1);
+    CU_ASSERT_EQUAL(wire_len - frame_start, DART_PLAIN_FRAME_LEN(sizeof(msg)) + 2);
+#else
+    CU_ASSERT_EQUAL(syncs, 2);
+#endif
+
+    dart_handle_received_buffer(peer, wire, wire_len);
+    CU_ASSERT_EQUAL(lb.msg_len, sizeof(msg));
+    CU_ASSERT_EQUAL(memcmp(lb.msg, &msg, sizeof(msg)), 0);
+
+#if DART_BYTE_STUFFING
+    int counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    memset(counters, 0, sizeof(counters));
+    dart_set_callback(peer, counters, clbk_counter);
+
+    // Frame cut by line noise, the following one is received at once
+    for (size_t i=frame_start; i<wire_len - 2; i++)
+        dart_handle_received_char(peer, wire[i]);
+    for (size_t i=frame_start; i<wire_len; i++)
+        dart_handle_received_char(peer, wire[i]);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_CORRUPTED], 1);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 1);
+
+    // Corrupted length does not swallow the following frame
+    uint8_t broken[32];
+    memcpy(broken, &wire[frame_start], wire_len - frame_start);
+    broken[1] = 0x30;
+    dart_handle_received_buffer(peer, broken, wire_len - frame_start);
+    dart_handle_received_buffer(peer, &wire[frame_start], wire_len - frame_start);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_TRANSFER_CORRUPTED], 2);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 2);
+    CU_ASSERT_FALSE(dart_is_receiving(peer));
+#endif
+
+    dart_clean(peer);
+    dart_clean(drt);
+}
+
+
+#if DART_BYTE_STUFFING
+static bool is_reserved_sync(uint8_t ch)
+{
+    return ch == DART_SYNC || ch == DART_SYNC_SEQ || ch == DART_SYNC_AGG || ch == DART_SYNC_LZ;
+}
+
+/**
+ * Escaped bytes do not depend on windowing and compression options
+ *
+ * Wire image of this build is checked against the fixed set, which every other build
+ * escapes as well, and is altered as if sent by a build escaping less.
+ */
+void test_stuffing_across_builds(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    static uint8_t peer_rx_buffer[DART_RX_BUFFER_LEN];
+    static uint8_t peer_memory_pool[DART_MEMORY_POOL_SIZE];
+    struct dart _peer;
+    struct dart *peer = &_peer;
+    dart_init(peer, peer_memory_pool, sizeof(peer_memory_pool), peer_rx_buffer, sizeof(peer_rx_buffer));
+
+    int counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    memset(counters, 0, sizeof(counters));
+    dart_set_callback(peer, counters, clbk_counter);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    const uint8_t msg[] = { 0x21, DART_SYNC, DART_SYNC_SEQ, DART_SYNC_AGG, DART_SYNC_LZ, DART_ESC };
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)msg, sizeof(msg)), DART_SUCCESS);
+    dart_handle_received_char(drt, DART_ACK);
+
+    uint8_t wire[32];
+    size_t wire_len = 0;
+    size_t start = 0;
+    while (start < uart_tx_bytes && uart_tx_buffer[start] != DART_SYNC)
+        start++;    // Skip offers
+    for (size_t i=start; i<uart_tx_bytes; i++)
+        wire[wire_len++] = uart_tx_buffer[i];
+
+    // Whole set is escaped whatever this build supports
+    size_t escaped = 0;
+    for (size_t i=1; i<wire_len; i++) {
+        CU_ASSERT_FALSE(is_reserved_sync(wire[i]));
+        if (wire[i] == DART_ESC)
+            escaped++;
+    }
+    CU_ASSERT(escaped >= 5);
+
+    dart_handle_received_buffer(peer, wire, wire_len);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 1);
+
+    // Bare sequenced sync within frame breaks it in every build, the next frame is received
+    uint8_t bare[32];
+    size_t bare_len = 0;
+    for (size_t i=0; i<wire_len; i++) {
+        if (wire[i] == DART_ESC && (wire[i + 1] ^ 0x20) == DART_SYNC_SEQ)
+            bare[bare_len++] = wire[++i] ^ 0x20;
+        else
+            bare[bare_len++] = wire[i];
+    }
+    dart_handle_received_buffer(peer, bare, bare_len);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 1);
+    dart_handle_received_buffer(peer, wire, wire_len);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 2);
+
+    dart_clean(peer);
+    dart_clean(drt);
+}
+#endif
+
+
+#if DART_STATS
+void test_link_statistics(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    struct dart_stats stats;
+    dart_get_stats(drt, &stats);
+    CU_ASSERT_EQUAL(stats.tx_frames, 0);
+    CU_ASSERT_EQUAL(stats.rx_frames, 0);
+
+    // Opponent is woken up, frame is acknowledged after 5 ms
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, false);
+    struct msg_p1 msg = { .type = MSG_REPORT | 0x11, .param1 = 0x01 };
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    clock_update(5, 0);
+    dart_handle_received_char(drt, DART_ACK);
+
+    dart_get_stats(drt, &stats);
+    CU_ASSERT_EQUAL(stats.wakeup_attempts, 1);
+    CU_ASSERT_EQUAL(stats.tx_frames, 1);
+    CU_ASSERT_EQUAL(stats.tx_bytes, DART_PLAIN_FRAME_LEN(sizeof(msg)));
+    CU_ASSERT_EQUAL(stats.ack_latency[3], 1);     // 4-7 ms
+
+    // Bad crc reported by the opponent, then acknowledge timeouts
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    dart_handle_received_char(drt, DART_BAD);
+    clock_update(10000, 0);
+    dart_handle_time(drt);
+    clock_update(10000, 0);
+    dart_handle_time(drt);
+
+    dart_get_stats(drt, &stats);
+    CU_ASSERT_EQUAL(stats.tx_frames, 4);
+    CU_ASSERT_EQUAL(stats.tx_retries, 2);
+    CU_ASSERT_EQUAL(stats.ack_timeouts, 2);
+    CU_ASSERT_EQUAL(stats.tx_failures, 1);
+
+    // Valid, corrupted and incomplete frames
+    uint8_t msg_corrupted[sizeof(msg_valid)];
+    memcpy(msg_corrupted, msg_valid, sizeof(msg_valid));
+    msg_corrupted[sizeof(msg_corrupted) - 1] ^= 0x01;
+    sim_receive_data(drt, msg_valid, sizeof(msg_valid));
+    sim_receive_data(drt, msg_corrupted, sizeof(msg_corrupted));
+    sim_receive_data(drt, msg_valid, 2);
+    clock_update(100, 0);
+    sim_receive_data(drt, msg_valid, sizeof(msg_valid));
+
+    dart_get_stats(drt, &stats);
+    CU_ASSERT_EQUAL(stats.rx_frames, 2);
+    CU_ASSERT_EQUAL(stats.rx_bytes, 2 * sizeof(msg_valid));
+    CU_ASSERT_EQUAL(stats.rx_crc_errors, 1);
+    CU_ASSERT_EQUAL(stats.rx_timeouts, 1);
+
+    // Response after 300 ms, then abandoned request
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REQUEST | 0x11), DART_SUCCESS);
+    dart_handle_received_char(drt, DART_ACK);
+    clock_update(300, 0);
+    sim_receive_data(drt, msg_response_11, sizeof(msg_response_11));
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REQUEST | 0x11), DART_SUCCESS);
+    dart_handle_received_char(drt, DART_ACK);
+    clock_update(10000, 0);
+    dart_handle_time(drt);
+
+    dart_get_stats(drt, &stats);
+    CU_ASSERT_EQUAL(stats.response_latency[9], 1);    // 256-511 ms
+    CU_ASSERT_EQUAL(stats.requests_abandoned, 1);
+
+    // Statistics survive reset until cleared
+    dart_reset(drt);
+    dart_get_stats(drt, &stats);
+    CU_ASSERT_EQUAL(stats.tx_frames, 6);
+    dart_reset_stats(drt);
+    dart_get_stats(drt, &stats);
+    CU_ASSERT_EQUAL(stats.tx_frames, 0);
+    CU_ASSERT_EQUAL(stats.ack_latency[3], 0);
+
+    dart_clean(drt);
+}
+#endif
+
+
+#if DART_HANDLERS
+static struct msg_p1 handler_proc_msg;
+
+PROCESS_NAME(handler_proc);
+PROCESS(handler_proc, "DART handler");
+PROCESS_THREAD(handler_proc, ev, msg)
+{
+    PROCESS_BEGIN();
+
+    while (1) {
+        if (ev == PROCESS_EV_EXIT)
+            break;
+        if (ev != PROCESS_EV_INIT)
+            memcpy(&handler_proc_msg, msg, sizeof(handler_proc_msg));
+        PROCESS_YIELD();
+    }
+
+    PROCESS_END();
+    return PT_ENDED;
+}
+
+
+struct handler_counter
+{
+    int calls;
+    size_t msg_len;
+    msgtype_t type;
+};
+
+void handler_count(struct msg *msg, size_t msg_len, void *private)
+{
+    struct handler_counter *counter = (struct handler_counter*)private;
+    counter->calls++;
+    counter->msg_len = msg_len;
+    counter->type = msg->type;
+}
+
+static void handler_transfer(struct dart *drt, struct dart *peer, msgtype_t type)
+{
+    struct msg_p1 msg = { .type = type, .param1 = 0x5A };
+    uart_tx_bytes = 0;
+    dart_send_msg(drt, (struct msg*)&msg, sizeof(msg));
+    dart_handle_received_buffer(peer, uart_tx_buffer, uart_tx_bytes);
+    dart_handle_received_char(drt, DART_ACK);
+}
+
+void test_handler_registry(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    static uint8_t peer_rx_buffer[DART_RX_BUFFER_LEN];
+    static uint8_t peer_memory_pool[DART_MEMORY_POOL_SIZE];
+    struct dart _peer;
+    struct dart *peer = &_peer;
+    dart_init(peer, peer_memory_pool, sizeof(peer_memory_pool), peer_rx_buffer, sizeof(peer_rx_buffer));
+
+    int counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    memset(counters, 0, sizeof(counters));
+    dart_set_callback(peer, counters, clbk_counter);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    uint32_t process_buffer[256];
+    process_init(process_buffer, sizeof(process_buffer));
+    process_start(&handler_proc);
+    process_run();
+
+    // Invalid and overlapping registrations
+    struct handler_counter range = { 0 }, notify = { 0 };
+    CU_ASSERT_EQUAL(dart_register_handler(peer, 0x20, 0x2F, DART_HANDLER_VIEW, &range, handler_count), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_register_handler(peer, 0x2F, 0x30, DART_HANDLER_VIEW, &range, handler_count), DART_ERR_NOT_POSSIBLE);
+    CU_ASSERT_EQUAL(dart_register_handler(peer, 0x18, 0x20, DART_HANDLER_VIEW, &range, handler_count), DART_ERR_NOT_POSSIBLE);
+    CU_ASSERT_EQUAL(dart_register_handler(peer, 0x35, 0x34, DART_HANDLER_VIEW, &range, handler_count), DART_ERR_NOT_POSSIBLE);
+    CU_ASSERT_EQUAL(dart_register_handler(peer, 0x34, 0x34, DART_HANDLER_VIEW, &range, NULL), DART_ERR_NOT_POSSIBLE);
+    CU_ASSERT_EQUAL(dart_register_handler(peer, 0x34, 0x34, DART_HANDLER_POST, NULL, NULL), DART_ERR_NOT_POSSIBLE);
+
+    CU_ASSERT_EQUAL(dart_register_handler(peer, 0x30, 0x30, DART_HANDLER_POST, &handler_proc, NULL), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_register_handler(peer, 0x31, 0x31, DART_HANDLER_NOTIFY, &notify, handler_count), DART_SUCCESS);
+
+    // Registrations are limited
+    int ret = DART_SUCCESS;
+    for (msgtype_t type=0x01; ret == DART_SUCCESS; type++)
+        ret = dart_register_handler(peer, type, type, DART_HANDLER_VIEW, &range, handler_count);
+    CU_ASSERT_EQUAL(ret, DART_ERR_NO_MEMORY);
+    for (msgtype_t type=0x01; type<0x20; type++)
+        dart_unregister_handler(peer, type);
+
+    // Handler replaces the callback
+    handler_transfer(drt, peer, 0x2A);
+    CU_ASSERT_EQUAL(range.calls, 1);
+    CU_ASSERT_EQUAL(range.type, 0x2A);
+    CU_ASSERT_EQUAL(range.msg_len, sizeof(struct msg_p1));
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 0);
+
+    // Notifying handler
+    handler_transfer(drt, peer, 0x31);
+    CU_ASSERT_EQUAL(notify.calls, 1);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 1);
+
+    // Message copy is posted to process
+    handler_transfer(drt, peer, 0x30);
+    CU_ASSERT_EQUAL(process_events(), 1);
+    process_run();
+    CU_ASSERT_EQUAL(handler_proc_msg.type, 0x30);
+    CU_ASSERT_EQUAL(handler_proc_msg.param1, 0x5A);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 1);
+
+    // Unregistered types go to the callback
+    handler_transfer(drt, peer, 0x40);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 2);
+    CU_ASSERT_EQUAL(dart_unregister_handler(peer, 0x20), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_unregister_handler(peer, 0x20), DART_ERR_MSG_NOT_FOUND);
+    handler_transfer(drt, peer, 0x2A);
+    CU_ASSERT_EQUAL(range.calls, 1);
+    CU_ASSERT_EQUAL(counters[DART_CLBK_MESSAGE_RECEIVED], 3);
+
+    // Remaining registrations are still found
+    handler_transfer(drt, peer, 0x31);
+    CU_ASSERT_EQUAL(notify.calls, 2);
+
+    process_exit(&handler_proc);
+    process_run();
+    dart_clean(peer);
+    dart_clean(drt);
+}
+#endif
+
+
+#if DART_COMPRESSION
+struct compression_msg
+{
+    msgtype_t type;
+    uint8_t data[40];
+}
+__attribute__((packed));
+
+void test_payload_compression(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    struct dart_validator dv;
+    dart_validator_init(&dv);
+    dart_set_callback(drt, &dv, clbk_validator);
+
+    static uint8_t lz_buffer[2 * DART_RX_BUFFER_LEN];
+    dart_set_compression(drt, 16, lz_buffer, sizeof(lz_buffer));
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    struct compression_msg msg;
+    msg.type = MSG_REPORT | 0x21;
+    for (size_t i=0; i<sizeof(msg.data); i++)
+        msg.data[i] = (uint8_t)("telemetry "[i % 10]);
+
+    // Compression is offered, the first frame is plain until the opponent agrees
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_LZ | 2);        // 128 bytes for decompressed message
+    CU_ASSERT_EQUAL(uart_tx_buffer[uart_tx_bytes - DART_PLAIN_FRAME_LEN(sizeof(msg))], DART_SYNC);
+
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_LZ | 1);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 0);      // Offered already
+    dart_handle_received_char(drt, DART_ACK);
+
+    // Frame carries compressed message
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_SYNC_LZ);
+    CU_ASSERT_TRUE(uart_tx_bytes + 20 < DART_PLAIN_FRAME_LEN(sizeof(msg)));
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_COMPLETE);
+#if DART_STATS
+    CU_ASSERT_EQUAL(drt->stats.tx_compressed, 1);
+    CU_ASSERT_EQUAL(drt->stats.tx_compress_saved, DART_PLAIN_FRAME_LEN(sizeof(msg)) - uart_tx_bytes);
+#endif
+
+    // Received compressed frame is delivered decompressed
+    uint8_t frame[64];
+    size_t frame_len = uart_tx_bytes;
+    memcpy(frame, uart_tx_buffer, frame_len);
+    uart_tx_bytes = 0;
+    dart_handle_received_buffer(drt, frame, frame_len);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_MESSAGE_RECEIVED);
+    CU_ASSERT_EQUAL(dv.msg_type, msg.type);
+    CU_ASSERT_EQUAL(dv.msg_length, sizeof(msg));
+    CU_ASSERT_EQUAL(memcmp(lz_buffer + DART_RX_BUFFER_LEN, &msg, sizeof(msg)), 0);
+
+    // Short and incompressible messages are sent plain
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x22), DART_SUCCESS);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_SYNC);
+    dart_handle_received_char(drt, DART_ACK);
+
+    for (size_t i=0; i<sizeof(msg.data); i++)
+        msg.data[i] = (uint8_t)(i * 37 + 11);
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_SYNC);
+    CU_ASSERT_TRUE(uart_tx_bytes >= DART_PLAIN_FRAME_LEN(sizeof(msg)));     // Stuffing may add bytes
+    dart_handle_received_char(drt, DART_ACK);
+
+    // Compressed frames are rejected when compression was not offered
+    dart_set_compression(drt, 0, NULL, 0);
+    uart_tx_bytes = 0;
+    dart_handle_received_buffer(drt, frame, frame_len);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_BAD);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_CORRUPTED);
+
+    // Offer is answered once per connection
+    dart_set_compression(drt, 16, lz_buffer, sizeof(lz_buffer));
+    dart_reset(drt);
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_LZ);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 1);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_LZ | 2);
+    dart_handle_received_char(drt, DART_LZ);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 1);
+
+    // Opponent decompressing at most 32 bytes gets longer messages plain
+    for (size_t i=0; i<sizeof(msg.data); i++)
+        msg.data[i] = (uint8_t)("telemetry "[i % 10]);
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msg(drt, (struct msg*)&msg, sizeof(msg)), DART_SUCCESS);
+    CU_ASSERT_EQUAL(uart_tx_buffer[uart_tx_bytes - DART_PLAIN_FRAME_LEN(sizeof(msg))], DART_SYNC);
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_COMPLETE);
+
+    // Buffer too short for the smallest size class is not offered
+    dart_set_compression(drt, 16, lz_buffer, 2 * 31);
+    dart_reset(drt);
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x22), DART_SUCCESS);
+    CU_ASSERT_EQUAL(uart_tx_buffer[uart_tx_bytes - DART_PLAIN_FRAME_LEN(sizeof(msgtype_t))], DART_SYNC);
+    CU_ASSERT_NOT_EQUAL(uart_tx_buffer[0], DART_LZ);
+    dart_handle_received_char(drt, DART_ACK);
+
+    dart_clean(drt);
+}
+#endif
+
+
+
+void test_request_aging(void)
+{
+    int ret;
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    struct dart_validator dv;
+    dart_validator_init(&dv);
+    dart_set_callback(drt, &dv, clbk_validator);
+    dart_set_max_delay(drt, DART_MSG_PRIO_REQUEST, 100);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    ret = dart_send_msgtype(drt, MSG_REPORT | 0x11);
+    CU_ASSERT_EQUAL(ret, DART_SUCCESS);
+    ret = dart_send_msgtype(drt, MSG_REQUEST | 0x12);
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+    ret = dart_send_msgtype(drt, MSG_REPORT | 0x13);
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+
+    msgtype_t current_msgtype;
+
+    // Reports have higher priority
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_TRUE(dart_get_current_msgtype(drt, &current_msgtype));
+    CU_ASSERT_EQUAL(current_msgtype, MSG_REPORT | 0x13);
+    ret = dart_send_msgtype(drt, MSG_REPORT | 0x14);
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+
+    // Request waits too long, it is served before next report
+    clock_update(150, 0);
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_TRUE(dart_get_current_msgtype(drt, &current_msgtype));
+    CU_ASSERT_EQUAL(current_msgtype, MSG_REQUEST | 0x12);
+    CU_ASSERT_TRUE(dart_get_worst_delay(drt, DART_MSG_PRIO_REQUEST) >= 150);
+
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_TRUE(dart_get_current_msgtype(drt, &current_msgtype));
+    CU_ASSERT_EQUAL(current_msgtype, MSG_REPORT | 0x14);
+    dart_handle_received_char(drt, DART_ACK);
+
+    sim_receive_data(drt, msg_response_12, sizeof(msg_response_12));
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_COMPLETE);
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    dart_clean(drt);
+}
+
+
+void test_msg_deadline(void)
+{
+    int ret;
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    struct dart_validator dv;
+    dart_validator_init(&dv);
+    dart_set_callback(drt, &dv, clbk_validator);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    struct msg msg;
+    msgtype_t current_msgtype;
+    uint32_t now = clock_get_milis();
+
+    msg.type = MSG_REPORT | 0x11;
+    ret = dart_send_msg_deadline(drt, DART_MSG_PRIO_REPORT, &msg, sizeof(msg), now + 1000);
+    CU_ASSERT_EQUAL(ret, DART_SUCCESS);
+    msg.type = MSG_REPORT | 0x12;
+    ret = dart_send_msg_deadline(drt, DART_MSG_PRIO_REPORT, &msg, sizeof(msg), now + 100);
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+    msg.type = MSG_REPORT | 0x13;
+    ret = dart_send_msg_ex(drt, DART_MSG_PRIO_REPORT, &msg, sizeof(msg));
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+
+    // Second message is stale when first one is confirmed
+    clock_update(200, 0);
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_MESSAGE_EXPIRED);
+    CU_ASSERT_EQUAL(dv.msg_type, MSG_REPORT | 0x12);
+    CU_ASSERT_TRUE(dart_get_current_msgtype(drt, &current_msgtype));
+    CU_ASSERT_EQUAL(current_msgtype, MSG_REPORT | 0x13);
+    CU_ASSERT_FALSE(dart_is_msg_pending(drt, DART_MSG_PRIO_ANY, MSG_REPORT | 0x12));
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_COMPLETE);
+
+    // Message is not retried after its deadline
+    msg.type = MSG_REPORT | 0x14;
+    ret = dart_send_msg_deadline(drt, DART_MSG_PRIO_REPORT, &msg, sizeof(msg), clock_get_milis() + 100);
+    CU_ASSERT_EQUAL(ret, DART_SUCCESS);
+    clock_update(dart_get_ack_timeout(drt), 0);     // Round trip of the previous frames was 200ms
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_COMPLETE);
+    CU_ASSERT_EQUAL(dv.msg_type, MSG_REPORT | 0x14);
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    // Zero is deadline like any other timestamp
+    msg.type = MSG_REPORT | 0x15;
+    CU_ASSERT_EQUAL(dart_send_msgtype_ex(drt, DART_MSG_PRIO_REPORT, MSG_REPORT | 0x16), DART_SUCCESS);
+    ret = dart_send_msg_deadline(drt, DART_MSG_PRIO_REPORT, &msg, sizeof(msg), 0);
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+    CU_ASSERT_EQUAL(dart_send_msgtype_ex(drt, DART_MSG_PRIO_REPORT, MSG_REPORT | 0x17), DART_PENDING);
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_MESSAGE_EXPIRED);
+    CU_ASSERT_EQUAL(dv.msg_type, MSG_REPORT | 0x15);
+    CU_ASSERT_TRUE(dart_get_current_msgtype(drt, &current_msgtype));
+    CU_ASSERT_EQUAL(current_msgtype, MSG_REPORT | 0x17);
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    // Earliest deadline goes first, message being transferred keeps its place
+    dart_set_edf(drt, DART_MSG_PRIO_REPORT, true);
+    now = clock_get_milis();
+    CU_ASSERT_EQUAL(dart_send_msgtype_ex(drt, DART_MSG_PRIO_REPORT, MSG_REPORT | 0x18), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_send_msgtype_ex(drt, DART_MSG_PRIO_REPORT, MSG_REPORT | 0x19), DART_PENDING);
+    msg.type = MSG_REPORT | 0x1A;
+    ret = dart_send_msg_deadline(drt, DART_MSG_PRIO_REPORT, &msg, sizeof(msg), now + 500);
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+    msg.type = MSG_REPORT | 0x1B;
+    ret = dart_send_msg_deadline(drt, DART_MSG_PRIO_REPORT, &msg, sizeof(msg), now + 100);
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+
+    msgtype_t expected[] = {MSG_REPORT | 0x18, MSG_REPORT | 0x1B, MSG_REPORT | 0x1A, MSG_REPORT | 0x19};
+    for (unsigned int i=0; i<ARRAY_SIZE(expected); i++) {
+        CU_ASSERT_TRUE(dart_get_current_msgtype(drt, &current_msgtype));
+        CU_ASSERT_EQUAL(current_msgtype, expected[i]);
+        dart_handle_received_char(drt, DART_ACK);
+    }
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    dart_clean(drt);
+}
+
+
+void test_forward_msg(void)
+{
+    int ret;
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    struct dart_validator dv;
+    dart_validator_init(&dv);
+    dart_set_callback(drt, &dv, clbk_validator);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Message allocated outside of the module
+    uint8_t foreign_pool[128];
+    struct cba foreign_cba;
+    cba_init(&foreign_cba, foreign_pool, sizeof(foreign_pool));
+
+    struct msg_ptr *msg_ptr = msg_ptr_malloc(&foreign_cba, sizeof(struct msg_p2));
+    struct msg_p2 *msg = (struct msg_p2*)&msg_ptr->msg;
+    msg->type = MSG_REPORT | 0x11;
+    msg->param1 = 0x01;
+    msg->param2 = 0x02;
+
+    // Keep own reference
+    msg_ptr_retain(msg_ptr);
+    ret = dart_forward_msg(drt, DART_MSG_PRIO_ANY, (struct msg*)msg);
+    CU_ASSERT_EQUAL(ret, DART_SUCCESS);
+    CU_ASSERT_EQUAL(drt->cba.free_idx, 0);
+
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_COMPLETE);
+    CU_ASSERT_EQUAL(dv.msg_type, MSG_REPORT | 0x11);
+    CU_ASSERT_EQUAL(dv.msg_length, sizeof(struct msg_p2));
+    CU_ASSERT_EQUAL(msg_ptr->refs, 1);
+
+    // Forwarded message is released on reset
+    ret = dart_forward_msg(drt, DART_MSG_PRIO_REPORT, (struct msg*)msg);
+    CU_ASSERT_EQUAL(ret, DART_SUCCESS);
+    dart_reset(drt);
+    CU_ASSERT_EQUAL(foreign_cba.free_idx, 0);
+
+    dart_clean(drt);
+}
+
+
+static msgtype_t uart_tx_msgtype(void)
+{
+    msgtype_t type;
+    memcpy(&type, &uart_tx_buffer[1 + DART_LEN_SIZE], sizeof(type));
+    return type;
+}
+
+void test_preemption_and_cancel(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+    dart_set_preemption(drt, DART_MSG_PRIO_RESPONSE);
+
+    struct dart_validator dv;
+    dart_validator_init(&dv);
+    dart_set_callback(drt, &dv, clbk_validator);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Obsolete messages are removed, the one being transferred is not
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x21), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x22), DART_PENDING);
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x23), DART_PENDING);
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x22), DART_PENDING);
+    CU_ASSERT_EQUAL(dart_cancel_msgtype(drt, DART_MSG_PRIO_ANY, MSG_REPORT | 0x22), 2);
+    CU_ASSERT_EQUAL(dart_cancel_msgtype(drt, DART_MSG_PRIO_RESPONSE, MSG_REPORT | 0x23), 0);
+    CU_ASSERT_EQUAL(dart_cancel_msgtype(drt, DART_MSG_PRIO_ANY, MSG_REPORT | 0x21), 0);
+    CU_ASSERT_FALSE(dart_is_msg_pending(drt, DART_MSG_PRIO_ANY, MSG_REPORT | 0x22));
+
+    // Urgent message does not interrupt the first attempt
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_RESPONSE | 0x01), DART_PENDING);
+
+    // But it jumps ahead of retransmission
+    uart_tx_bytes = 0;
+    clock_update(dart_get_ack_timeout(drt) + 1, 0);
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(uart_tx_msgtype(), MSG_RESPONSE | 0x01);
+
+    // Preempted message is retried with attempts it already took
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_DONE);
+    CU_ASSERT_EQUAL(dv.msg_type, MSG_RESPONSE | 0x01);
+    CU_ASSERT_EQUAL(uart_tx_msgtype(), MSG_REPORT | 0x21);
+    clock_update(dart_get_ack_timeout(drt) + 1, 0);
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_DONE);
+    clock_update(dart_get_ack_timeout(drt) + 1, 0);
+    dart_handle_time(drt);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_FAILURE);
+    CU_ASSERT_EQUAL(dv.msg_type, MSG_REPORT | 0x21);
+
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_COMPLETE);
+#if DART_STATS
+    CU_ASSERT_EQUAL(drt->stats.tx_preemptions, 1);
+    CU_ASSERT_EQUAL(drt->stats.tx_cancelled, 2);
+#endif
+
+    // Forwarded message is cancelled by its handle
+    uint8_t foreign_pool[128];
+    struct cba foreign_cba;
+    cba_init(&foreign_cba, foreign_pool, sizeof(foreign_pool));
+
+    struct msg_ptr *msg_ptr = msg_ptr_malloc(&foreign_cba, sizeof(struct msg));
+    msg_ptr->msg.type = MSG_REPORT | 0x24;
+    msg_ptr_retain(msg_ptr);
+
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, MSG_REPORT | 0x25), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_forward_msg(drt, DART_MSG_PRIO_ANY, &msg_ptr->msg), DART_PENDING);
+    CU_ASSERT_EQUAL(dart_cancel_msg(drt, &msg_ptr->msg), DART_SUCCESS);
+    CU_ASSERT_EQUAL(msg_ptr->refs, 1);
+    CU_ASSERT_EQUAL(dart_cancel_msg(drt, &msg_ptr->msg), DART_ERR_NOT_POSSIBLE);
+    msg_ptr_free(&foreign_cba, msg_ptr);
+    CU_ASSERT_EQUAL(foreign_cba.free_idx, 0);
+
+    dart_handle_received_char(drt, DART_ACK);
+    dart_handle_received_char(drt, DART_DONE);
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    dart_clean(drt);
+}
+
+
+
+#if DART_WINDOW_SIZE > 1
+void test_window_negotiation(void)
+{
+    int ret;
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    struct dart_validator dv;
+    dart_validator_init(&dv);
+    dart_set_callback(drt, &dv, clbk_validator);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Window is offered before the first legacy frame
+    uart_tx_bytes = 0;
+    ret = dart_send_msgtype(drt, 0x11);
+    CU_ASSERT_EQUAL(ret, DART_SUCCESS);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_HELLO | DART_WINDOW_SIZE);
+    CU_ASSERT_EQUAL(uart_tx_buffer[1], DART_SYNC);
+    CU_ASSERT_EQUAL(dart_get_window(drt), 1);
+
+    ret = dart_send_msgtype(drt, 0x12);
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+    ret = dart_send_msgtype(drt, 0x13);
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+    ret = dart_send_msgtype(drt, 0x14);
+    CU_ASSERT_EQUAL(ret, DART_PENDING);
+
+    // Opponent supports windowed mode, but smaller one
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_HELLO | 2);
+    CU_ASSERT_EQUAL(dart_get_window(drt), 2);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 0);
+
+    // Legacy frame is confirmed, following ones are pipelined
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_DONE);
+    CU_ASSERT_EQUAL(dv.msg_type, 0x11);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 2 * DART_FRAME_LEN(sizeof(struct msg)));
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_SYNC_SEQ);
+    CU_ASSERT_EQUAL(uart_tx_buffer[1 + DART_LEN_SIZE], 0x40 | 0);     // Resync, seq 0
+    CU_ASSERT_EQUAL(uart_tx_buffer[DART_FRAME_LEN(sizeof(struct msg))], DART_SYNC_SEQ);
+    CU_ASSERT_EQUAL(uart_tx_buffer[DART_FRAME_LEN(sizeof(struct msg)) + 1 + DART_LEN_SIZE], 1);
+    CU_ASSERT_TRUE(dart_is_msg_pending(drt, DART_MSG_PRIO_ANY, 0x12));
+    CU_ASSERT_TRUE(dart_is_msg_pending(drt, DART_MSG_PRIO_ANY, 0x13));
+
+    // Missing second frame, first one is confirmed
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_NAK | 1);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_DONE);
+    CU_ASSERT_EQUAL(dv.msg_type, 0x12);
+    CU_ASSERT_EQUAL(uart_tx_bytes, DART_FRAME_LEN(sizeof(struct msg)));
+    CU_ASSERT_EQUAL(uart_tx_buffer[1 + DART_LEN_SIZE], 1);
+    CU_ASSERT_EQUAL(uart_tx_buffer[2 + DART_LEN_SIZE], 0x13);
+
+    // Repeated NAK does not cause another retransmission
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_NAK | 1);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 0);
+
+    // Cumulative acknowledge
+    dart_validator_init(&dv);
+    dart_handle_received_char(drt, DART_SACK | 1);
+    CU_ASSERT_EQUAL(dv.msg_type, 0x13);
+    CU_ASSERT_EQUAL(uart_tx_buffer[2 + DART_LEN_SIZE], 0x14);
+    dart_handle_received_char(drt, DART_SACK | 2);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_COMPLETE);
+    CU_ASSERT_EQUAL(dv.msg_type, 0x14);
+
+    // Stale acknowledge is ignored
+    dart_validator_init(&dv);
+    dart_handle_received_char(drt, DART_SACK | 1);
+    CU_ASSERT_EQUAL(dv.code, -1);
+    CU_ASSERT_TRUE(dart_is_idle(drt));
+
+    dart_clean(drt);
+}
+
+
+void test_window_receiving(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    struct dart_validator dv;
+    dart_validator_init(&dv);
+    dart_set_callback(drt, &dv, clbk_validator);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Opponent offers window, answer is sent once
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_HELLO | 7);
+    CU_ASSERT_EQUAL(dart_get_window(drt), DART_WINDOW_SIZE);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 1);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_HELLO | DART_WINDOW_SIZE);
+    dart_handle_received_char(drt, DART_HELLO | 7);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 1);
+
+#if (DART_LEN_SIZE == 1) && (DART_CRC_SIZE == 1)
+    uint8_t frame_seq0[] = {DART_SYNC_SEQ, 0x02, 0x40, 0x21, 0x9E};
+    uint8_t frame_seq1[] = {DART_SYNC_SEQ, 0x02, 0x01, 0x22, 0xDC};
+    uint8_t frame_seq3[] = {DART_SYNC_SEQ, 0x02, 0x03, 0x23, 0xDF};
+
+    // In order frames
+    uart_tx_bytes = 0;
+    sim_receive_data(drt, frame_seq0, sizeof(frame_seq0));
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_MESSAGE_RECEIVED);
+    CU_ASSERT_EQUAL(dv.msg_type, 0x21);
+    CU_ASSERT_EQUAL(dv.msg_length, 1);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_SACK | 0);
+
+    sim_receive_data(drt, frame_seq1, sizeof(frame_seq1));
+    CU_ASSERT_EQUAL(dv.msg_type, 0x22);
+    CU_ASSERT_EQUAL(uart_tx_buffer[1], DART_SACK | 1);
+
+    // Retransmitted resync frame is acknowledged again, but not delivered
+    dart_validator_init(&dv);
+    sim_receive_data(drt, frame_seq0, sizeof(frame_seq0));
+    CU_ASSERT_EQUAL(dv.code, -1);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 3);
+    CU_ASSERT_EQUAL(uart_tx_buffer[2], DART_SACK | 0);
+
+    // Missing frame, rejected once
+    sim_receive_data(drt, frame_seq3, sizeof(frame_seq3));
+    sim_receive_data(drt, frame_seq3, sizeof(frame_seq3));
+    CU_ASSERT_EQUAL(dv.code, -1);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 4);
+    CU_ASSERT_EQUAL(uart_tx_buffer[3], DART_NAK | 2);
+
+    // Corrupted frame
+    frame_seq3[3] = 0x24;
+    frame_seq3[2] = 0x40 | 0x03;
+    sim_receive_data(drt, frame_seq3, sizeof(frame_seq3));
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_CORRUPTED);
+#endif
+
+    dart_clean(drt);
+}
+
+
+/**
+ * Sequenced frames are rejected with DART_NAK, DART_BAD answers false sync
+ *
+ */
+void test_window_bad_report(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    struct dart_validator dv;
+    dart_validator_init(&dv);
+    dart_set_callback(drt, &dv, clbk_validator);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Legacy frame is retransmitted
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, 0x11), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, 0x12), DART_PENDING);
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, 0x13), DART_PENDING);
+    dart_handle_received_char(drt, DART_HELLO | DART_WINDOW_SIZE);
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_BAD);
+    CU_ASSERT_EQUAL(uart_tx_bytes, DART_PLAIN_FRAME_LEN(sizeof(struct msg)));
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_SYNC);
+
+    // Frames in flight are not
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 2 * DART_FRAME_LEN(sizeof(struct msg)));
+    uart_tx_bytes = 0;
+    dart_handle_received_char(drt, DART_BAD);
+    dart_handle_received_char(drt, DART_BAD);
+    dart_handle_received_char(drt, DART_BAD);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 0);
+    CU_ASSERT_NOT_EQUAL(dv.code, DART_CLBK_TRANSFER_FAILURE);
+
+    dart_handle_received_char(drt, DART_SACK | 1);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_COMPLETE);
+    CU_ASSERT_EQUAL(dv.msg_type, 0x13);
+
+    dart_clean(drt);
+}
+
+#else
+
+void test_window_negotiation(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    struct dart_validator dv;
+    dart_validator_init(&dv);
+    dart_set_callback(drt, &dv, clbk_validator);
+
+    dart_pin_set_state(DART_RDY_PIN, true);
+    dart_pin_set_state(DART_WRK_PIN, true);
+
+    // Legacy module does not offer window and ignores the offer
+    uart_tx_bytes = 0;
+    CU_ASSERT_EQUAL(dart_send_msgtype(drt, 0x11), DART_SUCCESS);
+    CU_ASSERT_EQUAL(uart_tx_buffer[0], DART_SYNC);
+    dart_handle_received_char(drt, DART_HELLO | 4);
+    CU_ASSERT_EQUAL(dart_get_window(drt), 1);
+
+    dart_handle_received_char(drt, DART_ACK);
+    CU_ASSERT_EQUAL(dv.code, DART_CLBK_TRANSFER_COMPLETE);
+
+    dart_clean(drt);
+}
+
+
+void test_window_receiving(void)
+{
+    struct dart _drt;
+    struct dart *drt = &_drt;
+    dart_init(drt, dart_memory_pool, sizeof(dart_memory_pool), dart_rx_buffer, sizeof(dart_rx_buffer));
+
+    struct dart_validator dv;
+    dart_validator_init(&dv);
+    dart_set_callback(drt, &dv, clbk_validator);
+
+    // Legacy module does not recognize sequenced frames
+    uint8_t frame_seq0[] = {DART_SYNC_SEQ, 0x02, 0x40, 0x21, 0x9E};
+    uart_tx_bytes = 0;
+    sim_receive_data(drt, frame_seq0, sizeof(frame_seq0));
+    CU_ASSERT_EQUAL(dv.code, -1);
+    CU_ASSERT_EQUAL(uart_tx_bytes, 0);
+
+    dart_clean(drt);
+}
+#endif
@@ -0,0 +1,444 @@
+#include <CUnit/Basic.h>
+
+#include "mx/core/dart.h"
+#include "mx/timer.h"
+#include "mx/misc.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void test_bench_clean_link(void);
+static void test_bench_aggregation(void);
+static void test_bench_slow_link(void);
+static void test_bench_noisy_link(void);
+#if DART_COMPRESSION
+static void test_bench_compression(void);
+#endif
+
+
+CU_ErrorCode cu_test_dart_bench()
+{
+    // Test logging to terminal
+    CU_pSuite suite = CU_add_suite("Test DART benchmark", NULL, NULL);
+    if ( !suite ) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_add_test(suite, "Test bench clean link",             test_bench_clean_link);
+    CU_add_test(suite, "Test bench aggregation",            test_bench_aggregation);
+    CU_add_test(suite, "Test bench slow link",              test_bench_slow_link);
+    CU_add_test(suite, "Test bench noisy link",             test_bench_noisy_link);
+#if DART_COMPRESSION
+    CU_add_test(suite, "Test bench compression",            test_bench_compression);
+#endif
+
+    return CU_get_error();
+}
+
+
+
+
+/**
+ * Simulated link
+ *
+ * Every direction is a serial line of given baudrate (10 bits per byte), bytes arrive after
+ * their transmission time plus latency and per-write jitter. Bits are flipped with given bit
+ * error rate, whole writes (frame or control byte) are lost with given drop rate. Pins are
+ * wired crosswise, WRK of one side is RDY of the other one. Time is virtual, it is advanced
+ * with clock_update() in 1 ms steps, so results do not depend on the host.
+ */
+
+#define BENCH_RX_BUFFER_LEN             300
+#define BENCH_MEMORY_POOL_SIZE          4096
+#define BENCH_LINE_LEN                  8192
+#define BENCH_MAX_MSGS                  1000
+#define BENCH_TIME_LIMIT_MS             120000
+#define BENCH_MSG_TYPE                  0x21
+
+
+struct bench_params
+{
+    const char *name;
+    uint32_t baudrate;
+    uint32_t latency_us;
+    uint32_t jitter_us;
+    double ber;                         ///< Bit error rate
+    double drop_rate;                   ///< Write loss probability
+
+    int msgs;
+    int msg_len;                        ///< Including message type, at least 8 bytes
+    int queue_depth;                    ///< Messages kept in sender queue
+    dart_len_t aggr_max_len;            ///< Aggregation, 0 disables
+    dart_len_t lz_threshold;            ///< Compression, 0 disables
+};
+
+
+struct bench_byte
+{
+    uint64_t at;                        ///< Arrival time in microseconds
+    uint8_t value;
+};
+
+
+struct bench_line
+{
+    struct bench_byte bytes[BENCH_LINE_LEN];
+    size_t head;
+    size_t tail;
+    uint64_t free_at;                   ///< Transmitter is busy until
+    uint64_t last_at;
+    uint32_t overflows;                 ///< Bytes lost, sender outpaced the line
+};
+
+
+struct bench_side
+{
+    struct dart dart;
+    struct bench_side *peer;
+    struct bench_line line;             ///< Outgoing direction
+    const struct bench_params *params;
+    bool wrk;
+
+    uint8_t rx_buffer[BENCH_RX_BUFFER_LEN];
+    uint8_t memory_pool[BENCH_MEMORY_POOL_SIZE];
+#if DART_COMPRESSION
+    uint8_t lz_buffer[2 * BENCH_RX_BUFFER_LEN];
+#endif
+
+    int counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+};
+
+
+struct bench_result
+{
+    int sent;
+    int delivered;                      ///< Unique messages received
+    int failed;
+    uint32_t elapsed_ms;
+    uint32_t latency[BENCH_MAX_MSGS];
+    bool seen[BENCH_MAX_MSGS];
+};
+
+
+static uint64_t bench_now_us;
+static uint32_t bench_rand_state;
+static struct bench_result *bench_result;
+
+
+
+static uint32_t bench_rand(void)
+{
+    // xorshift32, deterministic across hosts
+    uint32_t x = bench_rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    bench_rand_state = x;
+    return x;
+}
+
+static bool bench_chance(double probability)
+{
+    return probability > 0 && bench_rand() < probability * 4294967295.0;
+}
+
+
+static void bench_send(uint8_t *buffer, int32_t length, void *private)
+{
+    struct bench_side *side = (struct bench_side*)private;
+    const struct bench_params *params = side->params;
+    struct bench_line *line = &side->line;
+
+    uint64_t byte_us = 10000000ULL / params->baudrate;
+    uint64_t start = (line->free_at > bench_now_us) ? line->free_at : bench_now_us;
+    line->free_at = start + byte_us * (uint64_t)length;
+
+    if (bench_chance(params->drop_rate))
+        return;
+
+    uint64_t delay = params->latency_us + (params->jitter_us ? bench_rand() % params->jitter_us : 0);
+    for (int32_t i=0; i<length; i++) {
+        uint8_t value = buffer[i];
+        if (bench_chance(params->ber * 8))
+            value ^= (uint8_t)(1 << (bench_rand() % 8));
+
+        // Line keeps order even with jitter
+        uint64_t at = start + byte_us * (uint64_t)(i + 1) + delay;
+        if (at < line->last_at)
+            at = line->last_at;
+        line->last_at = at;
+
+        if (line->tail - line->head >= BENCH_LINE_LEN) {
+            line->overflows++;
+            continue;
+        }
+        line->bytes[line->tail % BENCH_LINE_LEN].at = at;
+        line->bytes[line->tail % BENCH_LINE_LEN].value = value;
+        line->tail++;
+    }
+}
+
+static bool bench_pin_get_state(int pin_e, void *private)
+{
+    struct bench_side *side = (struct bench_side*)private;
+    return (pin_e == DART_WRK_PIN) ? side->wrk : side->peer->wrk;
+}
+
+static void bench_pin_set_state(int pin_e, bool state, void *private)
+{
+    struct bench_side *side = (struct bench_side*)private;
+    if (pin_e == DART_WRK_PIN)
+        side->wrk = state;
+}
+
+static const struct dart_ops bench_ops = {
+    .send = bench_send,
+    .sendv = NULL,
+    .pin_get_state = bench_pin_get_state,
+    .pin_set_state = bench_pin_set_state,
+    .get_milis = NULL,
+};
+
+
+static void bench_callback(int code, void *param1, void *param2, void *private)
+{
+    struct bench_side *side = (struct bench_side*)private;
+    side->counters[code]++;
+
+    if (code != DART_CLBK_MESSAGE_RECEIVED || (size_t)param2 < 1 + 2 * sizeof(uint32_t))
+        return;
+
+    // Message carries its number and send time
+    uint8_t *msg = (uint8_t*)param1;
+    uint32_t number, tstamp;
+    memcpy(&number, &msg[1], sizeof(number));
+    memcpy(&tstamp, &msg[1 + sizeof(number)], sizeof(tstamp));
+    if (number < BENCH_MAX_MSGS && !bench_result->seen[number]) {
+        bench_result->seen[number] = true;
+        bench_result->latency[bench_result->delivered++] = clock_get_milis() - tstamp;
+        bench_result->elapsed_ms = clock_get_milis();
+    }
+}
+
+
+static void bench_side_init(struct bench_side *side, struct bench_side *peer, const struct bench_params *params)
+{
+    memset(side, 0, sizeof(*side));
+    side->peer = peer;
+    side->params = params;
+
+    dart_init(&side->dart, side->memory_pool, sizeof(side->memory_pool), side->rx_buffer, sizeof(side->rx_buffer));
+    dart_set_ops(&side->dart, side, &bench_ops);
+    dart_set_callback(&side->dart, side, bench_callback);
+    dart_set_aggregation(&side->dart, params->aggr_max_len, 0);
+#if DART_COMPRESSION
+    dart_set_compression(&side->dart, params->lz_threshold, side->lz_buffer, sizeof(side->lz_buffer));
+#endif
+}
+
+
+/**
+ * Pass bytes which already arrived to the opponent
+ *
+ */
+static void bench_deliver(struct bench_side *side)
+{
+    uint8_t chunk[256];
+    struct bench_line *line = &side->line;
+
+    while (line->head != line->tail && line->bytes[line->head % BENCH_LINE_LEN].at <= bench_now_us) {
+        size_t length = 0;
+        while (length < sizeof(chunk) && line->head != line->tail && line->bytes[line->head % BENCH_LINE_LEN].at <= bench_now_us)
+            chunk[length++] = line->bytes[line->head++ % BENCH_LINE_LEN].value;
+        dart_handle_received_buffer(&side->peer->dart, chunk, length);
+    }
+}
+
+
+/**
+ * Check that no byte is on its way in either direction
+ *
+ * Sender finishes the last message once it is acknowledged, but frames retransmitted before
+ * the acknowledge arrived may still be on the line. Stopping earlier would leave them
+ * undelivered and count them as lost.
+ */
+static bool bench_link_idle(const struct bench_side *side)
+{
+    return side->line.head == side->line.tail && side->peer->line.head == side->peer->line.tail;
+}
+
+
+static void bench_fill(struct bench_side *side, struct bench_result *result)
+{
+    const struct bench_params *params = side->params;
+    uint8_t buffer[256];
+    struct msg *msg = (struct msg*)buffer;
+
+    int finished = side->counters[DART_CLBK_TRANSFER_DONE] + side->counters[DART_CLBK_TRANSFER_FAILURE];
+    while (result->sent < params->msgs && result->sent - finished < params->queue_depth) {
+        uint32_t number = (uint32_t)result->sent;
+        uint32_t tstamp = clock_get_milis();
+        memset(buffer, 0x55, sizeof(buffer));       // Sync bytes within payload
+        msg->type = BENCH_MSG_TYPE;
+        memcpy(&buffer[1], &number, sizeof(number));
+        memcpy(&buffer[1 + sizeof(number)], &tstamp, sizeof(tstamp));
+        if (dart_send_msg(&side->dart, msg, (dart_len_t)params->msg_len) < 0)
+            break;
+        result->sent++;
+    }
+}
+
+
+static int bench_compare(const void *a, const void *b)
+{
+    uint32_t va = *(const uint32_t*)a;
+    uint32_t vb = *(const uint32_t*)b;
+    return (va > vb) - (va < vb);
+}
+
+static uint32_t bench_percentile(struct bench_result *result, int percent)
+{
+    if (result->delivered == 0)
+        return 0;
+    return result->latency[(result->delivered - 1) * percent / 100];
+}
+
+
+/**
+ * Run single scenario, side A sends all messages to side B
+ *
+ */
+static void bench_run(const struct bench_params *params, struct bench_result *result)
+{
+    static struct bench_side a, b;
+
+    memset(result, 0, sizeof(*result));
+    bench_result = result;
+    bench_rand_state = 0x2545F491;
+    bench_now_us = 0;
+    bench_side_init(&a, &b, params);
+    bench_side_init(&b, &a, params);
+
+    uint32_t start = clock_get_milis();
+    for (uint32_t t=0; t<BENCH_TIME_LIMIT_MS; t++) {
+        bench_fill(&a, result);
+        bench_deliver(&a);
+        bench_deliver(&b);
+        dart_handle_time(&a.dart);
+        dart_handle_time(&b.dart);
+
+        result->failed = a.counters[DART_CLBK_TRANSFER_FAILURE];
+        if (a.counters[DART_CLBK_TRANSFER_DONE] + result->failed == params->msgs && bench_link_idle(&a))
+            break;
+
+        clock_update(1, 0);
+        bench_now_us += 1000;
+    }
+    result->elapsed_ms -= start;
+
+    // Sender must not outpace the simulated line
+    CU_ASSERT_EQUAL(a.line.overflows, 0);
+    CU_ASSERT_EQUAL(b.line.overflows, 0);
+
+    qsort(result->latency, (size_t)result->delivered, sizeof(result->latency[0]), bench_compare);
+
+    double seconds = (result->elapsed_ms ? result->elapsed_ms : 1) / 1000.0;
+    printf("\n    bench: %-10s %4d/%d msgs in %6u ms, %7.0f msg/s, %8.0f B/s goodput, latency p50/p90/p99 %u/%u/%u ms, %d failed, %d lost\n",
+           params->name, result->delivered, params->msgs, result->elapsed_ms,
+           result->delivered / seconds, result->delivered * (params->msg_len - 1) / seconds,
+           bench_percentile(result, 50), bench_percentile(result, 90), bench_percentile(result, 99),
+           result->failed, params->msgs - result->delivered - result->failed);
+
+    dart_clean(&a.dart);
+    dart_clean(&b.dart);
+}
+
+
+
+
+void test_bench_clean_link(void)
+{
+    static struct bench_result result;
+    struct bench_params params = {
+        .name = "clean", .baudrate = 115200, .latency_us = 1000, .jitter_us = 0, .ber = 0, .drop_rate = 0,
+        .msgs = 500, .msg_len = 32, .queue_depth = 8, .aggr_max_len = 0,
+    };
+
+    bench_run(&params, &result);
+    CU_ASSERT_EQUAL(result.delivered, params.msgs);
+    CU_ASSERT_EQUAL(result.failed, 0);
+
+    // Single frame takes ~3 ms on 115200 line, queued messages wait for their turn
+    CU_ASSERT(result.elapsed_ms < (uint32_t)params.msgs * 10);
+}
+
+
+void test_bench_aggregation(void)
+{
+    static struct bench_result result;
+    struct bench_params params = {
+        .name = "aggregated", .baudrate = 115200, .latency_us = 1000, .jitter_us = 0, .ber = 0, .drop_rate = 0,
+        .msgs = 500, .msg_len = 32, .queue_depth = 8, .aggr_max_len = 200,
+    };
+
+    bench_run(&params, &result);
+    CU_ASSERT_EQUAL(result.delivered, params.msgs);
+    CU_ASSERT_EQUAL(result.failed, 0);
+}
+
+
+void test_bench_slow_link(void)
+{
+    static struct bench_result result;
+    struct bench_params params = {
+        .name = "slow", .baudrate = 9600, .latency_us = 20000, .jitter_us = 10000, .ber = 0, .drop_rate = 0,
+        .msgs = 100, .msg_len = 16, .queue_depth = 4, .aggr_max_len = 0,
+    };
+
+    bench_run(&params, &result);
+    CU_ASSERT_EQUAL(result.delivered, params.msgs);
+    CU_ASSERT_EQUAL(result.failed, 0);
+}
+
+
+void test_bench_noisy_link(void)
+{
+    static struct bench_result result;
+    struct bench_params params = {
+        .name = "noisy", .baudrate = 115200, .latency_us = 1000, .jitter_us = 500, .ber = 1e-5, .drop_rate = 0.01,
+        .msgs = 500, .msg_len = 32, .queue_depth = 8, .aggr_max_len = 0,
+    };
+
+    bench_run(&params, &result);
+
+    // Short crc lets corrupted frame through now and then, such message is lost silently
+    CU_ASSERT(result.delivered >= params.msgs * 9 / 10);
+    CU_ASSERT(result.delivered + result.failed <= params.msgs);
+}
+
+
+#if DART_COMPRESSION
+void test_bench_compression(void)
+{
+    static struct bench_result plain, compressed;
+    struct bench_params params = {
+        .name = "slow plain", .baudrate = 9600, .latency_us = 20000, .jitter_us = 10000, .ber = 0, .drop_rate = 0,
+        .msgs = 100, .msg_len = 120, .queue_depth = 4, .aggr_max_len = 0, .lz_threshold = 0,
+    };
+
+    bench_run(&params, &plain);
+    params.name = "slow lzss";
+    params.lz_threshold = 32;
+    bench_run(&params, &compressed);
+
+    CU_ASSERT_EQUAL(plain.delivered, params.msgs);
+    CU_ASSERT_EQUAL(compressed.delivered, params.msgs);
+
+    // Payload is mostly filler, line time dominates
+    CU_ASSERT(compressed.elapsed_ms < plain.elapsed_ms / 2);
+}
+#endif
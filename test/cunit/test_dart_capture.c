@@ -0,0 +1,481 @@
+#include <CUnit/Basic.h>
+
+#include "mx/core/dart-capture.h"
+#include "mx/misc.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+
+static void test_capture_ring(void);
+static void test_capture_pcap(void);
+static void test_capture_append(void);
+static void test_replay_errors(void);
+#if DART_CAPTURE
+static void test_capture_replay(void);
+static void test_replay_timing(void);
+#endif
+
+
+CU_ErrorCode cu_test_dart_capture()
+{
+    // Test logging to terminal
+    CU_pSuite suite = CU_add_suite("Test DART capture", NULL, NULL);
+    if ( !suite ) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_add_test(suite, "Test capture ring",                 test_capture_ring);
+    CU_add_test(suite, "Test capture pcap",                 test_capture_pcap);
+    CU_add_test(suite, "Test capture append",               test_capture_append);
+    CU_add_test(suite, "Test replay errors",                test_replay_errors);
+#if DART_CAPTURE
+    CU_add_test(suite, "Test capture replay",               test_capture_replay);
+    CU_add_test(suite, "Test replay timing",                test_replay_timing);
+#endif
+
+    return CU_get_error();
+}
+
+
+
+
+#define CAPTURE_RX_BUFFER_LEN           128
+#define CAPTURE_MEMORY_POOL_SIZE        1024
+#define CAPTURE_WIRE_LEN                512
+#define CAPTURE_FILE_LEN                8192
+#define CAPTURE_RING_LEN                2048
+
+#define CAPTURE_FILE_HDR_LEN            24
+#define CAPTURE_PACKET_HDR_LEN          16
+#define CAPTURE_RECORD_HDR_LEN          8
+
+
+struct capture_file
+{
+    uint8_t data[CAPTURE_FILE_LEN];
+    size_t length;
+    size_t limit;                       // Simulate write failure at given file length, 0 disables
+};
+
+
+static size_t capture_file_write(void *private, const void *data, size_t length)
+{
+    struct capture_file *file = (struct capture_file*)private;
+    size_t limit = file->limit ? file->limit : sizeof(file->data);
+    size_t written = MIN(length, limit - file->length);
+    memcpy(&file->data[file->length], data, written);
+    file->length += written;
+    return written;
+}
+
+#if DART_CAPTURE
+static uint32_t capture_bytes(const struct dart_capture *capture)
+{
+    return capture->used - capture->records * CAPTURE_RECORD_HDR_LEN;
+}
+#endif
+
+static uint32_t capture_u32(const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+
+struct capture_side
+{
+    struct dart dart;
+    uint8_t rx_buffer[CAPTURE_RX_BUFFER_LEN];
+    uint8_t memory_pool[CAPTURE_MEMORY_POOL_SIZE];
+
+    uint8_t wire[CAPTURE_WIRE_LEN];     // Bytes sent to the opponent
+    size_t wire_bytes;
+
+    int received;
+};
+
+
+static void capture_send(uint8_t *buffer, int32_t length, void *private)
+{
+    struct capture_side *side = (struct capture_side*)private;
+    CU_ASSERT(side->wire_bytes + (size_t)length <= sizeof(side->wire));
+    if (side->wire_bytes + (size_t)length > sizeof(side->wire))
+        return;
+    memcpy(&side->wire[side->wire_bytes], buffer, (size_t)length);
+    side->wire_bytes += (size_t)length;
+}
+
+static bool capture_pin_get_state(int pin_e, void *private)
+{
+    UNUSED(pin_e);
+    UNUSED(private);
+    return true;
+}
+
+static void capture_pin_set_state(int pin_e, bool state, void *private)
+{
+    UNUSED(pin_e);
+    UNUSED(state);
+    UNUSED(private);
+}
+
+static const struct dart_ops capture_ops = {
+    .send = capture_send,
+    .sendv = NULL,
+    .pin_get_state = capture_pin_get_state,
+    .pin_set_state = capture_pin_set_state,
+    .get_milis = NULL,
+};
+
+
+static void capture_callback(int code, void *param1, void *param2, void *private)
+{
+    UNUSED(param1);
+    UNUSED(param2);
+
+    struct capture_side *side = (struct capture_side*)private;
+    if (code == DART_CLBK_MESSAGE_RECEIVED)
+        side->received++;
+}
+
+
+static void capture_side_init(struct capture_side *side)
+{
+    memset(side, 0, sizeof(*side));
+    dart_init(&side->dart, side->memory_pool, sizeof(side->memory_pool), side->rx_buffer, sizeof(side->rx_buffer));
+    dart_set_ops(&side->dart, side, &capture_ops);
+    dart_set_callback(&side->dart, side, capture_callback);
+}
+
+
+#if DART_CAPTURE
+/**
+ * Move bytes between sides until the line is quiet
+ *
+ */
+static void capture_pump(struct capture_side *a, struct capture_side *b)
+{
+    uint8_t chunk[CAPTURE_WIRE_LEN];
+
+    while (a->wire_bytes || b->wire_bytes) {
+        size_t length = a->wire_bytes;
+        memcpy(chunk, a->wire, length);
+        a->wire_bytes = 0;
+        dart_handle_received_buffer(&b->dart, chunk, length);
+
+        length = b->wire_bytes;
+        memcpy(chunk, b->wire, length);
+        b->wire_bytes = 0;
+        dart_handle_received_buffer(&a->dart, chunk, length);
+    }
+}
+#endif
+
+
+
+
+void test_capture_ring(void)
+{
+    struct dart_capture capture;
+    uint8_t ring[64];
+    uint8_t data[20];
+    memset(data, 0xA5, sizeof(data));
+
+    dart_capture_init(&capture, ring, sizeof(ring));
+
+    // Every record takes 8 bytes of header plus data, so two of them fit
+    dart_capture_record(&capture, DART_CAPTURE_TX, 1, data, sizeof(data));
+    dart_capture_record(&capture, DART_CAPTURE_RX, 2, data, sizeof(data));
+    CU_ASSERT_EQUAL(capture.records, 2);
+    CU_ASSERT_EQUAL(capture.dropped, 0);
+
+    // The oldest record is overwritten
+    dart_capture_record(&capture, DART_CAPTURE_RX, 3, data, sizeof(data));
+    CU_ASSERT_EQUAL(capture.records, 2);
+    CU_ASSERT_EQUAL(capture.dropped, 1);
+
+    // Record which never fits is dropped
+    uint8_t big[sizeof(ring)];
+    memset(big, 0, sizeof(big));
+    dart_capture_record(&capture, DART_CAPTURE_RX, 4, big, sizeof(big));
+    CU_ASSERT_EQUAL(capture.records, 2);
+    CU_ASSERT_EQUAL(capture.dropped, 2);
+
+    // Records wrapped around the buffer end are flushed intact
+    static struct capture_file file;
+    file.length = 0;
+    CU_ASSERT_EQUAL(dart_capture_flush(&capture, &file, capture_file_write), 2);
+    CU_ASSERT_EQUAL(capture.records, 0);
+    CU_ASSERT_EQUAL(file.length, CAPTURE_FILE_HDR_LEN + 2 * (CAPTURE_PACKET_HDR_LEN + 1 + sizeof(data)));
+
+    const uint8_t *packet = &file.data[CAPTURE_FILE_HDR_LEN];
+    CU_ASSERT_EQUAL(capture_u32(&packet[4]), 2000);         // Microseconds
+    CU_ASSERT_EQUAL(packet[CAPTURE_PACKET_HDR_LEN], DART_CAPTURE_RX);
+    packet += CAPTURE_PACKET_HDR_LEN + 1 + sizeof(data);
+    CU_ASSERT_EQUAL(capture_u32(&packet[4]), 3000);
+    CU_ASSERT_EQUAL(memcmp(&packet[CAPTURE_PACKET_HDR_LEN + 1], data, sizeof(data)), 0);
+}
+
+
+void test_capture_pcap(void)
+{
+    struct dart_capture capture;
+    uint8_t ring[CAPTURE_RING_LEN];
+    dart_capture_init(&capture, ring, sizeof(ring));
+
+    static struct capture_file file;
+    file.length = 0;
+    file.limit = 0;
+
+    uint8_t ack = DART_ACK;
+    dart_capture_record(&capture, DART_CAPTURE_TX, 1500, &ack, 1);
+    CU_ASSERT_EQUAL(dart_capture_flush(&capture, &file, capture_file_write), 1);
+
+    // File header
+    CU_ASSERT_EQUAL(capture_u32(&file.data[0]), 0xA1B2C3D4);
+    CU_ASSERT_EQUAL(capture_u32(&file.data[16]), DART_CAPTURE_SNAPLEN);
+    CU_ASSERT_EQUAL(capture_u32(&file.data[20]), DART_CAPTURE_LINKTYPE);
+
+    // Packet with direction pseudo header
+    const uint8_t *packet = &file.data[CAPTURE_FILE_HDR_LEN];
+    CU_ASSERT_EQUAL(capture_u32(&packet[0]), 1);
+    CU_ASSERT_EQUAL(capture_u32(&packet[4]), 500000);
+    CU_ASSERT_EQUAL(capture_u32(&packet[8]), 2);
+    CU_ASSERT_EQUAL(capture_u32(&packet[12]), 2);
+    CU_ASSERT_EQUAL(packet[16], DART_CAPTURE_TX);
+    CU_ASSERT_EQUAL(packet[17], DART_ACK);
+
+    // Next flush appends packets only
+    dart_capture_record(&capture, DART_CAPTURE_RX, 1600, &ack, 1);
+    CU_ASSERT_EQUAL(dart_capture_flush(&capture, &file, capture_file_write), 1);
+    CU_ASSERT_EQUAL(file.length, CAPTURE_FILE_HDR_LEN + 2 * (CAPTURE_PACKET_HDR_LEN + 2));
+
+    // Failed write is reported, record is not lost
+    file.limit = file.length;
+    dart_capture_record(&capture, DART_CAPTURE_RX, 1700, &ack, 1);
+    CU_ASSERT_EQUAL(dart_capture_flush(&capture, &file, capture_file_write), DART_ERR_NOT_POSSIBLE);
+    CU_ASSERT_EQUAL(capture.records, 1);
+    file.limit = 0;
+    CU_ASSERT_EQUAL(dart_capture_flush(&capture, &file, capture_file_write), 1);
+    CU_ASSERT_EQUAL(capture.records, 0);
+    CU_ASSERT_EQUAL(capture_u32(&file.data[file.length - CAPTURE_PACKET_HDR_LEN - 2]), 1);
+    CU_ASSERT_EQUAL(capture_u32(&file.data[file.length - CAPTURE_PACKET_HDR_LEN - 2 + 4]), 700000);
+
+    // Flush interrupted in the middle of packet continues where it stopped
+    size_t length = file.length;
+    file.limit = length + 5;
+    dart_capture_record(&capture, DART_CAPTURE_RX, 1800, &ack, 1);
+    dart_capture_record(&capture, DART_CAPTURE_TX, 1900, &ack, 1);
+    CU_ASSERT_EQUAL(dart_capture_flush(&capture, &file, capture_file_write), DART_ERR_NOT_POSSIBLE);
+    CU_ASSERT_EQUAL(capture.records, 2);
+    CU_ASSERT_EQUAL(file.length, length + 5);
+    file.limit = length + CAPTURE_PACKET_HDR_LEN + 1;
+    CU_ASSERT_EQUAL(dart_capture_flush(&capture, &file, capture_file_write), DART_ERR_NOT_POSSIBLE);
+    CU_ASSERT_EQUAL(capture.records, 2);
+
+    // Newest record is still extended while the oldest one is being written
+    dart_capture_append(&capture, DART_CAPTURE_TX, 1900, &ack, 1);
+    CU_ASSERT_EQUAL(capture.records, 2);
+    file.limit = 0;
+    CU_ASSERT_EQUAL(dart_capture_flush(&capture, &file, capture_file_write), 2);
+    CU_ASSERT_EQUAL(file.length, length + 2 * CAPTURE_PACKET_HDR_LEN + 2 + 3);
+    packet = &file.data[length];
+    CU_ASSERT_EQUAL(capture_u32(&packet[4]), 800000);
+    CU_ASSERT_EQUAL(capture_u32(&packet[8]), 2);
+    CU_ASSERT_EQUAL(packet[16], DART_CAPTURE_RX);
+    CU_ASSERT_EQUAL(packet[17], DART_ACK);
+    packet += CAPTURE_PACKET_HDR_LEN + 2;
+    CU_ASSERT_EQUAL(capture_u32(&packet[4]), 900000);
+    CU_ASSERT_EQUAL(capture_u32(&packet[8]), 3);
+    CU_ASSERT_EQUAL(packet[16], DART_CAPTURE_TX);
+
+    // Stdio sink
+    FILE *stream = tmpfile();
+    CU_ASSERT_PTR_NOT_NULL(stream);
+    if (stream) {
+        dart_capture_reset(&capture);
+        dart_capture_record(&capture, DART_CAPTURE_TX, 0, &ack, 1);
+        CU_ASSERT_EQUAL(dart_capture_flush(&capture, stream, dart_capture_fwrite), 1);
+        CU_ASSERT_EQUAL(ftell(stream), CAPTURE_FILE_HDR_LEN + CAPTURE_PACKET_HDR_LEN + 2);
+        fclose(stream);
+    }
+}
+
+
+void test_capture_append(void)
+{
+    struct dart_capture capture;
+    uint8_t ring[64];
+    dart_capture_init(&capture, ring, sizeof(ring));
+
+    // Bytes received within the same millisecond form single record
+    uint8_t data[] = {DART_SYNC, 0x01, 0x02, 0x03};
+    for (size_t i=0; i<sizeof(data); i++)
+        dart_capture_append(&capture, DART_CAPTURE_RX, 10, &data[i], 1);
+    CU_ASSERT_EQUAL(capture.records, 1);
+    CU_ASSERT_EQUAL(capture.used, CAPTURE_RECORD_HDR_LEN + sizeof(data));
+
+    // Other direction or millisecond starts new record
+    dart_capture_append(&capture, DART_CAPTURE_TX, 10, data, 1);
+    dart_capture_append(&capture, DART_CAPTURE_RX, 10, data, 1);
+    dart_capture_append(&capture, DART_CAPTURE_RX, 11, data, 2);
+    CU_ASSERT_EQUAL(capture.records, 4);
+
+    // Record is not extended beyond free space, new one overwrites the oldest records
+    uint8_t big[40];
+    memset(big, 0x5A, sizeof(big));
+    dart_capture_append(&capture, DART_CAPTURE_RX, 11, big, sizeof(big));
+    CU_ASSERT_EQUAL(capture.records, 2);
+    CU_ASSERT_EQUAL(capture.dropped, 3);
+
+    static struct capture_file file;
+    file.length = 0;
+    file.limit = 0;
+    dart_capture_reset(&capture);
+    for (size_t i=0; i<sizeof(data); i++)
+        dart_capture_append(&capture, DART_CAPTURE_RX, 1500, &data[i], 1);
+    CU_ASSERT_EQUAL(dart_capture_flush(&capture, &file, capture_file_write), 1);
+
+    const uint8_t *packet = &file.data[CAPTURE_FILE_HDR_LEN];
+    CU_ASSERT_EQUAL(capture_u32(&packet[8]), 1 + sizeof(data));
+    CU_ASSERT_EQUAL(packet[16], DART_CAPTURE_RX);
+    CU_ASSERT_EQUAL(memcmp(&packet[17], data, sizeof(data)), 0);
+}
+
+
+void test_replay_errors(void)
+{
+    static struct capture_side side;
+    capture_side_init(&side);
+
+    struct dart_replay replay;
+    uint8_t header[CAPTURE_FILE_HDR_LEN];
+    memset(header, 0, sizeof(header));
+    CU_ASSERT_EQUAL(dart_replay_init(&replay, &side.dart, header, 10, 1), DART_ERR_BAD_LENGTH);
+    CU_ASSERT_EQUAL(dart_replay_init(&replay, &side.dart, header, sizeof(header), 1), DART_ERR_NOT_SUPPORTED);
+
+    // Capture of other link type
+    uint32_t magic = 0xA1B2C3D4;
+    uint32_t linktype = 1;
+    memcpy(&header[0], &magic, sizeof(magic));
+    memcpy(&header[20], &linktype, sizeof(linktype));
+    CU_ASSERT_EQUAL(dart_replay_init(&replay, &side.dart, header, sizeof(header), 1), DART_ERR_NOT_SUPPORTED);
+
+    // Capture written on host of other byte order
+    magic = 0xD4C3B2A1;
+    linktype = 0x93000000;
+    memcpy(&header[0], &magic, sizeof(magic));
+    memcpy(&header[20], &linktype, sizeof(linktype));
+    CU_ASSERT_EQUAL(dart_replay_init(&replay, &side.dart, header, sizeof(header), 1), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_replay_poll(&replay, 0), DART_SUCCESS);
+
+    // Truncated packet
+    static struct capture_file file;
+    struct dart_capture capture;
+    uint8_t ring[64];
+    uint8_t done = DART_DONE;
+    dart_capture_init(&capture, ring, sizeof(ring));
+    dart_capture_record(&capture, DART_CAPTURE_RX, 0, &done, 1);
+    file.length = 0;
+    file.limit = 0;
+    dart_capture_flush(&capture, &file, capture_file_write);
+    CU_ASSERT_EQUAL(dart_replay_init(&replay, &side.dart, file.data, file.length - 1, 0), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_replay_poll(&replay, 0), DART_ERR_BAD_LENGTH);
+
+    dart_clean(&side.dart);
+}
+
+
+#if DART_CAPTURE
+void test_capture_replay(void)
+{
+    static struct capture_side a, b, c;
+    capture_side_init(&a);
+    capture_side_init(&b);
+    capture_side_init(&c);
+
+    struct dart_capture capture;
+    static uint8_t ring[CAPTURE_RING_LEN];
+    dart_capture_init(&capture, ring, sizeof(ring));
+    dart_set_capture(&b.dart, &capture);
+
+    // Payload contains sync and control bytes
+    uint8_t payload[16];
+    for (size_t i=0; i<sizeof(payload); i++)
+        payload[i] = (uint8_t)(0x55 + i * 0x11);
+    struct msg *msg = (struct msg*)payload;
+    msg->type = 0x21;
+
+    for (int i=0; i<5; i++) {
+        dart_send_msg(&a.dart, msg, sizeof(payload));
+        capture_pump(&a, &b);
+    }
+    CU_ASSERT_EQUAL(b.received, 5);
+
+    // Frames received by B and acknowledges sent by B are recorded
+    CU_ASSERT(capture.records >= 10);
+    CU_ASSERT_EQUAL(capture.dropped, 0);
+
+    static struct capture_file file;
+    file.length = 0;
+    file.limit = 0;
+    CU_ASSERT(dart_capture_flush(&capture, &file, capture_file_write) > 0);
+    dart_set_capture(&b.dart, NULL);
+
+    // Fresh instance receives the same messages, its own acknowledges are not replayed back
+    struct dart_replay replay;
+    CU_ASSERT_EQUAL(dart_replay_init(&replay, &c.dart, file.data, file.length, 0), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_replay_poll(&replay, 0), DART_SUCCESS);
+    CU_ASSERT_EQUAL(c.received, 5);
+
+    dart_clean(&a.dart);
+    dart_clean(&b.dart);
+    dart_clean(&c.dart);
+}
+
+
+void test_replay_timing(void)
+{
+    struct dart_capture capture;
+    uint8_t ring[CAPTURE_RING_LEN];
+    dart_capture_init(&capture, ring, sizeof(ring));
+
+    uint8_t done = DART_DONE;
+    dart_capture_record(&capture, DART_CAPTURE_RX, 1000, &done, 1);
+    dart_capture_record(&capture, DART_CAPTURE_TX, 1050, &done, 1);
+    dart_capture_record(&capture, DART_CAPTURE_RX, 1100, &done, 1);
+    dart_capture_record(&capture, DART_CAPTURE_RX, 1200, &done, 1);
+
+    static struct capture_file file;
+    file.length = 0;
+    file.limit = 0;
+    dart_capture_flush(&capture, &file, capture_file_write);
+
+    static struct capture_side side;
+    capture_side_init(&side);
+
+    // Replayed bytes are recorded by the target instance
+    struct dart_capture replayed;
+    uint8_t replayed_ring[256];
+    dart_capture_init(&replayed, replayed_ring, sizeof(replayed_ring));
+    dart_set_capture(&side.dart, &replayed);
+
+    // Twice as fast as original
+    struct dart_replay replay;
+    CU_ASSERT_EQUAL(dart_replay_init(&replay, &side.dart, file.data, file.length, 2), DART_SUCCESS);
+    CU_ASSERT_EQUAL(dart_replay_poll(&replay, 500), DART_PENDING);
+    CU_ASSERT_EQUAL(capture_bytes(&replayed), 1);
+    CU_ASSERT_EQUAL(dart_replay_poll(&replay, 549), DART_PENDING);
+    CU_ASSERT_EQUAL(capture_bytes(&replayed), 1);
+    CU_ASSERT_EQUAL(dart_replay_poll(&replay, 550), DART_PENDING);
+    CU_ASSERT_EQUAL(capture_bytes(&replayed), 2);
+    CU_ASSERT_EQUAL(dart_replay_poll(&replay, 600), DART_SUCCESS);
+    CU_ASSERT_EQUAL(capture_bytes(&replayed), 3);
+
+    dart_clean(&side.dart);
+}
+#endif
@@ -0,0 +1,233 @@
+#include <CUnit/Basic.h>
+
+#include "mx/core/dart-linux.h"
+#include "mx/misc.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+
+#ifdef __linux__
+static void test_open_errors(void);
+static void test_pty_pins(void);
+static void test_pty_throughput(void);
+static void test_pty_hangup(void);
+#endif
+
+
+CU_ErrorCode cu_test_dart_linux()
+{
+    // Test logging to terminal
+    CU_pSuite suite = CU_add_suite("Test DART linux backend", NULL, NULL);
+    if ( !suite ) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+#ifdef __linux__
+    CU_add_test(suite, "Test open errors",                  test_open_errors);
+    CU_add_test(suite, "Test pty pins",                     test_pty_pins);
+    CU_add_test(suite, "Test pty throughput",               test_pty_throughput);
+    CU_add_test(suite, "Test pty hangup",                   test_pty_hangup);
+#endif
+
+    return CU_get_error();
+}
+
+
+
+#ifdef __linux__
+
+#define PTY_RX_BUFFER_LEN               128
+#define PTY_MEMORY_POOL_SIZE            2048
+#define PTY_MESSAGES                    200
+#define PTY_TIMEOUT_MS                  5000
+
+
+struct pty_side
+{
+    struct dart dart;
+    struct dart_linux_link link;
+    uint8_t rx_buffer[PTY_RX_BUFFER_LEN];
+    uint8_t memory_pool[PTY_MEMORY_POOL_SIZE];
+    int counters[DART_CLBK_MESSAGE_EXPIRED + 1];
+    uint32_t rx_bytes;
+};
+
+
+static void pty_callback(int code, void *param1, void *param2, void *private)
+{
+    UNUSED(param1);
+
+    struct pty_side *side = (struct pty_side*)private;
+    side->counters[code]++;
+    if (code == DART_CLBK_MESSAGE_RECEIVED)
+        side->rx_bytes += (uint32_t)(size_t)param2;
+}
+
+
+static void pty_side_init(struct pty_side *side)
+{
+    dart_init(&side->dart, side->memory_pool, sizeof(side->memory_pool), side->rx_buffer, sizeof(side->rx_buffer));
+    dart_set_callback(&side->dart, side, pty_callback);
+    memset(side->counters, 0, sizeof(side->counters));
+    side->rx_bytes = 0;
+}
+
+
+static uint64_t pty_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+
+void test_open_errors(void)
+{
+    struct dart_linux loop;
+    CU_ASSERT_EQUAL(dart_linux_init(&loop), DART_SUCCESS);
+
+    static struct pty_side side;
+    pty_side_init(&side);
+
+    int ret = dart_linux_open(&loop, &side.link, &side.dart, "/nonexistent/tty", 115200, DART_LINUX_PINS_MODEM);
+    CU_ASSERT_EQUAL(ret, DART_ERR_NOT_POSSIBLE);
+    CU_ASSERT_EQUAL(errno, ENOENT);
+    CU_ASSERT_PTR_NULL(loop.links);
+
+    dart_clean(&side.dart);
+    dart_linux_clean(&loop);
+}
+
+
+void test_pty_pins(void)
+{
+    struct dart_linux loop;
+    CU_ASSERT_EQUAL(dart_linux_init(&loop), DART_SUCCESS);
+
+    static struct pty_side a, b;
+    pty_side_init(&a);
+    pty_side_init(&b);
+
+    int ret = dart_linux_open_pty(&loop, &a.link, &a.dart, &b.link, &b.dart);
+    CU_ASSERT_EQUAL_FATAL(ret, DART_SUCCESS);
+
+    // Opponent is woken up with WRK pin
+    ret = dart_send_msgtype(&a.dart, 0x11);
+    CU_ASSERT_EQUAL(ret, DART_WAITING);
+    CU_ASSERT_TRUE(a.link.pins[DART_WRK_PIN]);
+    CU_ASSERT_FALSE(b.link.pins[DART_WRK_PIN]);
+
+    for (int i=0; i<PTY_TIMEOUT_MS && a.counters[DART_CLBK_TRANSFER_DONE] == 0; i++)
+        dart_linux_poll(&loop, 1);
+    CU_ASSERT_TRUE(b.link.pins[DART_WRK_PIN]);
+    CU_ASSERT_EQUAL(a.counters[DART_CLBK_TRANSFER_DONE], 1);
+    CU_ASSERT_EQUAL(b.counters[DART_CLBK_MESSAGE_RECEIVED], 1);
+
+    // Both sides go idle when there is nothing to send
+    for (int i=0; i<PTY_TIMEOUT_MS && (a.link.pins[DART_WRK_PIN] || b.link.pins[DART_WRK_PIN]); i++)
+        dart_linux_poll(&loop, 1);
+    CU_ASSERT_FALSE(a.link.pins[DART_WRK_PIN]);
+    CU_ASSERT_FALSE(b.link.pins[DART_WRK_PIN]);
+
+    // Instances are bound back to default transport
+    dart_linux_clean(&loop);
+    CU_ASSERT_PTR_NULL(loop.links);
+    dart_clean(&a.dart);
+    dart_clean(&b.dart);
+}
+
+
+void test_pty_throughput(void)
+{
+    struct dart_linux loop;
+    CU_ASSERT_EQUAL(dart_linux_init(&loop), DART_SUCCESS);
+
+    static struct pty_side a, b;
+    pty_side_init(&a);
+    pty_side_init(&b);
+
+    int ret = dart_linux_open_pty(&loop, &a.link, &a.dart, &b.link, &b.dart);
+    CU_ASSERT_EQUAL_FATAL(ret, DART_SUCCESS);
+
+    uint8_t payload[32];
+    for (size_t i=0; i<sizeof(payload); i++)
+        payload[i] = (uint8_t)(i * 7 + 0x55);   // Includes sync byte within data
+    struct msg *msg = (struct msg*)payload;
+    msg->type = 0x21;
+
+    uint64_t start = pty_now_us();
+    int queued = 0;
+    for (int i=0; i<PTY_TIMEOUT_MS * 10 && a.counters[DART_CLBK_TRANSFER_DONE] < PTY_MESSAGES; i++) {
+        while (queued < PTY_MESSAGES && queued - a.counters[DART_CLBK_TRANSFER_DONE] < 16) {
+            if (dart_send_msg(&a.dart, msg, sizeof(payload)) < 0)
+                break;
+            queued++;
+        }
+        dart_linux_poll(&loop, 1);
+    }
+    uint64_t elapsed = pty_now_us() - start;
+
+    CU_ASSERT_EQUAL(a.counters[DART_CLBK_TRANSFER_DONE], PTY_MESSAGES);
+    CU_ASSERT_EQUAL(b.counters[DART_CLBK_MESSAGE_RECEIVED], PTY_MESSAGES);
+    CU_ASSERT_EQUAL(b.counters[DART_CLBK_TRANSFER_CORRUPTED], 0);
+    CU_ASSERT_EQUAL(a.link.tx_dropped, 0);
+
+    printf("\n    pty: %d messages in %.1f ms, %.0f msg/s, %.0f bytes/s\n", PTY_MESSAGES,
+           (double)elapsed / 1000.0,
+           elapsed ? PTY_MESSAGES * 1e6 / (double)elapsed : 0.0,
+           elapsed ? b.rx_bytes * 1e6 / (double)elapsed : 0.0);
+
+    dart_linux_clean(&loop);
+    dart_clean(&a.dart);
+    dart_clean(&b.dart);
+}
+
+
+void test_pty_hangup(void)
+{
+    struct dart_linux loop;
+    CU_ASSERT_EQUAL(dart_linux_init(&loop), DART_SUCCESS);
+
+    static struct pty_side a, b;
+    pty_side_init(&a);
+    pty_side_init(&b);
+
+    int ret = dart_linux_open_pty(&loop, &a.link, &a.dart, &b.link, &b.dart);
+    CU_ASSERT_EQUAL_FATAL(ret, DART_SUCCESS);
+
+    // Master side hangs up when slave is closed
+    dart_linux_close(&loop, &b.link);
+    ret = dart_linux_poll(&loop, 100);
+    CU_ASSERT_EQUAL(ret, DART_ERR_NOT_POSSIBLE);
+    CU_ASSERT_EQUAL(errno, EIO);
+    CU_ASSERT_EQUAL(a.link.error, EIO);
+
+    // Failed link does not wake up event loop anymore
+    uint64_t start = pty_now_us();
+    ret = dart_linux_poll(&loop, 20);
+    CU_ASSERT_EQUAL(ret, DART_ERR_NOT_POSSIBLE);
+    CU_ASSERT(pty_now_us() - start >= 10000);
+
+    // Bytes sent to failed link are dropped
+    uint32_t dropped = a.link.tx_dropped;
+    dart_send_msgtype(&a.dart, 0x11);
+    for (int i=0; i<10; i++)
+        dart_linux_poll(&loop, 1);
+    CU_ASSERT(a.link.tx_dropped > dropped);
+    CU_ASSERT_FALSE(a.link.tx_polling);
+
+    dart_linux_close(&loop, &a.link);
+    CU_ASSERT_EQUAL(dart_linux_poll(&loop, 0), 0);
+
+    dart_linux_clean(&loop);
+    dart_clean(&a.dart);
+    dart_clean(&b.dart);
+}
+
+#endif /* __linux__ */
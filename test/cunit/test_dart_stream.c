@@ -0,0 +1,335 @@
+#include <CUnit/Basic.h>
+
+#include "mx/core/dart-stream.h"
+#include "mx/misc.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+
+static void test_stream_transfer(void);
+static void test_stream_empty(void);
+static void test_stream_duplicates(void);
+static void test_stream_sink_errors(void);
+
+
+CU_ErrorCode cu_test_dart_stream()
+{
+    // Test logging to terminal
+    CU_pSuite suite = CU_add_suite("Test DART stream", NULL, NULL);
+    if ( !suite ) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_add_test(suite, "Test stream transfer",              test_stream_transfer);
+    CU_add_test(suite, "Test stream empty",                 test_stream_empty);
+    CU_add_test(suite, "Test stream duplicates",            test_stream_duplicates);
+    CU_add_test(suite, "Test stream sink errors",           test_stream_sink_errors);
+
+    return CU_get_error();
+}
+
+
+
+
+#define STREAM_RX_BUFFER_LEN            128
+#define STREAM_MEMORY_POOL_SIZE         1024
+#define STREAM_WIRE_LEN                 512
+#define STREAM_MSGTYPE                  0x3F
+
+
+struct stream_side
+{
+    struct dart dart;
+    struct dart_stream stream;
+    uint8_t rx_buffer[STREAM_RX_BUFFER_LEN];
+    uint8_t memory_pool[STREAM_MEMORY_POOL_SIZE];
+
+    uint8_t wire[STREAM_WIRE_LEN];      // Bytes sent to the opponent
+    size_t wire_bytes;
+
+    int events[DART_STREAM_ABORTED + 1];
+    uint32_t done;
+    int other_msgs;                     // Messages passed to chained callback
+};
+
+
+static void stream_send(uint8_t *buffer, int32_t length, void *private)
+{
+    struct stream_side *side = (struct stream_side*)private;
+    CU_ASSERT(side->wire_bytes + (size_t)length <= sizeof(side->wire));
+    if (side->wire_bytes + (size_t)length > sizeof(side->wire))
+        return;
+    memcpy(&side->wire[side->wire_bytes], buffer, (size_t)length);
+    side->wire_bytes += (size_t)length;
+}
+
+static bool stream_pin_get_state(int pin_e, void *private)
+{
+    UNUSED(pin_e);
+    UNUSED(private);
+    return true;
+}
+
+static void stream_pin_set_state(int pin_e, bool state, void *private)
+{
+    UNUSED(pin_e);
+    UNUSED(state);
+    UNUSED(private);
+}
+
+static const struct dart_ops stream_ops = {
+    .send = stream_send,
+    .sendv = NULL,
+    .pin_get_state = stream_pin_get_state,
+    .pin_set_state = stream_pin_set_state,
+    .get_milis = NULL,
+};
+
+
+static void stream_dart_callback(int code, void *param1, void *param2, void *private)
+{
+    UNUSED(param1);
+    UNUSED(param2);
+
+    struct stream_side *side = (struct stream_side*)private;
+    if (code == DART_CLBK_MESSAGE_RECEIVED)
+        side->other_msgs++;
+}
+
+static void stream_callback(int event, int dir, uint32_t done, uint32_t total, void *private)
+{
+    UNUSED(dir);
+    UNUSED(total);
+
+    struct stream_side *side = (struct stream_side*)private;
+    side->events[event]++;
+    side->done = done;
+}
+
+
+static void stream_side_init(struct stream_side *side)
+{
+    memset(side, 0, sizeof(*side));
+    dart_init(&side->dart, side->memory_pool, sizeof(side->memory_pool), side->rx_buffer, sizeof(side->rx_buffer));
+    dart_set_ops(&side->dart, side, &stream_ops);
+    dart_set_callback(&side->dart, side, stream_dart_callback);
+
+    dart_stream_init(&side->stream, &side->dart, STREAM_MSGTYPE);
+    dart_stream_set_callback(&side->stream, side, stream_callback);
+}
+
+static void stream_side_clean(struct stream_side *side)
+{
+    dart_stream_clean(&side->stream);
+    dart_clean(&side->dart);
+}
+
+
+/**
+ * Move bytes between sides until the line is quiet
+ *
+ */
+static void stream_pump(struct stream_side *a, struct stream_side *b)
+{
+    uint8_t chunk[STREAM_WIRE_LEN];
+
+    while (a->wire_bytes || b->wire_bytes) {
+        size_t length = a->wire_bytes;
+        memcpy(chunk, a->wire, length);
+        a->wire_bytes = 0;
+        dart_handle_received_buffer(&b->dart, chunk, length);
+
+        length = b->wire_bytes;
+        memcpy(chunk, b->wire, length);
+        b->wire_bytes = 0;
+        dart_handle_received_buffer(&a->dart, chunk, length);
+
+        CU_ASSERT(a->stream.tx.inflight <= DART_STREAM_TX_DEPTH);
+    }
+}
+
+
+/**
+ * Move bytes between sides, every frame is received twice as if acknowledge was lost
+ *
+ */
+static void stream_pump_twice(struct stream_side *a, struct stream_side *b)
+{
+    uint8_t chunk[STREAM_WIRE_LEN];
+
+    while (a->wire_bytes || b->wire_bytes) {
+        size_t chunk_len = a->wire_bytes;
+        memcpy(chunk, a->wire, chunk_len);
+        a->wire_bytes = 0;
+        dart_handle_received_buffer(&b->dart, chunk, chunk_len);
+        dart_handle_received_buffer(&b->dart, chunk, chunk_len);
+
+        chunk_len = b->wire_bytes;
+        memcpy(chunk, b->wire, chunk_len);
+        b->wire_bytes = 0;
+        dart_handle_received_buffer(&a->dart, chunk, chunk_len);
+    }
+}
+
+
+static uint8_t stream_payload[1000];
+
+static size_t stream_read(void *private, uint32_t offset, uint8_t *buffer, size_t length)
+{
+    UNUSED(private);
+
+    memcpy(buffer, &stream_payload[offset], length);
+    return length;
+}
+
+static void stream_payload_init(void)
+{
+    for (size_t i=0; i<sizeof(stream_payload); i++)
+        stream_payload[i] = (uint8_t)(i * 13 + 7);
+}
+
+
+
+
+void test_stream_transfer(void)
+{
+    static struct stream_side a, b;
+    stream_side_init(&a);
+    stream_side_init(&b);
+    stream_payload_init();
+
+    static uint8_t received[sizeof(stream_payload)];
+    struct dart_stream_buffer sink = { .data = received, .size = sizeof(received) };
+    dart_stream_set_sink(&b.stream, &sink, dart_stream_buffer_write);
+
+    int ret = dart_stream_send(&a.stream, sizeof(stream_payload), NULL, stream_read);
+    CU_ASSERT_EQUAL(ret, DART_SUCCESS);
+    CU_ASSERT_TRUE(dart_stream_is_sending(&a.stream));
+
+    // Only one stream is sent at once
+    ret = dart_stream_send(&a.stream, sizeof(stream_payload), NULL, stream_read);
+    CU_ASSERT_EQUAL(ret, DART_ERR_NOT_POSSIBLE);
+
+    // Other messages go through
+    CU_ASSERT_EQUAL(dart_send_msgtype(&a.dart, 0x11), DART_PENDING);
+
+    stream_pump(&a, &b);
+
+    int fragments = (sizeof(stream_payload) + DART_STREAM_FRAGMENT_LEN - 1) / DART_STREAM_FRAGMENT_LEN;
+    CU_ASSERT_FALSE(dart_stream_is_sending(&a.stream));
+    CU_ASSERT_EQUAL(a.events[DART_STREAM_PROGRESS], fragments - 1);
+    CU_ASSERT_EQUAL(a.events[DART_STREAM_DONE], 1);
+    CU_ASSERT_EQUAL(a.done, sizeof(stream_payload));
+
+    CU_ASSERT_FALSE(dart_stream_is_receiving(&b.stream));
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_STARTED], 1);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_PROGRESS], fragments - 1);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_DONE], 1);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_ABORTED], 0);
+    CU_ASSERT_EQUAL(memcmp(received, stream_payload, sizeof(stream_payload)), 0);
+    CU_ASSERT_EQUAL(b.other_msgs, 1);
+
+    stream_side_clean(&a);
+    stream_side_clean(&b);
+}
+
+
+void test_stream_empty(void)
+{
+    static struct stream_side a, b;
+    stream_side_init(&a);
+    stream_side_init(&b);
+
+    int ret = dart_stream_send(&a.stream, 0, NULL, stream_read);
+    CU_ASSERT_EQUAL(ret, DART_SUCCESS);
+    stream_pump(&a, &b);
+
+    CU_ASSERT_EQUAL(a.events[DART_STREAM_DONE], 1);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_STARTED], 1);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_DONE], 1);
+
+    stream_side_clean(&a);
+    stream_side_clean(&b);
+}
+
+
+void test_stream_duplicates(void)
+{
+    static struct stream_side a, b;
+    stream_side_init(&a);
+    stream_side_init(&b);
+    stream_payload_init();
+
+    static uint8_t received[sizeof(stream_payload)];
+    struct dart_stream_buffer sink = { .data = received, .size = sizeof(received) };
+    dart_stream_set_sink(&b.stream, &sink, dart_stream_buffer_write);
+
+    uint32_t length = 3 * DART_STREAM_FRAGMENT_LEN;
+    dart_stream_send(&a.stream, length, NULL, stream_read);
+    stream_pump_twice(&a, &b);
+
+    CU_ASSERT_EQUAL(a.events[DART_STREAM_DONE], 1);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_STARTED], 1);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_DONE], 1);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_ABORTED], 0);
+    CU_ASSERT_EQUAL(b.done, length);
+    CU_ASSERT_EQUAL(memcmp(received, stream_payload, length), 0);
+
+    // First fragment received again after the stream completed
+    length = DART_STREAM_FRAGMENT_LEN / 2;
+    dart_stream_send(&a.stream, length, NULL, stream_read);
+    stream_pump_twice(&a, &b);
+
+    CU_ASSERT_EQUAL(a.events[DART_STREAM_DONE], 2);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_STARTED], 2);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_DONE], 2);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_ABORTED], 0);
+    CU_ASSERT_FALSE(dart_stream_is_receiving(&b.stream));
+
+    // Next stream of the same length is not a duplicate
+    dart_stream_send(&a.stream, length, NULL, stream_read);
+    stream_pump_twice(&a, &b);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_STARTED], 3);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_DONE], 3);
+
+    stream_side_clean(&a);
+    stream_side_clean(&b);
+}
+
+
+void test_stream_sink_errors(void)
+{
+    static struct stream_side a, b;
+    stream_side_init(&a);
+    stream_side_init(&b);
+    stream_payload_init();
+
+    // Sink buffer too small
+    uint8_t received[DART_STREAM_FRAGMENT_LEN];
+    struct dart_stream_buffer sink = { .data = received, .size = sizeof(received) };
+    dart_stream_set_sink(&b.stream, &sink, dart_stream_buffer_write);
+
+    dart_stream_send(&a.stream, 2 * DART_STREAM_FRAGMENT_LEN, NULL, stream_read);
+    stream_pump(&a, &b);
+
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_STARTED], 1);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_ABORTED], 1);
+    CU_ASSERT_EQUAL(b.done, DART_STREAM_FRAGMENT_LEN);
+    CU_ASSERT_FALSE(dart_stream_is_receiving(&b.stream));
+
+    // Link level transfer succeeded anyway
+    CU_ASSERT_EQUAL(a.events[DART_STREAM_DONE], 1);
+
+    // Fragments of aborted stream are ignored until the next stream starts
+    dart_stream_set_sink(&b.stream, NULL, NULL);
+    dart_stream_send(&a.stream, 0, NULL, stream_read);
+    stream_pump(&a, &b);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_STARTED], 2);
+    CU_ASSERT_EQUAL(b.events[DART_STREAM_DONE], 1);
+
+    stream_side_clean(&a);
+    stream_side_clean(&b);
+}
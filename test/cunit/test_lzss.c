@@ -0,0 +1,272 @@
+#include <CUnit/Basic.h>
+
+#include "mx/lib/lzss.h"
+#include "mx/misc.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+
+static void test_lzss_roundtrip(void);
+static void test_lzss_limits(void);
+static void test_lzss_malformed(void);
+static void test_lzss_benchmark(void);
+
+
+CU_ErrorCode cu_test_lzss()
+{
+    // Test logging to terminal
+    CU_pSuite suite = CU_add_suite("Test LZSS module", NULL, NULL);
+    if ( !suite ) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_add_test(suite, "Test LZSS roundtrip",               test_lzss_roundtrip);
+    CU_add_test(suite, "Test LZSS limits",                  test_lzss_limits);
+    CU_add_test(suite, "Test LZSS malformed input",         test_lzss_malformed);
+    CU_add_test(suite, "Test LZSS benchmark",               test_lzss_benchmark);
+
+    return CU_get_error();
+}
+
+
+
+
+#define LZSS_TEST_DATA_LEN          1024
+#define LZSS_TEST_BUFFER_LEN        (LZSS_TEST_DATA_LEN + LZSS_WINDOW)
+
+
+static uint8_t lzss_input[LZSS_TEST_BUFFER_LEN];
+static uint8_t lzss_packed[LZSS_BOUND(LZSS_TEST_BUFFER_LEN)];
+static uint8_t lzss_output[LZSS_TEST_BUFFER_LEN];
+
+
+/**
+ * Compress and decompress given data, return compressed length
+ *
+ */
+static size_t lzss_roundtrip(const uint8_t *data, size_t length)
+{
+    size_t packed_len = lzss_compress(data, length, lzss_packed, sizeof(lzss_packed));
+    CU_ASSERT(packed_len <= LZSS_BOUND(length));
+
+    memset(lzss_output, 0, sizeof(lzss_output));
+    size_t output_len = lzss_decompress(lzss_packed, packed_len, lzss_output, sizeof(lzss_output));
+    CU_ASSERT_EQUAL(output_len, length);
+    CU_ASSERT_EQUAL(memcmp(lzss_output, data, length), 0);
+
+    return packed_len;
+}
+
+
+/**
+ * Telemetry record as text, values change slowly
+ *
+ */
+static size_t lzss_fill_telemetry(uint8_t *buffer, size_t size)
+{
+    size_t length = 0;
+
+    for (int i=0; length < size; i++) {
+        char record[64];
+        int n = snprintf(record, sizeof(record), "{\"t\":%d,\"temp\":%d.%d,\"rh\":%d,\"ok\":1}\n",
+                         1000 + i * 10, 21 + (i / 7) % 3, i % 10, 40 + i % 5);
+        size_t chunk = MIN((size_t)n, size - length);
+        memcpy(&buffer[length], record, chunk);
+        length += chunk;
+    }
+
+    return length;
+}
+
+
+/**
+ * Configuration structure, mostly zeros and repeated defaults
+ *
+ */
+static size_t lzss_fill_config(uint8_t *buffer, size_t size)
+{
+    memset(buffer, 0, size);
+    for (size_t i=0; i<size; i+=16) {
+        buffer[i] = (uint8_t)(i / 16);
+        buffer[i + 1] = 0x01;
+        buffer[i + 4] = 0xE8;
+        buffer[i + 5] = 0x03;
+    }
+
+    return size;
+}
+
+
+static size_t lzss_fill_random(uint8_t *buffer, size_t size)
+{
+    uint32_t state = 0x12345678;
+
+    for (size_t i=0; i<size; i++) {
+        state = state * 1103515245 + 12345;
+        buffer[i] = (uint8_t)(state >> 16);
+    }
+
+    return size;
+}
+
+
+
+
+void test_lzss_roundtrip(void)
+{
+    // Empty input
+    CU_ASSERT_EQUAL(lzss_compress(lzss_input, 0, lzss_packed, sizeof(lzss_packed)), 0);
+
+    // Short inputs are literals only
+    for (size_t len=1; len<=LZSS_MIN_MATCH; len++) {
+        memset(lzss_input, 'a', len);
+        CU_ASSERT_EQUAL(lzss_roundtrip(lzss_input, len), len + 1);
+    }
+
+    // Run is encoded as overlapping match
+    memset(lzss_input, 'a', 100);
+    CU_ASSERT(lzss_roundtrip(lzss_input, 100) < 20);
+
+    // Every length and both ends of the window
+    lzss_fill_random(lzss_input, sizeof(lzss_input));
+    for (size_t len=1; len<=LZSS_MAX_MATCH + 2; len++) {
+        memcpy(&lzss_input[LZSS_WINDOW], lzss_input, len);
+        lzss_roundtrip(lzss_input, LZSS_WINDOW + len);
+        memcpy(&lzss_input[LZSS_WINDOW + 1], &lzss_input[1], len);
+        lzss_roundtrip(lzss_input, LZSS_WINDOW + 1 + len);
+    }
+
+    size_t len = lzss_fill_telemetry(lzss_input, LZSS_TEST_DATA_LEN);
+    CU_ASSERT(lzss_roundtrip(lzss_input, len) < len / 2);
+    len = lzss_fill_config(lzss_input, LZSS_TEST_DATA_LEN);
+    CU_ASSERT(lzss_roundtrip(lzss_input, len) < len / 4);
+    len = lzss_fill_random(lzss_input, LZSS_TEST_DATA_LEN);
+    CU_ASSERT_EQUAL(lzss_roundtrip(lzss_input, len), LZSS_BOUND(len));
+}
+
+
+void test_lzss_limits(void)
+{
+    size_t len = lzss_fill_random(lzss_input, 64);
+
+    // Output must fit exactly
+    CU_ASSERT_EQUAL(lzss_compress(lzss_input, len, lzss_packed, LZSS_BOUND(len)), LZSS_BOUND(len));
+    CU_ASSERT_EQUAL(lzss_compress(lzss_input, len, lzss_packed, LZSS_BOUND(len) - 1), 0);
+    CU_ASSERT_EQUAL(lzss_compress(lzss_input, len, lzss_packed, 0), 0);
+
+    len = lzss_fill_config(lzss_input, 256);
+    size_t packed_len = lzss_compress(lzss_input, len, lzss_packed, sizeof(lzss_packed));
+    CU_ASSERT_NOT_EQUAL(packed_len, 0);
+    CU_ASSERT_EQUAL(lzss_compress(lzss_input, len, lzss_packed, packed_len - 1), 0);
+
+    // Decompressed data must fit too, failed call left partial output
+    lzss_compress(lzss_input, len, lzss_packed, sizeof(lzss_packed));
+    CU_ASSERT_EQUAL(lzss_decompress(lzss_packed, packed_len, lzss_output, len), len);
+    CU_ASSERT_EQUAL(lzss_decompress(lzss_packed, packed_len, lzss_output, len - 1), 0);
+    CU_ASSERT_EQUAL(lzss_decompress(lzss_packed, packed_len, lzss_output, 0), 0);
+}
+
+
+void test_lzss_malformed(void)
+{
+    // Match before the start of output
+    const uint8_t bad_offset[] = { 0x02, 'a', 0x00, 0x10 };
+    CU_ASSERT_EQUAL(lzss_decompress(bad_offset, sizeof(bad_offset), lzss_output, sizeof(lzss_output)), 0);
+
+    // Truncated match
+    const uint8_t truncated[] = { 0x02, 'a', 0x00 };
+    CU_ASSERT_EQUAL(lzss_decompress(truncated, sizeof(truncated), lzss_output, sizeof(lzss_output)), 0);
+
+    // Flags without items
+    const uint8_t flags_only[] = { 0x00, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 0x00 };
+    CU_ASSERT_EQUAL(lzss_decompress(flags_only, sizeof(flags_only), lzss_output, sizeof(lzss_output)), 0);
+
+    // Valid overlapping match
+    const uint8_t run[] = { 0x02, 'a', 0x00, 0x02 };
+    CU_ASSERT_EQUAL(lzss_decompress(run, sizeof(run), lzss_output, sizeof(lzss_output)), 6);
+    CU_ASSERT_EQUAL(memcmp(lzss_output, "aaaaaa", 6), 0);
+}
+
+
+
+#define LZSS_BENCH_ROUNDS           200
+
+static uint64_t lzss_bench_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+
+/**
+ * Compression ratio and CPU cost against line time saved
+ *
+ * Blobs are compressed in message sized chunks as DART does. Line time assumes 10 bits per
+ * byte, frame overhead is left out.
+ */
+void test_lzss_benchmark(void)
+{
+    static const struct {
+        const char *name;
+        size_t (*fill)(uint8_t *buffer, size_t size);
+    } sets[] = {
+        { "telemetry",  lzss_fill_telemetry },
+        { "config",     lzss_fill_config },
+        { "random",     lzss_fill_random },
+    };
+    static const uint32_t baudrates[] = { 9600, 57600, 115200 };
+    const size_t chunk = 240;
+
+#if defined(__x86_64__) || defined(__i386__)
+    const char *unit = "cycles";
+#else
+    const char *unit = "ns";
+#endif
+
+    printf("\n");
+    for (size_t s=0; s<ARRAY_SIZE(sets); s++) {
+        size_t len = sets[s].fill(lzss_input, LZSS_TEST_DATA_LEN);
+        size_t packed_len = 0;
+        uint64_t compress_ticks = 0;
+        uint64_t decompress_ticks = 0;
+
+        for (size_t offset=0; offset<len; offset+=chunk) {
+            size_t chunk_len = MIN(chunk, len - offset);
+            size_t chunk_packed = 0;
+
+            uint64_t start = lzss_bench_ticks();
+            for (int r=0; r<LZSS_BENCH_ROUNDS; r++)
+                chunk_packed = lzss_compress(&lzss_input[offset], chunk_len, lzss_packed, sizeof(lzss_packed));
+            compress_ticks += lzss_bench_ticks() - start;
+
+            start = lzss_bench_ticks();
+            for (int r=0; r<LZSS_BENCH_ROUNDS; r++)
+                lzss_decompress(lzss_packed, chunk_packed, lzss_output, sizeof(lzss_output));
+            decompress_ticks += lzss_bench_ticks() - start;
+
+            CU_ASSERT_EQUAL(memcmp(lzss_output, &lzss_input[offset], chunk_len), 0);
+            packed_len += MIN(chunk_packed, chunk_len);     // Incompressible chunk is sent plain
+        }
+
+        double bytes = (double)len * LZSS_BENCH_ROUNDS;
+        printf("    lzss %-10s: %4zu -> %4zu bytes (%5.1f %%), compress %7.1f %s/byte, decompress %5.1f %s/byte\n",
+               sets[s].name, len, packed_len, 100.0 * (double)packed_len / (double)len,
+               (double)compress_ticks / bytes, unit, (double)decompress_ticks / bytes, unit);
+        for (size_t b=0; b<ARRAY_SIZE(baudrates); b++) {
+            double plain_ms = (double)len * 10 * 1000 / baudrates[b];
+            double packed_ms = (double)packed_len * 10 * 1000 / baudrates[b];
+            printf("        %6u Bd: %7.1f ms -> %7.1f ms on line, %7.1f ms saved\n",
+                   baudrates[b], plain_ms, packed_ms, plain_ms - packed_ms);
+        }
+        CU_ASSERT(packed_len <= len);
+    }
+}
@@ -5,11 +5,14 @@
 #include "mx/cba.h"
 #include "mx/misc.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 
 
 static void test_msg_list_remove(void);
+static void test_msg_list_splice(void);
+static void test_msg_ptr_refs(void);
 
 
 
@@ -23,12 +26,14 @@ CU_ErrorCode cu_test_message_list()
     }
 
     CU_add_test(suite, "Test removing msg from list",       test_msg_list_remove);
+    CU_add_test(suite, "Test splicing msg lists",           test_msg_list_splice);
+    CU_add_test(suite, "Test msg references",               test_msg_ptr_refs);
 
     return CU_get_error();
 }
 
 
-#define CBA_BUFFER_LEN      256
+#define CBA_BUFFER_LEN      512
 
 static uint8_t cba_buffer[CBA_BUFFER_LEN];
 
@@ -78,4 +83,101 @@ void test_msg_list_remove(void)
 
     tmp = msg_list_remove(&mlist, m1);
     CU_ASSERT_PTR_NULL(tmp);
+
+    // Removing last message keeps list consistent
+    msg_list_push(&mlist, m1);
+    msg_list_push(&mlist, m2);
+    msg_list_remove(&mlist, m2);
+    msg_list_push(&mlist, m3);
+    CU_ASSERT_EQUAL(2, msg_list_length(&mlist));
+    CU_ASSERT_PTR_EQUAL(m1, msg_list_pop(&mlist));
+    CU_ASSERT_PTR_EQUAL(m3, msg_list_pop(&mlist));
+    CU_ASSERT_PTR_NULL(msg_list_pop(&mlist));
+}
+
+
+void test_msg_list_splice(void)
+{
+    struct cba cba;
+    struct msg_list l1, l2;
+
+    cba_init(&cba, cba_buffer, sizeof(cba_buffer));
+
+    msg_list_init(&l1);
+    msg_list_init(&l2);
+
+    struct msg_ptr *m1 = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *m2 = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *m3 = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *m4 = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *m5 = msg_ptr_malloc(&cba, 1);
+
+    msg_list_push(&l1, m1);
+    msg_list_push(&l1, m2);
+    msg_list_push(&l2, m3);
+    msg_list_push(&l2, m4);
+
+    // Splice into non-empty list
+    msg_list_splice(&l1, &l2);
+    CU_ASSERT_EQUAL(4, msg_list_length(&l1));
+    CU_ASSERT_EQUAL(0, msg_list_length(&l2));
+    CU_ASSERT_PTR_NULL(msg_list_peek(&l2));
+
+    // Splice empty list
+    msg_list_splice(&l1, &l2);
+    CU_ASSERT_EQUAL(4, msg_list_length(&l1));
+
+    msg_list_push(&l1, m5);
+    CU_ASSERT_EQUAL(5, msg_list_length(&l1));
+
+    // Pop part of the list
+    CU_ASSERT_EQUAL(2, msg_list_pop_n(&l1, &l2, 2));
+    CU_ASSERT_EQUAL(3, msg_list_length(&l1));
+    CU_ASSERT_EQUAL(2, msg_list_length(&l2));
+    CU_ASSERT_PTR_EQUAL(m3, msg_list_peek(&l1));
+    CU_ASSERT_PTR_EQUAL(m1, msg_list_peek(&l2));
+
+    // Pop more than available
+    CU_ASSERT_EQUAL(3, msg_list_pop_n(&l1, &l2, 10));
+    CU_ASSERT_EQUAL(0, msg_list_length(&l1));
+    CU_ASSERT_EQUAL(0, msg_list_pop_n(&l1, &l2, 1));
+    CU_ASSERT_EQUAL(5, msg_list_length(&l2));
+
+    // Order is preserved
+    CU_ASSERT_PTR_EQUAL(m1, msg_list_pop(&l2));
+    CU_ASSERT_PTR_EQUAL(m2, msg_list_pop(&l2));
+    CU_ASSERT_PTR_EQUAL(m3, msg_list_pop(&l2));
+    CU_ASSERT_PTR_EQUAL(m4, msg_list_pop(&l2));
+    CU_ASSERT_PTR_EQUAL(m5, msg_list_pop(&l2));
+    CU_ASSERT_PTR_NULL(msg_list_pop(&l2));
+}
+
+
+void test_msg_ptr_refs(void)
+{
+    struct cba cba;
+    cba_init(&cba, cba_buffer, sizeof(cba_buffer));
+
+    // Message data may be mapped onto aligned structures
+    CU_ASSERT_EQUAL(offsetof(struct msg_ptr, msg) % sizeof(void*), 0);
+
+    struct msg_ptr *m1 = msg_ptr_malloc(&cba, 4);
+    CU_ASSERT_EQUAL((uintptr_t)&m1->msg % sizeof(uint32_t), 0);
+    CU_ASSERT_EQUAL(m1->refs, 1);
+
+    // Counter saturates instead of wrapping
+    bool retained = true;
+    for (uint32_t i=1; i<UINT16_MAX; i++)
+        retained &= (msg_ptr_retain(m1) == m1);
+    CU_ASSERT_TRUE(retained);
+    CU_ASSERT_EQUAL(m1->refs, UINT16_MAX);
+    CU_ASSERT_PTR_NULL(msg_ptr_retain(m1));
+    CU_ASSERT_EQUAL(m1->refs, UINT16_MAX);
+
+    // Memory is returned with the last reference
+    for (uint32_t i=1; i<UINT16_MAX; i++)
+        msg_ptr_free(&cba, m1);
+    CU_ASSERT_EQUAL(m1->refs, 1);
+    msg_ptr_free(&cba, m1);
+    CU_ASSERT_EQUAL(cba.free_idx, 0);
 }
@@ -3,6 +3,7 @@
 
 #include "mx/core/message-queue.h"
 #include "mx/cba.h"
+#include "mx/timer.h"
 #include "mx/misc.h"
 
 #include <stdio.h>
@@ -10,6 +11,9 @@
 
 
 static void test_msg_queue_basic(void);
+static void test_msg_queue_aging(void);
+static void test_msg_queue_drain(void);
+static void test_msg_queue_edf(void);
 
 
 
@@ -23,12 +27,15 @@ CU_ErrorCode cu_test_message_queue()
     }
 
     CU_add_test(suite, "Test msg queue basic operations",   test_msg_queue_basic);
+    CU_add_test(suite, "Test msg queue aging",              test_msg_queue_aging);
+    CU_add_test(suite, "Test msg queue draining",           test_msg_queue_drain);
+    CU_add_test(suite, "Test msg queue deadline order",     test_msg_queue_edf);
 
     return CU_get_error();
 }
 
 
-#define CBA_BUFFER_LEN      256
+#define CBA_BUFFER_LEN      512
 
 static uint8_t cba_buffer[CBA_BUFFER_LEN];
 
@@ -96,3 +103,167 @@ void test_msg_queue_basic(void)
     tmp = msg_queue_push(&mqueue, MSG_PRIO_ANY, NULL);
     CU_ASSERT_PTR_NULL(tmp);
 }
+
+
+void test_msg_queue_aging(void)
+{
+    struct cba cba;
+    struct msg_queue mqueue;
+
+    cba_init(&cba, cba_buffer, sizeof(cba_buffer));
+
+    msg_queue_init(&mqueue);
+    msg_queue_set_max_delay(&mqueue, MSG_PRIO_LOW, 100);
+
+    struct msg_ptr *low = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *h1 = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *h2 = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *h3 = msg_ptr_malloc(&cba, 1);
+
+    struct msg_ptr *tmp;
+    uint8_t prio;
+
+    msg_queue_push(&mqueue, MSG_PRIO_LOW, low);
+    msg_queue_push(&mqueue, MSG_PRIO_HIGH, h1);
+    msg_queue_push(&mqueue, MSG_PRIO_HIGH, h2);
+
+    // Strict priority until aging limit is reached
+    clock_update(50, 0);
+    tmp = msg_queue_pop(&mqueue, &prio);
+    CU_ASSERT_PTR_EQUAL(tmp, h1);
+    CU_ASSERT_EQUAL(prio, MSG_PRIO_HIGH);
+    msg_queue_push(&mqueue, MSG_PRIO_HIGH, h1);
+
+    // Low priority message is overdue now
+    clock_update(50, 0);
+    msg_queue_push(&mqueue, MSG_PRIO_HIGH, h3);
+    tmp = msg_queue_peek(&mqueue, &prio);
+    CU_ASSERT_PTR_EQUAL(tmp, low);
+    CU_ASSERT_EQUAL(prio, MSG_PRIO_LOW);
+    tmp = msg_queue_pop(&mqueue, &prio);
+    CU_ASSERT_PTR_EQUAL(tmp, low);
+    CU_ASSERT_EQUAL(prio, MSG_PRIO_LOW);
+    CU_ASSERT_EQUAL(msg_queue_get_worst_delay(&mqueue, MSG_PRIO_LOW), 100);
+
+    // Excluded list is never selected
+    msg_queue_push(&mqueue, MSG_PRIO_LOW, low);
+    clock_update(200, 0);
+    CU_ASSERT_PTR_EQUAL(msg_queue_select_msg_list(&mqueue, &prio, 0x1 << MSG_PRIO_LOW), msg_queue_get_msg_list(&mqueue, MSG_PRIO_HIGH));
+    CU_ASSERT_EQUAL(prio, MSG_PRIO_HIGH);
+
+    // Disabled aging restores strict priority
+    msg_queue_set_max_delay(&mqueue, MSG_PRIO_LOW, 0);
+    tmp = msg_queue_pop(&mqueue, &prio);
+    CU_ASSERT_PTR_EQUAL(tmp, h2);
+    tmp = msg_queue_pop(&mqueue, &prio);
+    CU_ASSERT_PTR_EQUAL(tmp, h1);
+    tmp = msg_queue_pop(&mqueue, &prio);
+    CU_ASSERT_PTR_EQUAL(tmp, h3);
+    CU_ASSERT_EQUAL(msg_queue_get_worst_delay(&mqueue, MSG_PRIO_HIGH), 300);
+    tmp = msg_queue_pop(&mqueue, &prio);
+    CU_ASSERT_PTR_EQUAL(tmp, low);
+    CU_ASSERT_EQUAL(prio, MSG_PRIO_LOW);
+    CU_ASSERT_EQUAL(msg_queue_get_worst_delay(&mqueue, MSG_PRIO_LOW), 200);
+
+    msg_queue_reset(&mqueue);
+    CU_ASSERT_EQUAL(0, msg_queue_length(&mqueue));
+    CU_ASSERT_EQUAL(msg_queue_get_worst_delay(&mqueue, MSG_PRIO_LOW), 200);
+}
+
+
+void test_msg_queue_drain(void)
+{
+    struct cba cba;
+    struct msg_queue mqueue;
+    struct msg_list mlist;
+
+    cba_init(&cba, cba_buffer, sizeof(cba_buffer));
+
+    msg_queue_init(&mqueue);
+    msg_list_init(&mlist);
+
+    struct msg_ptr *m1 = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *m2 = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *m3 = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *m4 = msg_ptr_malloc(&cba, 1);
+
+    msg_list_push(&mlist, m1);
+    msg_queue_push(&mqueue, MSG_PRIO_LOW, m2);
+    msg_queue_push(&mqueue, MSG_PRIO_HIGH, m3);
+    msg_queue_push(&mqueue, MSG_PRIO_LOW, m4);
+
+    CU_ASSERT_EQUAL(3, msg_queue_drain_into(&mqueue, &mlist));
+    CU_ASSERT_EQUAL(0, msg_queue_length(&mqueue));
+    CU_ASSERT_EQUAL(4, msg_list_length(&mlist));
+
+    CU_ASSERT_PTR_EQUAL(m1, msg_list_pop(&mlist));
+    CU_ASSERT_PTR_EQUAL(m3, msg_list_pop(&mlist));
+    CU_ASSERT_PTR_EQUAL(m2, msg_list_pop(&mlist));
+    CU_ASSERT_PTR_EQUAL(m4, msg_list_pop(&mlist));
+
+    CU_ASSERT_EQUAL(0, msg_queue_drain_into(&mqueue, &mlist));
+}
+
+
+void test_msg_queue_edf(void)
+{
+    struct cba cba;
+    struct msg_queue mqueue;
+
+    cba_init(&cba, cba_buffer, sizeof(cba_buffer));
+
+    msg_queue_init(&mqueue);
+    msg_queue_set_edf(&mqueue, MSG_PRIO_NORMAL, true);
+
+    struct msg_ptr *none = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *late = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *early = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *early2 = msg_ptr_malloc(&cba, 1);
+    struct msg_ptr *wrapped = msg_ptr_malloc(&cba, 1);
+
+    late->has_deadline = true;
+    late->deadline = 0x10;
+    early->has_deadline = true;
+    early->deadline = 0xFFFFFFF0;
+    early2->has_deadline = true;
+    early2->deadline = 0xFFFFFFF0;
+    wrapped->has_deadline = true;
+    wrapped->deadline = 0;
+
+    // Expiration is checked across clock wrap
+    CU_ASSERT_FALSE(msg_ptr_expired_at(none, 0x7FFFFFFF));
+    CU_ASSERT_FALSE(msg_ptr_expired_at(late, 0xFFFFFFF0));
+    CU_ASSERT_FALSE(msg_ptr_expired_at(late, 0x10));
+    CU_ASSERT_TRUE(msg_ptr_expired_at(late, 0x11));
+    CU_ASSERT_TRUE(msg_ptr_expired_at(early, 0x00));
+
+    // Deadline order across clock wrap, FIFO among equal deadlines, no deadline last
+    msg_queue_push_at(&mqueue, MSG_PRIO_NORMAL, none, 0xFFFFFF00);
+    msg_queue_push_at(&mqueue, MSG_PRIO_NORMAL, late, 0xFFFFFF00);
+    msg_queue_push_at(&mqueue, MSG_PRIO_NORMAL, early, 0xFFFFFF00);
+    msg_queue_push_at(&mqueue, MSG_PRIO_NORMAL, wrapped, 0xFFFFFF00);
+    msg_queue_push_at(&mqueue, MSG_PRIO_NORMAL, early2, 0xFFFFFF00);
+    CU_ASSERT_EQUAL(5, msg_queue_length(&mqueue));
+
+    CU_ASSERT_PTR_EQUAL(early, msg_queue_pop(&mqueue, NULL));
+    CU_ASSERT_PTR_EQUAL(early2, msg_queue_pop(&mqueue, NULL));
+    CU_ASSERT_PTR_EQUAL(wrapped, msg_queue_pop(&mqueue, NULL));
+    CU_ASSERT_PTR_EQUAL(late, msg_queue_pop(&mqueue, NULL));
+    CU_ASSERT_PTR_EQUAL(none, msg_queue_pop(&mqueue, NULL));
+    CU_ASSERT_PTR_EQUAL(NULL, msg_queue_pop(&mqueue, NULL));
+
+    // Pinned messages are not overtaken
+    msg_queue_push_at(&mqueue, MSG_PRIO_NORMAL, late, 0);
+    msg_queue_push_at(&mqueue, MSG_PRIO_NORMAL, none, 0);
+    msg_queue_push_pinned_at(&mqueue, MSG_PRIO_NORMAL, wrapped, 0, 1);
+    CU_ASSERT_PTR_EQUAL(late, msg_queue_pop(&mqueue, NULL));
+    CU_ASSERT_PTR_EQUAL(wrapped, msg_queue_pop(&mqueue, NULL));
+    CU_ASSERT_PTR_EQUAL(none, msg_queue_pop(&mqueue, NULL));
+
+    // FIFO order otherwise
+    msg_queue_set_edf(&mqueue, MSG_PRIO_NORMAL, false);
+    msg_queue_push_at(&mqueue, MSG_PRIO_NORMAL, late, 0);
+    msg_queue_push_at(&mqueue, MSG_PRIO_NORMAL, wrapped, 0);
+    CU_ASSERT_PTR_EQUAL(late, msg_queue_pop(&mqueue, NULL));
+    CU_ASSERT_PTR_EQUAL(wrapped, msg_queue_pop(&mqueue, NULL));
+}
@@ -0,0 +1,111 @@
+
+#include <CUnit/Basic.h>
+
+#include "mx/core/message-schema.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+
+static void test_msg_schema_layout(void);
+static void test_msg_schema_pack_unpack(void);
+static void test_msg_schema_view(void);
+
+
+
+CU_ErrorCode cu_test_message_schema()
+{
+    // Test logging to terminal
+    CU_pSuite suite = CU_add_suite("Test message schema", NULL, NULL);
+    if ( !suite ) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_add_test(suite, "Test schema wire layout",           test_msg_schema_layout);
+    CU_add_test(suite, "Test schema pack and unpack",       test_msg_schema_pack_unpack);
+    CU_add_test(suite, "Test schema zero-copy view",        test_msg_schema_view);
+
+    return CU_get_error();
+}
+
+
+
+#define MSG_TEST_FIELDS(FIELD, msg)             \
+    FIELD(msg, int16_t,     temperature)        \
+    FIELD(msg, uint8_t,     sensor)             \
+    FIELD(msg, uint32_t,    timestamp)
+
+MSG_SCHEMA(msg_test, MSG_TEST_FIELDS)
+MSG_SCHEMA_ASSERT_LEN(msg_test, uint8_t);
+
+
+
+void test_msg_schema_layout(void)
+{
+    CU_ASSERT_EQUAL(msg_test_size, sizeof(msgtype_t) + 2 + 1 + 4);
+
+    struct msg_test wire;
+    memset(&wire, 0, sizeof(wire));
+
+    wire.type = 0x12;
+    msg_test_set_temperature(&wire, -2);
+    msg_test_set_sensor(&wire, 7);
+    msg_test_set_timestamp(&wire, 0x01020304);
+
+    const uint8_t *bytes = (const uint8_t*)&wire;
+    size_t off = sizeof(msgtype_t);
+    CU_ASSERT_EQUAL(bytes[off+0], 0xFF);
+    CU_ASSERT_EQUAL(bytes[off+1], 0xFE);
+    CU_ASSERT_EQUAL(bytes[off+2], 7);
+    CU_ASSERT_EQUAL(bytes[off+3], 0x01);
+    CU_ASSERT_EQUAL(bytes[off+4], 0x02);
+    CU_ASSERT_EQUAL(bytes[off+5], 0x03);
+    CU_ASSERT_EQUAL(bytes[off+6], 0x04);
+
+    CU_ASSERT_EQUAL(msg_test_get_temperature(&wire), -2);
+    CU_ASSERT_EQUAL(msg_test_get_sensor(&wire), 7);
+    CU_ASSERT_EQUAL(msg_test_get_timestamp(&wire), 0x01020304);
+}
+
+
+
+void test_msg_schema_pack_unpack(void)
+{
+    struct msg_test_host in = {
+        .type = 0x21,
+        .temperature = -300,
+        .sensor = 200,
+        .timestamp = 0xDEADBEEF
+    };
+    struct msg_test_host out;
+    struct msg_test wire;
+
+    msg_test_pack(&wire, &in);
+    memset(&out, 0, sizeof(out));
+    msg_test_unpack(&out, &wire);
+
+    CU_ASSERT_EQUAL(out.type, 0x21);
+    CU_ASSERT_EQUAL(out.temperature, -300);
+    CU_ASSERT_EQUAL(out.sensor, 200);
+    CU_ASSERT_EQUAL(out.timestamp, 0xDEADBEEF);
+}
+
+
+
+void test_msg_schema_view(void)
+{
+    uint8_t buffer[16];
+    memset(buffer, 0, sizeof(buffer));
+
+    buffer[sizeof(msgtype_t) + 2] = 9;
+    const struct msg *msg = (const struct msg*)buffer;
+
+    CU_ASSERT_PTR_NULL(msg_test_view(msg, msg_test_size - 1));
+    CU_ASSERT_PTR_NULL(msg_test_view(NULL, msg_test_size));
+
+    const struct msg_test *view = msg_test_view(msg, msg_test_size);
+    CU_ASSERT_PTR_EQUAL(view, buffer);
+    CU_ASSERT_EQUAL(msg_test_get_sensor(view), 9);
+}
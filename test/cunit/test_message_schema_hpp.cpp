@@ -0,0 +1,85 @@
+#include <CUnit/Basic.h>
+
+#include "mx/core/message-schema.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+
+static void test_msg_schema_hpp_layout(void);
+static void test_msg_schema_hpp_view(void);
+
+
+
+extern "C" CU_ErrorCode cu_test_message_schema_hpp()
+{
+    // Test logging to terminal
+    CU_pSuite suite = CU_add_suite("Test message schema C++", NULL, NULL);
+    if ( !suite ) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_add_test(suite, "Test schema C++ wire layout",       test_msg_schema_hpp_layout);
+    CU_add_test(suite, "Test schema C++ zero-copy view",    test_msg_schema_hpp_view);
+
+    return CU_get_error();
+}
+
+
+
+struct msg_test_hpp
+{
+    MSG_BASE();
+    mx::be<std::int16_t>    temperature;
+    mx::be<std::uint8_t>    sensor;
+    mx::be<std::uint64_t>   counter;
+}
+__attribute__((packed));
+
+static_assert(mx::msg_size<msg_test_hpp> == sizeof(msgtype_t) + 2 + 1 + 8, "unexpected message size");
+static_assert(mx::msg_fits<msg_test_hpp, std::uint8_t>, "message does not fit into uint8_t length");
+static_assert(!mx::msg_fits<msg_test_hpp[32], std::uint8_t>, "message array fits into uint8_t length");
+
+
+
+void test_msg_schema_hpp_layout(void)
+{
+    msg_test_hpp wire;
+    std::memset(&wire, 0, sizeof(wire));
+
+    wire.type = 0x12;
+    wire.temperature = -2;
+    wire.sensor = 7;
+    wire.counter = 0x0102030405060708ULL;
+
+    const std::uint8_t *bytes = reinterpret_cast<const std::uint8_t*>(&wire);
+    std::size_t off = sizeof(msgtype_t);
+    CU_ASSERT_EQUAL(bytes[off+0], 0xFF);
+    CU_ASSERT_EQUAL(bytes[off+1], 0xFE);
+    CU_ASSERT_EQUAL(bytes[off+2], 7);
+    CU_ASSERT_EQUAL(bytes[off+3], 0x01);
+    CU_ASSERT_EQUAL(bytes[off+10], 0x08);
+
+    CU_ASSERT_EQUAL(wire.temperature.get(), -2);
+    CU_ASSERT_EQUAL(wire.sensor.get(), 7);
+    CU_ASSERT(wire.counter.get() == 0x0102030405060708ULL);
+}
+
+
+
+void test_msg_schema_hpp_view(void)
+{
+    std::uint8_t buffer[16];
+    std::memset(buffer, 0, sizeof(buffer));
+
+    buffer[sizeof(msgtype_t) + 2] = 9;
+    const struct msg *msg = reinterpret_cast<const struct msg*>(buffer);
+
+    CU_ASSERT_PTR_NULL(mx::msg_view<msg_test_hpp>(msg, sizeof(msg_test_hpp) - 1));
+    CU_ASSERT_PTR_NULL(mx::msg_view<msg_test_hpp>(nullptr, sizeof(msg_test_hpp)));
+
+    const msg_test_hpp *view = mx::msg_view<msg_test_hpp>(msg, sizeof(msg_test_hpp));
+    CU_ASSERT_PTR_EQUAL(view, buffer);
+    CU_ASSERT_EQUAL(view->sensor.get(), 9);
+}
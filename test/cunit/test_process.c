@@ -8,6 +8,7 @@
 #include "mx/misc.h"
 
 #include <stdio.h>
+#include <string.h>
 
 
 
@@ -20,6 +21,8 @@ static void test_process_post_alloc_msg(void);
 static void test_process_send_msg(void);
 static void test_process_timer(void);
 static void test_process_problems(void);
+static void test_process_forward_msg(void);
+static void test_process_share_broadcast(void);
 
 
 CU_ErrorCode cu_test_process()
@@ -40,6 +43,8 @@ CU_ErrorCode cu_test_process()
     CU_add_test(suite, "Test send msg to process",              test_process_send_msg);
     CU_add_test(suite, "Test process timers",                   test_process_timer);
     CU_add_test(suite, "Test process problems",                 test_process_problems);
+    CU_add_test(suite, "Test forward msg without copying",      test_process_forward_msg);
+    CU_add_test(suite, "Test share broadcast msg",              test_process_share_broadcast);
 
 
     return CU_get_error();
@@ -65,6 +70,9 @@ struct mx_msg_custom
 
 
 struct msg_p4 last_msg;
+struct msg *last_msg_ptr;
+struct msg *relay_msg_ptr;
+struct msg *taken_msg_ptr;
 
 enum test_msgtype_e
 {
@@ -75,6 +83,8 @@ enum test_msgtype_e
     TEST_EV_EXIT,
     TEST_EV_POLL,
     TEST_EV_BROADCAST,
+    TEST_EV_RELAY,
+    TEST_EV_SHARE,
     TEST_EV_P0 = 0x30,
     TEST_EV_P1,
     TEST_EV_P2,
@@ -97,6 +107,7 @@ PROCESS_THREAD(proc1, ev, msg)
 
     while (1) {
         last_msg.type = ev;
+        last_msg_ptr = msg;
         if (ev == PROCESS_EV_EXIT)
             break;
         if (ev == TEST_EV_POLL) {
@@ -145,10 +156,69 @@ PROCESS_THREAD(proc2, ev, msg)
     while (1) {
         if (ev == TEST_EV_EXIT)
             break;
+        if (ev == TEST_EV_RELAY) {
+            relay_msg_ptr = msg;
+            process_forward_msg(&proc1, msg);
+            process_forward_msg(&proc1, msg);   // Shared again
+            taken_msg_ptr = process_take_msg(msg);
+        }
+
+        PROCESS_YIELD();
+    }
+
+    PROCESS_END();
+    return PT_ENDED;
+}
+
+
+#define SHARE_PROCESSES     3
+
+struct msg *shared_msg_ptr[SHARE_PROCESSES];
+
+/**
+ * Keep received broadcast and forward it to proc1
+ *
+ */
+static void share_msg(unsigned int idx, msgtype_t ev, struct msg *msg)
+{
+    if (ev == TEST_EV_SHARE) {
+        shared_msg_ptr[idx] = process_take_msg(msg);
+        process_forward_msg(&proc1, msg);
+    }
+}
+
+PROCESS(share0, "SHARE0");
+PROCESS_THREAD(share0, ev, msg)
+{
+    PROCESS_BEGIN();
+    while (1) {
+        share_msg(0, ev, msg);
+        PROCESS_YIELD();
+    }
+    PROCESS_END();
+    return PT_ENDED;
+}
 
+PROCESS(share1, "SHARE1");
+PROCESS_THREAD(share1, ev, msg)
+{
+    PROCESS_BEGIN();
+    while (1) {
+        share_msg(1, ev, msg);
         PROCESS_YIELD();
     }
+    PROCESS_END();
+    return PT_ENDED;
+}
 
+PROCESS(share2, "SHARE2");
+PROCESS_THREAD(share2, ev, msg)
+{
+    PROCESS_BEGIN();
+    while (1) {
+        share_msg(2, ev, msg);
+        PROCESS_YIELD();
+    }
     PROCESS_END();
     return PT_ENDED;
 }
@@ -478,3 +548,94 @@ void test_process_problems(void)
     status = process_send_msg_data(&proc1, TEST_EV_EMPTY, NULL, sizeof(process_buffer));
     CU_ASSERT_EQUAL(status, PROCESS_ERR_NO_MEMORY);
 }
+
+
+void test_process_forward_msg(void)
+{
+    unsigned int events;
+    uint32_t process_buffer[256];
+
+    process_init(process_buffer, sizeof(process_buffer));
+    process_start(&proc1);
+    process_start(&proc2);
+
+    uint8_t data = 0xDA;
+    process_send_msg_data(&proc2, TEST_EV_RELAY, &data, 1);
+    events = process_run();
+    CU_ASSERT_EQUAL(events, 2);
+    CU_ASSERT_PTR_EQUAL(taken_msg_ptr, relay_msg_ptr);
+
+    events = process_run();
+    CU_ASSERT_EQUAL(last_msg.type, TEST_EV_RELAY);
+    CU_ASSERT_PTR_EQUAL(last_msg_ptr, relay_msg_ptr);
+    CU_ASSERT_EQUAL(((struct msg_data*)last_msg_ptr)->data[0], 0xDA);
+    CU_ASSERT_EQUAL(events, 1);
+
+    events = process_run();
+    CU_ASSERT_EQUAL(last_msg.type, TEST_EV_RELAY);
+    CU_ASSERT_PTR_EQUAL(last_msg_ptr, relay_msg_ptr);
+    CU_ASSERT_EQUAL(((struct msg_data*)last_msg_ptr)->data[0], 0xDA);
+    CU_ASSERT_EQUAL(events, 0);
+
+    CU_ASSERT_EQUAL(((struct msg_data*)taken_msg_ptr)->data[0], 0xDA);
+    process_free(taken_msg_ptr);
+
+    // Synchronous messages could not be forwarded
+    struct msg tmp_msg = {.type = TEST_EV_EMPTY};
+    CU_ASSERT_EQUAL(process_forward_msg(&proc1, &tmp_msg), PROCESS_ERR_NOT_POSSIBLE);
+    CU_ASSERT_PTR_NULL(process_take_msg(&tmp_msg));
+
+    // All messages were released
+    struct msg *msg = process_malloc(sizeof(process_buffer) - 64);
+    CU_ASSERT_PTR_NOT_NULL(msg);
+    process_free(msg);
+
+    process_exit(&proc1);
+    process_exit(&proc2);
+}
+
+
+void test_process_share_broadcast(void)
+{
+    unsigned int events;
+    uint32_t process_buffer[256];
+
+    process_init(process_buffer, sizeof(process_buffer));
+    process_start(&proc1);
+    process_start(&share0);
+    process_start(&share1);
+    process_start(&share2);
+
+    // Payload would not fit into memory if it was copied for every receiver
+    uint8_t data[sizeof(process_buffer) / 3];
+    memset(data, 0x5E, sizeof(data));
+    process_send_msg_data(PROCESS_BROADCAST, TEST_EV_SHARE, data, sizeof(data));
+    events = process_run();
+    CU_ASSERT_EQUAL(events, SHARE_PROCESSES);
+
+    CU_ASSERT_PTR_NOT_NULL(shared_msg_ptr[0]);
+    for (int i=0; i<SHARE_PROCESSES; i++) {
+        CU_ASSERT_PTR_EQUAL(shared_msg_ptr[i], shared_msg_ptr[0]);
+    }
+
+    for (int i=0; i<SHARE_PROCESSES; i++) {
+        last_msg_ptr = NULL;
+        process_run();
+        CU_ASSERT_EQUAL(last_msg.type, TEST_EV_SHARE);
+        CU_ASSERT_PTR_EQUAL(last_msg_ptr, shared_msg_ptr[0]);
+    }
+    CU_ASSERT_EQUAL(((struct msg_data*)shared_msg_ptr[0])->data[sizeof(data) - 1], 0x5E);
+
+    for (int i=0; i<SHARE_PROCESSES; i++)
+        process_free(shared_msg_ptr[i]);
+
+    // All messages were released
+    struct msg *msg = process_malloc(sizeof(process_buffer) - 64);
+    CU_ASSERT_PTR_NOT_NULL(msg);
+    process_free(msg);
+
+    process_exit(&share2);
+    process_exit(&share1);
+    process_exit(&share0);
+    process_exit(&proc1);
+}